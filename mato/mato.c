@@ -4,6 +4,10 @@
 #include "mato_core.h"
 #include "mato_net.h"
 #include "mato_logs.h"
+#include "mato_pool.h"
+#include "mato_timer.h"
+#include "mato_recorder.h"
+#include "mato_requests.h"
 
 // default values go to framework config to appear soon
 #define DEFAULT_PRINT_ALL_LOGS_TO_CONSOLE 1
@@ -14,6 +18,33 @@
 /// \file mato.c
 /// Implementation of the Mato control framework: public functions.
 
+/// The start-up of a local module instance: when it was created and started, and which modules must be started before it.
+typedef struct {
+    long long create_duration;
+    long long start_begin;
+    long long start_end;
+    /// of int, local module_ids
+    GArray *dependencies;
+    /// set when mato_start() has assigned the module to a starting thread
+    int starting;
+    int started;
+} module_startup;
+
+/// of module_startup, indexed by local module_id, protected by startup_lock
+static GArray *startups;
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t module_started_cond = PTHREAD_COND_INITIALIZER;
+
+/// the number of batches posted by mato_post_data_batch(), gives each batch its key in the post_queue
+static atomic_ullong batches_posted;
+
+/// Returns the start-up record of the local module, creates the missing ones. Startups must be locked.
+static module_startup *get_startup(int module_id)
+{
+    if (startups == 0) startups = g_array_new(0, 1, sizeof(module_startup));
+    if (module_id >= startups->len) g_array_set_size(startups, module_id + 1);
+    return &g_array_index(startups, module_startup, module_id);
+}
 
 void mato_init(int this_node_identifier, char *mato_config_filename)
 {
@@ -40,33 +71,40 @@ int mato_create_new_module_instance(const char *module_type, const char *module_
         char *name = malloc(strlen(module_name) + 1);
         strcpy(name, module_name);
         g_array_append_val(g_array_index(module_names, GArray *, this_node_id), name);
-        char *type = malloc(strlen(module_name) + 1);
+        char *type = malloc(strlen(module_type) + 1);
         strcpy(type, module_type);
         g_array_append_val(g_array_index(module_types, GArray *, this_node_id), type);
+        index_module(this_node_id, module_id);
+
+        module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
+        g_array_append_val(instance_specifications, spec);
 
-        GArray *channels_subscriptions = g_array_new(0, 0, sizeof(GArray *));
+        GArray *channels_subscriptions = g_array_new(0, 0, sizeof(subscription_list *));
         g_array_append_val(g_array_index(subscriptions,GArray *,this_node_id), channels_subscriptions);
 
-        GArray *module_buffers = g_array_new(0, 0, sizeof(GArray *));
+        GArray *module_buffers = g_array_new(0, 0, sizeof(channel_buffers *));
         g_array_append_val(g_array_index(buffers,GArray *,this_node_id), module_buffers);
 
-        module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
         int num_channels = spec->number_of_channels;
 
         for (int channel_id = 0; channel_id < num_channels; channel_id++)
         {
-           GArray *subs_for_channel = g_array_new(0, 0, sizeof(GArray *));
+           subscription_list *subs_for_channel = new_subscription_list();
            g_array_append_val(channels_subscriptions, subs_for_channel);
 
-           GList *channel_buffers = 0;
-           g_array_append_val(module_buffers, channel_buffers);
+           channel_buffers *cb = new_channel_buffers();
+           g_array_append_val(module_buffers, cb);
         }
 
         create_instance_callback create_instance = spec->create_instance;
     unlock_framework();
 
     int public_module_id = module_id + this_node_id * NODE_MULTIPLIER;
+    long long create_begin = monotonic_usec();
     void *module_instance_data = create_instance(public_module_id);
+    pthread_mutex_lock(&startup_lock);
+        get_startup(module_id)->create_duration = monotonic_usec() - create_begin;
+    pthread_mutex_unlock(&startup_lock);
 
     lock_framework();
         g_array_append_val(instance_data, module_instance_data);
@@ -80,25 +118,188 @@ int mato_create_new_module_instance(const char *module_type, const char *module_
 
 void mato_start_module(int module_id)
 {
-    lock_framework();
-        char *module_type = g_array_index(g_array_index(module_types, GArray *, this_node_id), char *, module_id);
-        if (module_type == 0) return;
-        module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
-        if (spec != 0)
-        {
-            void *data = g_array_index(instance_data, void *, module_id);
+    lock_framework_read();
+        module_specification *spec = g_array_index(instance_specifications, module_specification *, module_id);
+        void *data = g_array_index(instance_data, void *, module_id);
     unlock_framework();
-            spec->start_instance(data);
+    if (spec != 0)
+        spec->start_instance(data);
+}
+
+int mato_add_start_dependency(int module_id, int depends_on_module_id)
+{
+    if ((module_id / NODE_MULTIPLIER != this_node_id) || (depends_on_module_id / NODE_MULTIPLIER != this_node_id) ||
+        (module_id == depends_on_module_id) || modules_started) return 0;
+    lock_framework_read();
+        int number_of_modules = g_array_index(module_names, GArray *, this_node_id)->len;
+    unlock_framework();
+    if ((module_id % NODE_MULTIPLIER >= number_of_modules) || (depends_on_module_id % NODE_MULTIPLIER >= number_of_modules)) return 0;
+    int depends_on = depends_on_module_id % NODE_MULTIPLIER;
+    pthread_mutex_lock(&startup_lock);
+        module_startup *startup = get_startup(module_id % NODE_MULTIPLIER);
+        if (startup->dependencies == 0) startup->dependencies = g_array_new(0, 0, sizeof(int));
+        g_array_append_val(startup->dependencies, depends_on);
+    pthread_mutex_unlock(&startup_lock);
+    return 1;
+}
+
+/// Returns the first module that the module depends on and that has not been started yet, or -1. Startups must be locked.
+static int unstarted_dependency(module_startup *startup)
+{
+    for (int i = 0; startup->dependencies && (i < startup->dependencies->len); i++)
+    {
+        int depends_on = g_array_index(startup->dependencies, int, i);
+        if ((depends_on < startups->len) && !g_array_index(startups, module_startup, depends_on).started)
+            return depends_on;
+    }
+    return -1;
+}
+
+/// Returns 1 if all modules that the module depends on have been started. Startups must be locked.
+static int dependencies_started(module_startup *startup)
+{
+    return unstarted_dependency(startup) < 0;
+}
+
+/// All modules that remain to be started wait for each other. Follow their dependencies from the waiting module
+/// until they form a cycle, log the modules of the cycle, and drop the dependencies that form it. Startups must be locked.
+static void break_dependency_cycle(int module_id)
+{
+    // a waiting module always depends on another waiting module, so the path ends in a cycle
+    char *visited = (char *)calloc(startups->len, 1);
+    while (!visited[module_id])
+    {
+        visited[module_id] = 1;
+        module_id = unstarted_dependency(&g_array_index(startups, module_startup, module_id));
+    }
+    free(visited);
+
+    GArray *names = g_array_index(module_names, GArray *, this_node_id);
+    char msg[400];
+    int length = snprintf(msg, 400, "circular start dependencies, ignoring %s", g_array_index(names, char *, module_id));
+    int first = module_id;
+    do
+    {
+        module_startup *startup = &g_array_index(startups, module_startup, module_id);
+        int depends_on = unstarted_dependency(startup);
+        for (int i = startup->dependencies->len - 1; i >= 0; i--)
+            if (g_array_index(startup->dependencies, int, i) == depends_on)
+                g_array_remove_index(startup->dependencies, i);
+        if (length < 400)
+            length += snprintf(msg + length, 400 - length, " -> %s", g_array_index(names, char *, depends_on));
+        module_id = depends_on;
+    } while (module_id != first);
+    mato_log(ML_ERR, msg);
+}
+
+/// Assign the next module that is ready to be started to the calling thread, waits while the modules that are not
+/// ready yet wait for the modules being started. Returns -1 when there are no more modules to start.
+/// Startups must be locked.
+static int next_module_to_start()
+{
+    while (1)
+    {
+        int waiting = 0, in_progress = 0, some_waiting_module = -1;
+        for (int module_id = 0; module_id < startups->len; module_id++)
+        {
+            module_startup *startup = &g_array_index(startups, module_startup, module_id);
+            if (startup->started) continue;
+            if (startup->starting) in_progress++;
+            else if (dependencies_started(startup))
+            {
+                startup->starting = 1;
+                return module_id;
+            }
+            else
+            {
+                waiting++;
+                some_waiting_module = module_id;
+            }
+        }
+        if (waiting == 0) return -1;
+        if (in_progress == 0)
+        {
+            // nothing will ever be started that the waiting modules depend on
+            break_dependency_cycle(some_waiting_module);
+            continue;
+        }
+        pthread_cond_wait(&module_started_cond, &startup_lock);
+    }
+}
+
+/// A thread of mato_start() that starts the modules one after another, as soon as their dependencies have been started.
+static void *starting_thread(void *arg)
+{
+    mato_inc_system_thread_count("mato_start");
+    pthread_mutex_lock(&startup_lock);
+        int module_id;
+        while ((module_id = next_module_to_start()) >= 0)
+        {
+            g_array_index(startups, module_startup, module_id).start_begin = monotonic_usec();
+    pthread_mutex_unlock(&startup_lock);
+            mato_start_module(module_id);
+    pthread_mutex_lock(&startup_lock);
+            module_startup *startup = &g_array_index(startups, module_startup, module_id);
+            startup->start_end = monotonic_usec();
+            startup->started = 1;
+            pthread_cond_broadcast(&module_started_cond);
+        }
+    pthread_mutex_unlock(&startup_lock);
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+/// Write the durations of the creation and start of each module into the log.
+static void log_startup_timeline(int n, long long t0)
+{
+    char msg[200];
+    lock_framework_read();
+        for (int module_id = 0; module_id < n; module_id++)
+        {
+            module_startup *startup = &g_array_index(startups, module_startup, module_id);
+            if (g_array_index(instance_specifications, module_specification *, module_id) == 0) continue;
+            sprintf(msg, "startup: %.60s created in %.1f ms, started at +%.1f ms in %.1f ms",
+                    g_array_index(g_array_index(module_names, GArray *, this_node_id), char *, module_id),
+                    startup->create_duration / 1000.0, (startup->start_begin - t0) / 1000.0,
+                    (startup->start_end - startup->start_begin) / 1000.0);
+            mato_log(ML_INFO, msg);
         }
-        else
     unlock_framework();
+    sprintf(msg, "startup: %d modules started in %.1f ms", n, (monotonic_usec() - t0) / 1000.0);
+    mato_log(ML_INFO, msg);
 }
 
 void mato_start()
 {
     int n = g_array_index(module_names, GArray *, this_node_id)->len;
-    for (int module_id = 0; module_id < n; module_id++)
-        mato_start_module(module_id);
+    long long t0 = monotonic_usec();
+    recorder_init();
+    if (n == 0)
+    {
+        // a node without modules of its own
+        modules_started = 1;
+        return;
+    }
+    pthread_mutex_lock(&startup_lock);
+        get_startup(n - 1);
+        int number_of_threads = mato_core_config.start_threads;
+        if (number_of_threads > n) number_of_threads = n;
+    pthread_mutex_unlock(&startup_lock);
+    if (number_of_threads < 1) number_of_threads = 1;
+
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * number_of_threads);
+    int started = 0;
+    for (int i = 0; i < number_of_threads; i++)
+        if (pthread_create(&threads[started], 0, starting_thread, 0) != 0)
+            mato_log_val(ML_ERR, "could not create thread for starting modules", errno);
+        else started++;
+    if (started == 0) starting_thread(0);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], 0);
+    free(threads);
+
+    log_startup_timeline(n, t0);
+    modules_started = 1;
 }
 
 void mato_delete_module_instance(int module_id)
@@ -109,10 +310,9 @@ void mato_delete_module_instance(int module_id)
 
     lock_framework();
 
-        char *module_type = g_array_index(g_array_index(module_types, GArray *, this_node_id), char *, module_id);
+        module_specification *spec = g_array_index(instance_specifications, module_specification *, module_id);
         void *data = g_array_index(instance_data, void *, module_id);
-
-        module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
+        timers_remove_module(module_id);
     unlock_framework();
 
     spec->delete_instance(data);
@@ -120,6 +320,7 @@ void mato_delete_module_instance(int module_id)
 
         delete_module_instance(this_node_id, module_id);
         g_array_index(instance_data, void *, module_id) = 0;
+        g_array_index(instance_specifications, module_specification *, module_id) = 0;
         net_send_delete_module(module_id);
 
     unlock_framework();
@@ -127,17 +328,12 @@ void mato_delete_module_instance(int module_id)
 
 int mato_get_module_id(const char *module_name)
 {
-    for(int node_id = 0; node_id < nodes->len; node_id++)
-    {
-        int module_count = g_array_index(module_names, GArray *, node_id)->len;
-        for (int i = 0; i < module_count; i++)
-        {
-            char *name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, i);
-            if ((name != 0) && (strcmp(name, module_name) == 0))
-                return i + node_id * NODE_MULTIPLIER;
-        }
-    }
-    return -1;
+    lock_framework_read();
+        // the first module with that name, in the order of nodes and modules
+        GArray *ids = (GArray *)g_hash_table_lookup(module_ids_by_name, module_name);
+        int module_id = ids ? g_array_index(ids, int, 0) : -1;
+    unlock_framework();
+    return module_id;
 }
 
 char *mato_get_module_name(int module_id)
@@ -155,6 +351,12 @@ char *mato_get_module_type(int module_id)
 }
 
 int mato_subscribe(int subscriber_module_id, int subscribed_module_id, int channel, subscriber_callback callback, int subscription_type)
+{
+    return mato_subscribe_with_policy(subscriber_module_id, subscribed_module_id, channel, callback, subscription_type, queue_all, 0);
+}
+
+int mato_subscribe_with_policy(int subscriber_module_id, int subscribed_module_id, int channel, subscriber_callback callback, int subscription_type,
+                               subscription_queue_policy policy, int max_pending)
 {
     int subscriber_node_id = subscriber_module_id / NODE_MULTIPLIER;
     subscriber_module_id %= NODE_MULTIPLIER;
@@ -162,19 +364,161 @@ int mato_subscribe(int subscriber_module_id, int subscribed_module_id, int chann
         return -1;
     int subscribed_node_id = subscribed_module_id / NODE_MULTIPLIER;
     subscribed_module_id %= NODE_MULTIPLIER;
-    subscription *new_subscription = (subscription *)malloc(sizeof(subscription));
-    new_subscription->type = subscription_type;
-    new_subscription->callback = callback;
-    new_subscription->subscriber_module_id = subscriber_module_id;
-    new_subscription->subscriber_node_id = subscriber_node_id;
+    subscription *sub = new_subscription(subscription_type, callback, subscriber_module_id, subscriber_node_id);
+    if (subscription_type != latest_only)
+    {
+        sub->policy = policy;
+        sub->max_pending = (max_pending > 0) ? max_pending : 1;
+    }
     lock_framework();
-        new_subscription->subscription_id = get_free_subscription_id();
-        GArray *channel_subscriptions = g_array_index(g_array_index(g_array_index(subscriptions, GArray *, subscribed_node_id), GArray *, subscribed_module_id), GArray *, channel);
-        g_array_append_val(channel_subscriptions, new_subscription);
-        if ((channel_subscriptions->len == 1) && (subscribed_node_id != this_node_id))
+        int subscription_id = get_free_subscription_id();
+        sub->subscription_id = subscription_id;
+        int number_of_subscriptions = add_channel_subscription(subscribed_node_id, subscribed_module_id, channel, sub);
+        if ((number_of_subscriptions == 1) && (subscribed_node_id != this_node_id))
             net_send_subscribe(subscribed_node_id, subscribed_module_id, channel);
     unlock_framework();
-    return new_subscription->subscription_id;
+    return subscription_id;
+}
+
+/// Returns the subscription with the specified id to a channel of a module (public module_id), or 0 if there is none.
+/// Must be called with the framework locked (for reading at least).
+static subscription *find_subscription(int subscribed_module_id, int channel, int subscription_id)
+{
+    int subscribed_node_id = subscribed_module_id / NODE_MULTIPLIER;
+    subscribed_module_id %= NODE_MULTIPLIER;
+    subscription_list *channel_subscriptions = get_channel_subscriptions(subscribed_node_id, subscribed_module_id, channel);
+    for (int i = 0; channel_subscriptions && (i < channel_subscriptions->count); i++)
+        if (channel_subscriptions->subs[i]->subscription_id == subscription_id)
+            return channel_subscriptions->subs[i];
+    return 0;
+}
+
+long mato_subscription_dropped(int subscribed_module_id, int channel, int subscription_id)
+{
+    long dropped = -1;
+    lock_framework_read();
+        subscription *sub = find_subscription(subscribed_module_id, channel, subscription_id);
+        if (sub) dropped = sub->dropped;
+    unlock_framework();
+    return dropped;
+}
+
+int mato_get_channel_stats(int subscribed_module_id, int channel, int subscription_id, mato_channel_stats *stats)
+{
+    int found = 0;
+    lock_framework_read();
+        subscription *sub = find_subscription(subscribed_module_id, channel, subscription_id);
+        if (sub && (sub->subscriber_node_id == this_node_id))
+        {
+            latency_histogram_summary(&sub->post_to_dispatch, &stats->post_to_dispatch);
+            latency_histogram_summary(&sub->dispatch_to_return, &stats->dispatch_to_return);
+            found = 1;
+        }
+    unlock_framework();
+    return found;
+}
+
+int mato_set_callback_budget(int subscribed_module_id, int channel, int subscription_id, long budget, int degrade_on_overrun)
+{
+    int found = 0;
+    lock_framework_read();
+        subscription *sub = find_subscription(subscribed_module_id, channel, subscription_id);
+        if (sub && (sub->subscriber_node_id == this_node_id))
+        {
+            sub->budget = budget;
+            sub->degrade_on_overrun = degrade_on_overrun;
+            found = 1;
+        }
+    unlock_framework();
+    return found;
+}
+
+/// Fill in the profile of the callback of the subscription.
+static void get_callback_profile(subscription *sub, mato_callback_profile *profile)
+{
+    mato_latency_stats stats;
+    latency_histogram_summary(&sub->dispatch_to_return, &stats);
+    profile->calls = stats.count;
+    profile->total_time = atomic_load(&sub->dispatch_to_return.sum);
+    profile->max_time = stats.max;
+    profile->p99_time = stats.p99;
+    profile->budget = sub->budget;
+    profile->overruns = sub->overruns;
+    profile->last_overrun_time = sub->last_overrun_time;
+    profile->degraded = sub->degraded;
+}
+
+int mato_get_callback_profile(int subscribed_module_id, int channel, int subscription_id, mato_callback_profile *profile)
+{
+    int found = 0;
+    lock_framework_read();
+        subscription *sub = find_subscription(subscribed_module_id, channel, subscription_id);
+        if (sub && (sub->subscriber_node_id == this_node_id))
+        {
+            get_callback_profile(sub, profile);
+            found = 1;
+        }
+    unlock_framework();
+    return found;
+}
+
+/// One line of the log written by mato_log_callback_profiles().
+typedef struct {
+    mato_callback_profile profile;
+    int subscriber_module_id;
+    int subscribed_module_id;
+    int channel;
+} callback_profile_record;
+
+static int compare_total_time(const void *a, const void *b)
+{
+    long long time_a = ((const callback_profile_record *)a)->profile.total_time;
+    long long time_b = ((const callback_profile_record *)b)->profile.total_time;
+    return (time_a < time_b) - (time_a > time_b);
+}
+
+void mato_log_callback_profiles()
+{
+    GArray *records = g_array_new(0, 0, sizeof(callback_profile_record));
+    lock_framework_read();
+        for (int node_id = 0; node_id < nodes->len; node_id++)
+        {
+            GArray *node_subscriptions = g_array_index(subscriptions, GArray *, node_id);
+            for (int module_id = 0; module_id < node_subscriptions->len; module_id++)
+            {
+                GArray *module_subscriptions = g_array_index(node_subscriptions, GArray *, module_id);
+                for (int channel = 0; module_subscriptions && (channel < module_subscriptions->len); channel++)
+                {
+                    subscription_list *list = g_array_index(module_subscriptions, subscription_list *, channel);
+                    for (int i = 0; i < list->count; i++)
+                    {
+                        subscription *sub = list->subs[i];
+                        if (sub->subscriber_node_id != this_node_id) continue;
+                        callback_profile_record record;
+                        get_callback_profile(sub, &record.profile);
+                        record.subscriber_module_id = sub->subscriber_module_id;
+                        record.subscribed_module_id = module_id + node_id * NODE_MULTIPLIER;
+                        record.channel = channel;
+                        g_array_append_val(records, record);
+                    }
+                }
+            }
+        }
+
+        qsort(records->data, records->len, sizeof(callback_profile_record), compare_total_time);
+        char msg[250];
+        for (int i = 0; i < records->len; i++)
+        {
+            callback_profile_record *record = &g_array_index(records, callback_profile_record, i);
+            char *subscriber_name = g_array_index(g_array_index(module_names, GArray *, this_node_id), char *, record->subscriber_module_id);
+            snprintf(msg, 250, "callback of %s on channel %d of %s: %ld calls, total %lld us, max %lld us, p99 %lld us, budget %ld us, %ld overruns%s",
+                     subscriber_name ? subscriber_name : "?", record->channel, mato_get_module_name(record->subscribed_module_id),
+                     record->profile.calls, record->profile.total_time, record->profile.max_time, record->profile.p99_time,
+                     record->profile.budget, record->profile.overruns, record->profile.degraded ? ", degraded" : "");
+            mato_log(ML_INFO, msg);
+        }
+    unlock_framework();
+    g_array_free(records, 1);
 }
 
 void mato_unsubscribe(int module_id, int channel, int subscription_id)
@@ -189,7 +533,12 @@ void mato_unsubscribe(int module_id, int channel, int subscription_id)
 
 void *mato_get_data_buffer(int size)
 {
-    return malloc(size);
+    return new_data_buffer(size);
+}
+
+void mato_free_data_buffer(void *data)
+{
+    free_data_buffer(data);
 }
 
 void mato_post_data(int id_of_posting_module, int channel, int data_length, void *data)
@@ -197,11 +546,47 @@ void mato_post_data(int id_of_posting_module, int channel, int data_length, void
     int node_id = id_of_posting_module / NODE_MULTIPLIER;
     id_of_posting_module %= NODE_MULTIPLIER;
 
-    //writing data of size <= PIPE_BUF to pipe are atomic, therefore no framework locking is needed
+    //the post queue is lock-free for multiple producers, therefore no framework locking is needed
     channel_data *cd = new_channel_data(node_id, id_of_posting_module, channel, data_length, data);
-//    printf("%d sending channel data to pipe: %" PRIuPTR "\n", id_of_posting_module, (uintptr_t)cd);
+//    printf("%d sending channel data to queue: %" PRIuPTR "\n", id_of_posting_module, (uintptr_t)cd);
+
+    delivery_started();
+    mato_queue_push(post_queue, CHANNEL_KEY(node_id, id_of_posting_module, channel), cd);
+}
+
+void mato_post_data_batch(int id_of_posting_module, int n, int *channels, int *data_lengths, void **data, int frame_id)
+{
+    if (n <= 0) return;
+    int node_id = id_of_posting_module / NODE_MULTIPLIER;
+    id_of_posting_module %= NODE_MULTIPLIER;
+
+    int valid = 1;
+    lock_framework_read();
+        for (int i = 0; i < n; i++)
+            if ((channels[i] < 0) || (get_channel_buffers(node_id, id_of_posting_module, channels[i]) == 0))
+                valid = 0;
+    unlock_framework();
+    if (!valid)
+    {
+        mato_log_val(ML_ERR, "posting a batch to a channel that does not exist, module", id_of_posting_module);
+        for (int i = 0; i < n; i++)
+            if (data[i]) free_data_buffer(data[i]);
+        return;
+    }
+
+    // the messages are chained behind the first one, which takes a single place in the post queue
+    channel_data *first = 0, *last = 0;
+    for (int i = 0; i < n; i++)
+    {
+        channel_data *cd = new_channel_data(node_id, id_of_posting_module, channels[i], data_lengths[i], data[i]);
+        cd->frame_id = frame_id;
+        if (last) last->next_in_batch = cd;
+        else first = cd;
+        last = cd;
+    }
 
-    write(post_data_pipe[1], &cd, sizeof(channel_data *));
+    delivery_started();
+    mato_queue_push(post_queue, BATCH_KEY(atomic_fetch_add(&batches_posted, 1)), first);
 }
 
 void mato_send_global_message(int module_id_sender, int message_id, int msg_length, void *message_data)
@@ -213,27 +598,18 @@ void mato_send_global_message(int module_id_sender, int message_id, int msg_leng
         net_send_global_message(module_id_sender, message_id, (uint8_t *)message_data, msg_length);
 
     // all messages are delivered to all our modules
-    lock_framework();
-        int our_modules_count = g_array_index(module_names, GArray *, this_node_id)->len;
-        for (int module_id = 0; module_id < our_modules_count; module_id++)
+    lock_framework_read();
+        // the modules whose instance data are not created yet are skipped
+        for (int module_id = 0; module_id < instance_data->len; module_id++)
         {
-            char *module_type = g_array_index(g_array_index(module_types, GArray *, this_node_id), char *, module_id);
-            if (module_type != 0)
+            if (module_id + this_node_id * NODE_MULTIPLIER == module_id_sender) continue;  // not delivering to the msg. originator
+            module_specification *spec = g_array_index(instance_specifications, module_specification *, module_id);
+            void *modules_instance_data = g_array_index(instance_data, void *, module_id);
+            if ((spec != 0) && (modules_instance_data != 0))
             {
-                if (module_id + this_node_id * NODE_MULTIPLIER != module_id_sender)  // not delivering to the msg. originator
-                {
-                    module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
-                    if (spec != 0)
-                    {
-                        void *modules_instance_data = g_array_index(instance_data, void *, module_id);
-                        if (modules_instance_data != 0)
-                        {
     unlock_framework();
-                            spec->global_message(modules_instance_data, module_id_sender, message_id, msg_length, message_data);
-    lock_framework();
-                        }
-                    }
-                }
+                spec->global_message(modules_instance_data, module_id_sender, message_id, msg_length, message_data);
+    lock_framework_read();
             }
         }
     unlock_framework();
@@ -250,93 +626,139 @@ void mato_send_message(int module_id_sender, int module_id_receiver, int message
     else
     {
         int local_module_id_receiver = module_id_receiver % NODE_MULTIPLIER;
-        lock_framework();
-            char *module_type = g_array_index(g_array_index(module_types, GArray *, this_node_id), char *, local_module_id_receiver);
-            if (module_type != 0)
+        module_specification *spec = 0;
+        void *modules_instance_data = 0;
+        lock_framework_read();
+            if (local_module_id_receiver < instance_data->len)
             {
-                module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
-                if (spec != 0)
-                {
-                    void *modules_instance_data = g_array_index(instance_data, void *, local_module_id_receiver);
-        unlock_framework();
-                    if (modules_instance_data != 0)
-                        spec->global_message(modules_instance_data, module_id_sender, message_id, msg_length, message_data);
-                }
+                spec = g_array_index(instance_specifications, module_specification *, local_module_id_receiver);
+                modules_instance_data = g_array_index(instance_data, void *, local_module_id_receiver);
             }
+        unlock_framework();
+        if ((spec != 0) && (modules_instance_data != 0))
+            spec->global_message(modules_instance_data, module_id_sender, message_id, msg_length, message_data);
     }
 }
 
 void mato_get_data(int id_module, int channel, int *data_length, void **data)
 {
-    lock_framework();
+    lock_framework_read();
         int node_id = id_module / NODE_MULTIPLIER;
         id_module %= NODE_MULTIPLIER;
         if (node_id == this_node_id)
             copy_of_last_data_of_channel(node_id, id_module, channel, data_length, (uint8_t **)data);
         else
         {
-            GArray *node_subscriptions = g_array_index(subscriptions, GArray *, node_id);
-            GArray *module_subscriptions = g_array_index(node_subscriptions, GArray *, id_module);
-            GArray *channel_subscriptions = g_array_index(module_subscriptions, GArray *, channel);
-            if (channel_subscriptions->len > 0)
+            subscription_list *channel_subscriptions = get_channel_subscriptions(node_id, id_module, channel);
+            if (channel_subscriptions->count > 0)
             {  // there is at least 1 subscription on that channel from us
                 copy_of_last_data_of_channel(node_id, id_module, channel, data_length, (uint8_t **)data);
             }
             else
-            {  // otherwise request the data from another node
-                int fd[2];
-                pipe(fd);
-                net_send_get_data(node_id, id_module, channel, fd[1]);
-                if (read(fd[0], data_length, sizeof(int32_t)) < 0)
-                    perror("could not retrieve data size from pipe");
-                else if (read(fd[0], data, sizeof(uint8_t *)) < 0)
-                    perror("could not retrieve data size from pipe");
-                close(fd[0]);
-                close(fd[1]);
+            {  // otherwise request the data from another node (not blocking the framework while waiting)
+    unlock_framework();
+                request_remote_data(node_id, id_module, channel, data_length, (uint8_t **)data);
+                return;
             }
         }
     unlock_framework();
     return;
 }
 
+void mato_get_data_async(int id_module, int channel, get_data_callback callback, void *context)
+{
+    int data_length = 0;
+    uint8_t *data = 0;
+    lock_framework_read();
+        int node_id = id_module / NODE_MULTIPLIER;
+        int local_module_id = id_module % NODE_MULTIPLIER;
+        subscription_list *channel_subscriptions = (node_id == this_node_id) ? 0 : get_channel_subscriptions(node_id, local_module_id, channel);
+        if ((node_id == this_node_id) || (channel_subscriptions && (channel_subscriptions->count > 0)))
+            copy_of_last_data_of_channel(node_id, local_module_id, channel, &data_length, &data);
+        else
+        {
+    unlock_framework();
+            request_remote_data_async(node_id, local_module_id, channel, callback, context);
+            return;
+        }
+    unlock_framework();
+    callback(context, id_module, channel, data_length, data);
+}
+
+int mato_get_data_into(int id_module, int channel, void *buffer, int capacity)
+{
+    int data_length = 0;
+    lock_framework_read();
+        int node_id = id_module / NODE_MULTIPLIER;
+        int local_module_id = id_module % NODE_MULTIPLIER;
+        subscription_list *channel_subscriptions = (node_id == this_node_id) ? 0 : get_channel_subscriptions(node_id, local_module_id, channel);
+        if ((node_id == this_node_id) || (channel_subscriptions && (channel_subscriptions->count > 0)))
+            data_length = copy_last_data_of_channel_into(node_id, local_module_id, channel, buffer, capacity);
+        else
+        {  // nobody from us is subscribed, request the data from another node
+    unlock_framework();
+            void *data;
+            mato_get_data(id_module, channel, &data_length, &data);
+            if (data == 0) return 0;
+            if (data_length > capacity) data_length = -1;
+            else memcpy(buffer, data, data_length);
+            free(data);
+            return data_length;
+        }
+    unlock_framework();
+    return data_length;
+}
+
+int mato_set_node_send_policy(int module_id, int channel, node_send_policy policy)
+{
+    if (module_id / NODE_MULTIPLIER != this_node_id) return 0;
+    lock_framework_read();
+        channel_buffers *cb = get_channel_buffers(this_node_id, module_id % NODE_MULTIPLIER, channel);
+        if (cb) cb->send_drop_policy = policy;
+    unlock_framework();
+    return (cb != 0);
+}
+
+long long mato_data_post_time(void *data)
+{
+    if (data == 0) return 0;
+    return channel_data_of_buffer(data)->post_time;
+}
+
+int mato_data_frame_id(void *data)
+{
+    if (data == 0) return 0;
+    return channel_data_of_buffer(data)->frame_id;
+}
+
 void mato_borrow_data(int id_module, int channel, int *data_length, void **data)
 {
-    lock_framework();
+    lock_framework_read();
         int node_id = id_module / NODE_MULTIPLIER;
         id_module %= NODE_MULTIPLIER;
         if (node_id == this_node_id)
             borrow_last_data_of_channel(node_id, id_module, channel, data_length, (uint8_t **)data);
         else
         {
-            GArray *node_subscriptions = g_array_index(subscriptions, GArray *, node_id);
-            GArray *module_subscriptions = g_array_index(node_subscriptions, GArray *, id_module);
-            GArray *channel_subscriptions = g_array_index(module_subscriptions, GArray *, channel);
-            if (channel_subscriptions->len > 0)
+            subscription_list *channel_subscriptions = get_channel_subscriptions(node_id, id_module, channel);
+            if (channel_subscriptions->count > 0)
             {  // there is at least 1 subscription on that channel from us
                 borrow_last_data_of_channel(node_id, id_module, channel, data_length, (uint8_t **)data);
             }
             else
             {  // otherwise request the data from another node, store it to buffers and return borrowed pointer
-                int fd[2];
-                pipe(fd);
-    unlock_framework();
-                net_send_get_data(node_id, id_module, channel, fd[1]);
-                if (read(fd[0], data_length, sizeof(int32_t)) < 0)
-                    perror("could not retrieve data size from pipe");
-                else if (read(fd[0], data, sizeof(uint8_t *)) < 0)
-                    perror("could not retrieve data size from pipe");
-                close(fd[0]);
-                close(fd[1]);
-                if (*data)
-                {
-                    channel_data *cd = new_channel_data(node_id, id_module, channel, *data_length, *data);
-                    cd->references++;
-        lock_framework();
-                    GArray *module_buffers = g_array_index(g_array_index(buffers,GArray *, node_id), GArray *, id_module);
-                    GList *channel_list = g_array_index(module_buffers, GList *, channel);
-                    channel_list = g_list_prepend(channel_list, cd);
-                    g_array_index(module_buffers, GList *, channel) = channel_list;
-                }
+    unlock_framework();
+                request_remote_data(node_id, id_module, channel, data_length, (uint8_t **)data);
+                if (*data == 0) return;
+                // the network delivers a malloc-ed copy, the buffers of the channel must come from the pool
+                void *buffer = new_data_buffer(*data_length);
+                memcpy(buffer, *data, *data_length);
+                free(*data);
+                *data = buffer;
+                channel_data *cd = new_channel_data(node_id, id_module, channel, *data_length, *data);
+                cd->references++;
+        lock_framework_read();
+                store_borrowed_channel_data(cd);
             }
         }
     unlock_framework();
@@ -345,45 +767,10 @@ void mato_borrow_data(int id_module, int channel, int *data_length, void **data)
 
 void mato_release_data(int id_module, int channel, void *data)
 {
-    lock_framework();
+    lock_framework_read();
         int node_id = id_module / NODE_MULTIPLIER;
         id_module %= NODE_MULTIPLIER;
-        int removed = 0;
-
-        do {
-            GArray *buffers_for_module = g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, id_module);
-            if (buffers_for_module == 0) break;
-            GList *waiting_buffers = g_array_index(buffers_for_module, GList *, channel);
-            if (waiting_buffers == 0) break;
-            GList *lookup = waiting_buffers;
-            while (lookup)
-            {
-                channel_data *buffer = (channel_data *)(lookup->data);
-                if (buffer->data == data)
-                {
-                    lookup = decrement_references(waiting_buffers, buffer);
-                    if (lookup != waiting_buffers)
-                        g_array_index(buffers_for_module, GList *, channel) = lookup;
-                    removed = 1;
-                    break;
-                }
-                lookup = lookup->next;
-            }
-        } while (0);
-        if (!removed)
-        {
-            GList *dcd = dangling_channel_data;
-            while (dcd)
-            {
-                channel_data *buffer = dcd->data;
-                if (buffer->data == data)
-                {
-                    dangling_channel_data = decrement_references(dangling_channel_data, buffer);
-                    break;
-                }
-                dcd = dcd->next;
-            }
-        }
+        release_borrowed_data_of_channel(node_id, id_module, channel, data);
     unlock_framework();
 }
 
@@ -400,37 +787,57 @@ GArray* mato_get_list_of_all_modules()
     return mato_get_list_of_modules(0);
 }
 
+/// Append module_info of the module to the list, the structures are stored in the infos array that has enough space for all of them.
+static void append_module_info(GArray *modules, module_info *infos, int public_module_id)
+{
+    int node_id = public_module_id / NODE_MULTIPLIER;
+    int module_id = public_module_id % NODE_MULTIPLIER;
+    module_info *info = infos + modules->len;
+    info->module_id = public_module_id;
+    info->node_id = node_id;
+    info->name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id);
+    info->type = g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id);
+    info->number_of_channels = g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id)->len;
+    g_array_append_val(modules, info);
+}
+
 GArray* mato_get_list_of_modules(char *type)
 {
-    lock_framework();
-        GArray *modules = g_array_new(0, 0, sizeof(module_info *));
-        for (int node_id = 0; node_id < nodes->len; node_id++)
+    lock_framework_read();
+        // all module_info structures of the list are allocated at once, see mato_free_list_of_modules()
+        int count = 0;
+        GArray *ids_of_type = 0;
+        if (type != 0)
         {
-            int module_count = g_array_index(module_names, GArray *, node_id)->len;
-            for (int module_id = 0; module_id < module_count; module_id++)
+            ids_of_type = (GArray *)g_hash_table_lookup(module_ids_by_type, type);
+            if (ids_of_type) count = ids_of_type->len;
+        }
+        else
+            for (int node_id = 0; node_id < nodes->len; node_id++)
+                count += g_array_index(module_names, GArray *, node_id)->len;
+        GArray *modules = g_array_sized_new(0, 0, sizeof(module_info *), count);
+        module_info *infos = (module_info *)malloc((count ? count : 1) * sizeof(module_info));
+
+        if (ids_of_type)
+            for (int i = 0; i < ids_of_type->len; i++)
+                append_module_info(modules, infos, g_array_index(ids_of_type, int, i));
+        else if (type == 0)
+            for (int node_id = 0; node_id < nodes->len; node_id++)
             {
-                char *module_name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id);
-                if (module_name == 0) continue;
-                char *module_type = g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id);
-                if ((type == 0) || (strcmp(module_type, type) == 0))
-                {
-                    module_info *info = new_module_info(node_id, module_id + node_id * NODE_MULTIPLIER, module_name, module_type);
-                    g_array_append_val(modules, info);
-                }
+                GArray *names = g_array_index(module_names, GArray *, node_id);
+                for (int module_id = 0; module_id < names->len; module_id++)
+                    if (g_array_index(names, char *, module_id) != 0)
+                        append_module_info(modules, infos, module_id + node_id * NODE_MULTIPLIER);
             }
-        }
+        if (modules->len == 0) free(infos);
     unlock_framework();
     return modules;
 }
 
 void mato_free_list_of_modules(GArray* a)
 {
-    int n = a->len;
-    for (int i = 0; i < n; i++)
-    {
-        module_info *info = g_array_index(a, module_info *, i);
-        free(info);
-    }
+    if (a->len > 0)
+        free(g_array_index(a, module_info *, 0));
     g_array_free(a, 1);
 }
 
@@ -438,24 +845,40 @@ void mato_data_buffer_usage(int module_id, int channel, int *number_of_allocated
 {
     *number_of_allocated_buffers = 0;
     *total_sum_of_ref_count = 0;
-    lock_framework();
-        int node_id = module_id / NODE_MULTIPLIER;
-        module_id %= NODE_MULTIPLIER;
+    int node_id = module_id / NODE_MULTIPLIER;
+    module_id %= NODE_MULTIPLIER;
 
-        if(node_id != this_node_id)
-            return;
+    if ((node_id < 0) || (node_id >= nodes->len))
+        return;
 
-        GArray *module_buffers = (GArray *)g_array_index(g_array_index(buffers, GArray *,this_node_id), GArray *, module_id);
-        GList *channel_buffers = (GList *)g_array_index(module_buffers, GList *, channel);
-        while (channel_buffers != 0)
+    // the channels of remote modules hold the messages that arrived to this node
+    lock_framework_read();
+        channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+        if (cb)
         {
-            (*number_of_allocated_buffers)++;
-            (*total_sum_of_ref_count) += ((channel_data *)(channel_buffers->data))->references;
-            channel_buffers = channel_buffers->next;
+            lock_channel(cb);
+                channel_buffers_usage(cb, number_of_allocated_buffers, total_sum_of_ref_count);
+            unlock_channel(cb);
         }
     unlock_framework();
 }
 
+int mato_memory_pool_usage(int size_class, int *block_size, int *blocks_allocated, int *blocks_in_use, int *high_water_mark)
+{
+    mato_pool_usage usage;
+    if (!mato_pool_class_usage(size_class, &usage)) return 0;
+    *block_size = usage.block_size;
+    *blocks_allocated = usage.blocks_allocated;
+    *blocks_in_use = usage.blocks_in_use;
+    *high_water_mark = usage.high_water_mark;
+    return 1;
+}
+
+double mato_memory_pool_allocation_rate()
+{
+    return mato_pool_allocation_rate();
+}
+
 void mato_inc_thread_count(char *short_thread_name)
 {
     lock_framework();
@@ -2,6 +2,7 @@
 #define __MATO_H__
 
 #include <glib.h>
+#include <stdio.h>
 #include "mato_logs.h"
 #include "mato_config.h"
 
@@ -42,7 +43,163 @@ typedef enum subscription_type_enum {
     data_copy = 2, 
     /// the subscriber callback receives a pointer that is valid until the module will release it
     /// by calling the release_data() function.
-    borrowed_pointer = 3} subscription_type;
+    borrowed_pointer = 3,
+    /// the same as direct_data_ptr, but the subscriber only receives the most recent message: the messages that are
+    /// superseded by a newer one before the subscriber is ready to take them are skipped (the coalesce_to_latest policy).
+    latest_only = 4} subscription_type;
+
+/// what happens with the messages for a subscriber that does not keep up with the posting module:
+typedef enum subscription_queue_policy_enum {
+    /// all messages are delivered in the order they have been posted, however many of them are waiting (default),
+    queue_all = 0,
+    /// at most max_pending messages wait for the subscriber, when a new one arrives, the oldest waiting message is dropped,
+    keep_last_n = 1,
+    /// at most one message waits for the subscriber and a new message replaces it, i.e. the subscriber always gets the most recent one.
+    coalesce_to_latest = 2} subscription_queue_policy;
+
+/// Which message is dropped when the send queue of a remote node is full (see mato_set_node_send_policy()).
+typedef enum node_send_policy_enum {
+    /// the oldest message of the same channel that is still waiting in the queue, the node receives the most recent messages (default),
+    send_drop_oldest = 0,
+    /// the new message, the node receives the messages that are already waiting.
+    send_drop_newest = 1} node_send_policy;
+
+/// Distribution of the latencies of one stage of the message delivery to a subscriber (in microseconds).
+typedef struct {
+    /// number of delivered messages
+    long count;
+    double mean;
+    long long p50;
+    long long p90;
+    long long p99;
+    long long p999;
+    long long max;
+} mato_latency_stats;
+
+/// Latencies of the message delivery to a single subscription, see mato_get_channel_stats().
+typedef struct {
+    /// from posting the message (or its arrival from the network) until the subscriber callback is called,
+    /// i.e. the time spent waiting in the post queue and in the pending queue of the subscription
+    mato_latency_stats post_to_dispatch;
+    /// from calling the subscriber callback until it returns
+    mato_latency_stats dispatch_to_return;
+} mato_channel_stats;
+
+/// Profile of the subscriber callback of a single subscription, see mato_get_callback_profile().
+typedef struct {
+    /// number of callback calls
+    long calls;
+    /// total, longest and 99th percentile duration of the callback (in microseconds)
+    long long total_time;
+    long long max_time;
+    long long p99_time;
+    /// the time budget of the callback (in microseconds, 0 = unlimited)
+    long budget;
+    /// how many times the callback took longer than the budget, and monotonic_usec() of the last time (0 = never)
+    long overruns;
+    long long last_overrun_time;
+    /// 1 if the subscription has been switched to the coalesce_to_latest policy because of the overruns
+    int degraded;
+} mato_callback_profile;
+
+/// Expirations of a timer, see mato_get_timer_stats().
+typedef struct {
+    /// how many times the callback has been called
+    long expirations;
+    /// expirations of a periodic timer that were skipped, because the previous callback has not finished in time
+    long missed;
+    /// delays of the callbacks after the expiration times (in microseconds)
+    mato_latency_stats jitter;
+} mato_timer_stats;
+
+/// Maximum length of a module name in mato_channel_metrics (longer names are truncated).
+#define MATO_METRICS_NAME_LENGTH 32
+
+/// Metrics of a single output channel of a module of any node, see mato_get_metrics(). The channels of remote modules
+/// only count the messages that arrived to this node (i.e. if some module of this node is subscribed to them).
+typedef struct {
+    int node_id;
+    int module_id;
+    int channel;
+    char module_name[MATO_METRICS_NAME_LENGTH];
+    /// messages and bytes posted to the channel since the start
+    long messages;
+    long long bytes;
+    /// the same per second since the previous snapshot (0 if there is none)
+    double messages_per_second;
+    double bytes_per_second;
+    /// number of subscriptions to the channel (of the remote nodes as well)
+    int subscribers;
+    /// messages of the channel that are still used by someone, and the sum of their references
+    int buffers;
+    int references;
+} mato_channel_metrics;
+
+/// Network traffic with a single node, see mato_get_metrics().
+typedef struct {
+    int node_id;
+    int is_online;
+    /// number of modules of the node
+    int modules;
+    /// bytes sent to and received from the node since the start, and per second since the previous snapshot
+    long long bytes_sent;
+    long long bytes_received;
+    double bytes_sent_per_second;
+    double bytes_received_per_second;
+    /// messages waiting in the send queue of the node, and the messages dropped from it since the start
+    int send_queue_length;
+    long send_queue_dropped;
+} mato_node_metrics;
+
+/// A snapshot of the framework metrics, see mato_get_metrics().
+typedef struct {
+    /// monotonic_usec() when the snapshot was taken
+    long long time;
+    /// seconds since the previous snapshot (0 if there is none)
+    double interval;
+    int this_node_id;
+    /// messages waiting for the core thread, and the messages dropped from its queue since the start
+    int post_queue_length;
+    long post_queue_dropped;
+    /// messages waiting in the pending queues of the subscriptions
+    int pending_messages;
+    /// messages of deleted modules that are still borrowed by someone
+    int dangling_buffers;
+    /// module threads, framework threads and dispatch worker threads running
+    int threads;
+    int system_threads;
+    int dispatch_threads;
+    int number_of_nodes;
+    mato_node_metrics *nodes;
+    int number_of_channels;
+    mato_channel_metrics *channels;
+} mato_metrics;
+
+/// Statistics of the session recorder (see mato_start_recording()).
+typedef struct {
+    int active;
+    /// messages written into the file, and the bytes of their payload
+    long messages;
+    long long bytes;
+    /// messages that could not be recorded, because the recorder could not keep up or the file could not be extended
+    long dropped;
+} mato_recording_stats;
+
+/// The speed of mato_create_replay() that posts each recorded message as soon as the previous one has been delivered.
+#define MATO_REPLAY_LOCKSTEP 0
+
+/// Statistics of a replay (see mato_create_replay()).
+typedef struct {
+    /// all messages have been posted (and delivered in the lockstep mode)
+    int finished;
+    long messages;
+    long long bytes;
+    /// microseconds since the first message was posted, until the replay finished
+    long long duration;
+} mato_replay_stats;
+
+/// Messages of at most this length are retrieved by mato_get_data_into() without locking the channel.
+#define MATO_SNAPSHOT_SIZE 256
 
 /// Create instance data of a module and initialize it. Each module should define this callback.
 /// This instance will be from now on always referred by the module_id passed in the argument.
@@ -67,6 +224,14 @@ typedef void (* global_message_callback)(void *instance_data, int module_id_send
 /// the instance data of the subscriber, the id of the sender module, and the actual raw data of the message and its length
 typedef void (* subscriber_callback)(void *instance_data, int sender_module_id, int data_length, void *new_data_ptr);
 
+/// Prototype for a function that is called when a timer of the module expires (see mato_add_timer()).
+typedef void (* timer_callback)(void *instance_data, int timer_id);
+
+/// Prototype for a function that receives the data requested by mato_get_data_async(): the context passed to that function,
+/// and a copy of the most recent message of the channel, that the function should release by calling free() (data is 0
+/// if the module has not posted any data yet).
+typedef void (* get_data_callback)(void *context, int module_id, int channel, int data_length, void *data);
+
 /// Each module type has to provide the callbacks for its module instances.
 typedef struct {
         create_instance_callback create_instance;
@@ -115,8 +280,16 @@ void mato_register_new_type_of_module(char *type, module_specification *specific
 int mato_create_new_module_instance(const char *module_type, const char *module_name);
 
 /// Start the framework and all modules. This is typically called after all module instances have been created.
+/// Several modules are started at the same time by a few threads (see start_threads in the framework config),
+/// so that the modules that wait for their devices do not delay the others. A module is started only after the modules
+/// it depends on (see mato_add_start_dependency()) have been started. Returns when all modules have been started, the durations
+/// of the creation and start of each module are written to the log.
 void mato_start();
 
+/// Declare that the start_instance of a module must not be called before the start_instance of another module has returned
+/// in mato_start(). Both modules must be local and already created. Returns 0 if the dependency cannot be added.
+int mato_add_start_dependency(int module_id, int depends_on_module_id);
+
 /// Start a newly created instance of a particular module. This is typically used when the module instance
 /// is created later than when the framework has already been started.
 void mato_start_module(int module_id);
@@ -136,15 +309,87 @@ char *mato_get_module_type(int module_id);
 /// Subscribe on a channel of some module instance. Returns a number that represents this subscription (a subscription_id).
 int mato_subscribe(int subscriber_module_id, int subscribed_module_id, int channel, subscriber_callback callback, int subscription_type);
 
+/// Subscribe on a channel of some module instance like mato_subscribe(), but the messages waiting for the subscriber are limited
+/// by the specified policy (max_pending is only used by keep_last_n). The dropped messages are never delivered to this subscriber,
+/// see mato_subscription_dropped(). The latest_only subscriptions always use the coalesce_to_latest policy.
+int mato_subscribe_with_policy(int subscriber_module_id, int subscribed_module_id, int channel, subscriber_callback callback, int subscription_type,
+                               subscription_queue_policy policy, int max_pending);
+
+/// Returns how many messages have been dropped by the queue policy of the subscription so far, or -1 if there is no such subscription.
+long mato_subscription_dropped(int subscribed_module_id, int channel, int subscription_id);
+
+/// Retrieve the latencies of all messages delivered to the local subscription so far. Returns 1 on success, or 0 if there is no such
+/// subscription. The latencies are recorded for all subscriptions of the modules of this node, without any locking.
+int mato_get_channel_stats(int subscribed_module_id, int channel, int subscription_id, mato_channel_stats *stats);
+
+/// Set the time budget of the callback of a local subscription in microseconds (0 = unlimited), the default is the callback_budget
+/// variable of the framework config. Each time the callback takes longer, the overrun is counted, and a warning naming the
+/// subscriber and the channel is logged (at most once per second for each subscription). If degrade_on_overrun is set, the subscription
+/// is switched to the coalesce_to_latest policy after the first overrun (if it had the queue_all policy), so that the slow subscriber
+/// only receives the latest messages and does not delay the others. Returns 1 on success, or 0 if there is no such subscription.
+int mato_set_callback_budget(int subscribed_module_id, int channel, int subscription_id, long budget, int degrade_on_overrun);
+
+/// Retrieve the profile of the callback of a local subscription. Returns 1 on success, or 0 if there is no such subscription.
+int mato_get_callback_profile(int subscribed_module_id, int channel, int subscription_id, mato_callback_profile *profile);
+
+/// Write the profiles of the callbacks of all subscriptions of the modules of this node to the log, starting with the one
+/// that has taken the most time in total.
+void mato_log_callback_profiles();
+
+/// Call the callback of a local module every period_usec microseconds, starting period_usec from now. The timers of all modules
+/// are served by a single framework thread, so that the modules do not need their own threads that loop on usleep(), and the
+/// callbacks are called the same way as the subscriber callbacks: by the dispatch workers if the dispatch_threads variable
+/// of the framework config is set, otherwise directly by the timer thread (then they must return quickly). If the previous
+/// callback of the timer has not finished when the timer expires again, the expiration is skipped. Returns the timer_id,
+/// or -1 if there is no such local module. The timers of a module are removed when the module is deleted.
+int mato_add_timer(int module_id, long period_usec, timer_callback callback);
+
+/// Call the callback of a local module once, delay_usec microseconds from now. Returns the timer_id, or -1 if there is
+/// no such local module. The timer is removed after its callback has been called.
+int mato_add_one_shot_timer(int module_id, long delay_usec, timer_callback callback);
+
+/// Align a periodic timer to a reference time in the microseconds of monotonic_usec(), for example the post time
+/// of a sensor frame (mato_data_post_time()): the next expirations will be at reference_time + k * period.
+/// Returns 1 on success, or 0 if there is no such timer.
+int mato_align_timer(int timer_id, long long reference_time);
+
+/// Remove the timer, its callback is not called anymore after this returns (unless it is running right now).
+/// It can be called from the callback of the timer itself.
+void mato_remove_timer(int timer_id);
+
+/// Retrieve the statistics of the timer. Returns 1 on success, or 0 if there is no such timer.
+int mato_get_timer_stats(int timer_id, mato_timer_stats *stats);
+
 /// Given a subscription_id, cancel the ongoing subscription to a channel of some module instance.
 void mato_unsubscribe(int module_id, int channel, int subscription_id);
 
-/// Allocate a memory for a new message to be posted with post_data.
+/// Allocate a memory for a new message to be posted with post_data. The buffers come from a memory pool of the framework,
+/// they are returned to the pool automatically when the message is not used anymore.
 void *mato_get_data_buffer(int size);
 
+/// Return a buffer obtained by mato_get_data_buffer() that is not going to be posted after all (do not use free() for it).
+void mato_free_data_buffer(void *data);
+
 /// A module instance posts a new message to its own output data channel by calling this function.
+/// The data must have been allocated by mato_get_data_buffer(), the framework takes care of it from now on.
 void mato_post_data(int id_of_posting_module, int channel, int data_length, void *data);
 
+/// Post n messages to the output channels of the module at once, such as several outputs computed from the same sensor frame
+/// (the channels may repeat). The messages are queued with a single wakeup of the framework, all of them become the latest data
+/// of their channels before any of them is delivered, and then they are delivered one after another in their order,
+/// with no other message of the module in between. With dispatch workers (see dispatch_threads in the framework config),
+/// each subscription still receives them in their order, but different subscriptions are served in parallel.
+/// The frame_id is attached to all messages of the batch, so that the subscribers can find out which messages belong
+/// together (see mato_data_frame_id()). The data must have been allocated by mato_get_data_buffer(), the framework takes
+/// care of them from now on. If any of the channels does not exist, nothing is posted. The drop_oldest policy of the post queue
+/// (see post_queue_overflow in the framework config) never drops a batch.
+void mato_post_data_batch(int id_of_posting_module, int n, int *channels, int *data_lengths, void **data, int frame_id);
+
+/// Set which message is dropped when a channel of a local module is sent to a remote node whose send queue is full
+/// (the messages for each remote node are sent by its own thread, see node_send_queue_capacity in the framework config,
+/// so that a slow node does not delay the delivery to the local modules). Returns 0 if there is no such local channel.
+int mato_set_node_send_policy(int module_id, int channel, node_send_policy policy);
+
 /// The main program or any module instance can post a global message to be posted to all modules immediatelly in the same
 /// thread by calling this function. To send a global message from the main program, use mato_main_program_module_id().
 void mato_send_global_message(int module_id_sender, int message_id, int msg_length, void *message_data);
@@ -158,6 +403,32 @@ void mato_send_message(int module_id_sender, int module_id_receiver, int message
 /// it is not needed anymore.
 void mato_get_data(int id_module, int channel, int *data_length, void **data);
 
+/// Retrieve the most recently posted data of some channel of some module instance like mato_get_data(), but without waiting:
+/// the callback receives the copy of the data. For the local modules and the remote ones that some module of this node
+/// is subscribed to, it is called right away from this function. Otherwise the data is requested from the node of the module,
+/// and the callback is called from the networking thread when it arrives (so it should return quickly), or right away
+/// if the response to an earlier request is still fresh (see get_data_cache_ttl in the framework config). Concurrent requests
+/// for the same channel share a single request to the other node.
+void mato_get_data_async(int id_module, int channel, get_data_callback callback, void *context);
+
+/// Retrieve the most recently posted data of some channel of some module instance into a buffer of the caller
+/// that has capacity bytes. Returns the length of the data, 0 if there is no data posted by that module yet, or -1 if the data
+/// do not fit in the buffer (nothing is copied then). Messages of at most MATO_SNAPSHOT_SIZE bytes are copied from
+/// a snapshot of the channel that is read without memory allocation and without waiting for the posting module or
+/// the framework threads, therefore this is the preferred way of polling small data (such as poses) many times per second.
+/// Larger messages are copied with the channel locked. Data of remote modules that no module of this node
+/// is subscribed to are requested from their node the same way as by mato_get_data().
+int mato_get_data_into(int id_module, int channel, void *buffer, int capacity);
+
+/// Returns the time when the message was posted (or when it arrived from its node) in the microseconds of monotonic_usec().
+/// Only valid for the data pointers owned by the framework, i.e. received by a callback in the direct_data_ptr, borrowed_pointer
+/// or latest_only mode, or borrowed by mato_borrow_data(), not for copies. Returns 0 for empty messages (data == 0).
+long long mato_data_post_time(void *data);
+
+/// Returns the frame_id of a message posted by mato_post_data_batch(), or 0 for the messages posted by mato_post_data().
+/// Valid for the same data pointers as mato_data_post_time(). The frame ids are not transferred to the other nodes.
+int mato_data_frame_id(void *data);
+
 /// Retrieve the most recently posted data of some channel of some module instance. In this case, the data is not copied,
 /// but a pointer to read-only memory containing the data is provided. The module should return the borrowed pointer
 /// back to the framework by calling mato_release_data() when the data is not needed anymore.
@@ -181,17 +452,83 @@ GArray* mato_get_list_of_modules(char *type);
 int mato_get_number_of_modules();
 
 /// Free the list of modules returned by either of the two functions mato_get_list_of_modules() or mato_get_list_of_modules().
+/// The module_info structures of the list are allocated together, they must not be freed one by one.
 void mato_free_list_of_modules(GArray* a);
 
 /// Provide a diagnostic information on use of the buffers by a particular channel of a particular module. If this
-/// starts growing, the callbacks take too much time to process data and should be refactored.
+/// starts growing, the callbacks take too much time to process data and should be refactored. For the modules
+/// of the other nodes, the messages that arrived to this node are counted.
 void mato_data_buffer_usage(int module_id, int channel, int *number_of_allocated_buffers, int *total_sum_of_ref_count);
 
+/// Retrieve the usage of the memory pool for the messages: the size of blocks of the size_class (0..7) and how many blocks
+/// have been allocated, how many are currently in use, and the maximum number of blocks used at the same time. The size_class 8
+/// reports the messages larger than the largest class (block_size is 0 then). Returns 0 if there is no such size_class.
+int mato_memory_pool_usage(int size_class, int *block_size, int *blocks_allocated, int *blocks_in_use, int *high_water_mark);
+
+/// Returns the number of message buffers allocated per second since the previous call of this function.
+double mato_memory_pool_allocation_rate();
+
+/// Take a snapshot of the framework metrics: all channels of all modules of all nodes, the traffic with the other nodes,
+/// the lengths of the queues and the number of threads. The snapshot is taken with the framework locked for reading,
+/// so that the set of modules and channels is consistent. If the previous snapshot is given, the rates per second are computed
+/// for the interval between them. Release the snapshot with mato_free_metrics().
+mato_metrics *mato_get_metrics(mato_metrics *previous);
+
+/// Release a snapshot returned by mato_get_metrics().
+void mato_free_metrics(mato_metrics *metrics);
+
+/// Write the snapshot to the file in the compact text format of the metrics files (see the metrics_interval variable
+/// of the framework config), which can be viewed by the tools/mato_metrics_view program.
+void mato_write_metrics(FILE *f, mato_metrics *metrics);
+
+/// Start recording the messages of the channels of all modules of all nodes (or only of the selected channels) into
+/// the binary file (see mato_recorder.h for its format). The channels is a list of module names, or name:channel, separated
+/// by spaces, 0 or an empty string selects all channels. The modules that are created later are recorded as well
+/// (they are picked up within 0.1 s). The recorder never blocks the dispatcher: the messages are dropped when it cannot keep up.
+/// Empty messages are not recorded. Returns 1 on success, 0 if the recording already runs or the file could not be created.
+/// The recording can also be started by the record_file variable of the framework config.
+int mato_start_recording(const char *filename, const char *channels);
+
+/// Stop the recording and close the file, it is also stopped when the framework shuts down.
+void mato_stop_recording();
+
+/// Retrieve the statistics of the current (or the last) recording.
+void mato_get_recording_stats(mato_recording_stats *stats);
+
+/// Create a replay of a recording made by mato_start_recording(), it should be called before mato_start() like the creation
+/// of the other modules. A module is created for each recorded module that has posted some messages, with the same name,
+/// type and number of channels, so that the other modules can subscribe to them as usual (if the program has registered
+/// the type itself, the replayed module gets the type with the prefix replay_). When the replay module is started, it waits
+/// until mato_start() has started all modules, and then posts the recorded messages through mato_post_data() on behalf of
+/// the replayed modules. With the speed 1.0 they are posted in the recorded rhythm, with the speed N N-times faster (or slower).
+/// With the speed MATO_REPLAY_LOCKSTEP, each message is posted as soon as the previous one has been delivered to all subscribers
+/// and their callbacks have returned (including the deliveries of the messages they have posted meanwhile), so the replay runs
+/// as fast as the consumers can keep up, and they always process the same input in the same order.
+/// Returns the module_id of the replay module, or -1 if the recording could not be read. Deleting the replay module
+/// stops the replay and deletes the replayed modules as well.
+int mato_create_replay(const char *filename, double speed);
+
+/// Retrieve the statistics of the replay. Returns 0 if there is no such replay module.
+int mato_get_replay_stats(int replay_module_id, mato_replay_stats *stats);
+
 /// Each module instance (or other part of the program) that creates a new thread should call this funciton for each newly
 /// created thread. Increments the number of threads running. This should be called from each thread that has been started.
-/// The short thread name provided is associated with the thread id and can later be retrieved by this_thread_name() function.
+/// The short thread name provided (at most 12 characters) is associated with the thread and can later be retrieved by this_thread_name() function,
+/// it is also shown by the system tools, such as top -H or perf.
 void mato_inc_thread_count(char *short_thread_name);
 
+/// Start a new thread of a module that runs the thread_function with the arg. The thread is counted and named
+/// (the mato_inc_thread_count() and mato_dec_thread_count() functions are called by the framework, the thread_function must not call them),
+/// and it runs on the named executor (see the executors variable of the framework config), or on the executor assigned to
+/// its name by the thread_executors variable if executor_name is 0. Returns 1 on success, 0 if there is no such executor
+/// or the thread could not be created.
+int mato_start_thread(const char *short_thread_name, const char *executor_name, void *(*thread_function)(void *), void *arg);
+
+/// Move the calling thread to the named executor: its CPU cores and scheduling policy and priority. Returns 1 on success,
+/// 0 if there is no such executor, or the executor could not be applied (typically because the real-time policies require
+/// the CAP_SYS_NICE capability), which is logged.
+int mato_use_executor(const char *executor_name);
+
 /// Each thread that terminates should call this function just before it quits.
 /// Decrement the number of threads running. It should be called by each thread that terminates.
 void mato_dec_thread_count();
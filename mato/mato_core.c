@@ -4,6 +4,13 @@
 #include "mato_net.h"
 #include "mato_core.h"
 #include "mato_logs.h"
+#include "mato_dispatch.h"
+#include "mato_pool.h"
+#include "mato_metrics.h"
+#include "mato_timer.h"
+#include "mato_executor.h"
+#include "mato_recorder.h"
+#include "mato_sender.h"
 
 /// \file mato_core.c
 /// Implementation of the Mato control framework - internal data structures and algorithms.
@@ -11,17 +18,20 @@
 volatile int program_runs;
 volatile int threads_started;
 volatile int system_threads_started;
+volatile int modules_started;
 
 //--- declared and commented in mato_core.h
 GArray *module_names;
 GArray *module_types;
 GArray *instance_data;
 GHashTable *module_specifications;
-GHashTable *thread_names;
+GArray *instance_specifications;
+GHashTable *module_ids_by_name;
+GHashTable *module_ids_by_type;
 GArray *buffers;
-GList *dangling_channel_data;
+GHashTable *dangling_channel_data;
 GArray *subscriptions;
-int post_data_pipe[2];
+mato_queue *post_queue;
 mato_config_structure mato_core_config;
 //---
 
@@ -32,28 +42,235 @@ static int next_free_module_id;
 static int next_free_subscription_id;
 
 /// Used for mutual exclusion when accessing framework structures from functions that can be called from different threads.
-static pthread_mutex_t framework_mutex;
-static pthread_mutex_t threads_mutex;
+/// The registry is read much more often than changed, therefore it is a read-write lock (see lock_framework_read()).
+static pthread_rwlock_t framework_lock;
+
+/// Protects dangling_channel_data while the framework is only locked for reading.
+static pthread_mutex_t dangling_mutex;
+
+/// Number of message deliveries in progress, see delivery_started(). The threads in wait_for_deliveries() wait for the
+/// condition, it is only signalled when the number drops to zero and someone waits.
+static atomic_long deliveries_in_progress;
+static atomic_int deliveries_waiting;
+static pthread_mutex_t deliveries_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deliveries_done = PTHREAD_COND_INITIALIZER;
 
 void core_mato_shutdown()
 {
-    close(post_data_pipe[1]);
+    recorder_shutdown();
+    // the queue itself is not released: module threads that are still finishing may post to the closed queue
+    mato_queue_close(post_queue);
+    senders_shutdown();
+    timers_shutdown();
+    dispatch_shutdown();
     while (mato_system_threads_running() > 1) { usleep(10000); }
+    mato_pool_log_usage();
     mato_logs_shutdown();
     while (mato_system_threads_running() > 0) { usleep(10000); }
-    close(post_data_pipe[0]);
-    pthread_mutex_destroy(&framework_mutex);
-    pthread_mutex_destroy(&threads_mutex);
+    pthread_rwlock_destroy(&framework_lock);
+    pthread_mutex_destroy(&dangling_mutex);
 }
 
 void lock_framework()
 {
-    pthread_mutex_lock(&framework_mutex);
+    pthread_rwlock_wrlock(&framework_lock);
+}
+
+void lock_framework_read()
+{
+    pthread_rwlock_rdlock(&framework_lock);
 }
 
 void unlock_framework()
 {
-    pthread_mutex_unlock(&framework_mutex);
+    pthread_rwlock_unlock(&framework_lock);
+}
+
+void lock_channel(channel_buffers *cb)
+{
+    pthread_mutex_lock(&cb->lock);
+}
+
+void unlock_channel(channel_buffers *cb)
+{
+    pthread_mutex_unlock(&cb->lock);
+}
+
+/// Initial number of slots of each channel (must be a power of two), see channel_buffers.
+#define INITIAL_CHANNEL_SLOTS 8
+
+channel_buffers *new_channel_buffers()
+{
+    channel_buffers *cb = (channel_buffers *)malloc(sizeof(channel_buffers));
+    pthread_mutex_init(&cb->lock, 0);
+    cb->capacity = INITIAL_CHANNEL_SLOTS;
+    cb->slots = (channel_slot *)calloc(cb->capacity, sizeof(channel_slot));
+    cb->used = 0;
+    cb->next_slot = 0;
+    cb->latest = -1;
+    cb->messages = 0;
+    cb->bytes = 0;
+    cb->send_drop_policy = mato_core_config.node_send_queue_overflow;
+    atomic_init(&cb->snapshot_sequence, 0);
+    return cb;
+}
+
+void free_channel_buffers(channel_buffers *cb)
+{
+    pthread_mutex_destroy(&cb->lock);
+    free(cb->slots);
+    free(cb);
+}
+
+/// Store a message in the next free slot of the channel, the ring doubles its capacity if all slots are occupied.
+static void store_in_channel_slot(channel_buffers *cb, channel_data *cd)
+{
+    if (cb->used == cb->capacity)
+    {
+        cb->slots = (channel_slot *)realloc(cb->slots, 2 * cb->capacity * sizeof(channel_slot));
+        memset(cb->slots + cb->capacity, 0, cb->capacity * sizeof(channel_slot));
+        cb->next_slot = cb->capacity;
+        cb->capacity *= 2;
+    }
+    int slot = cb->next_slot;
+    while (cb->slots[slot].cd) slot = (slot + 1) & (cb->capacity - 1);
+    cb->slots[slot].cd = cd;
+    cd->slot = slot;
+    cd->generation = ++cb->slots[slot].generation;
+    cb->used++;
+    cb->next_slot = (slot + 1) & (cb->capacity - 1);
+}
+
+/// Returns 1 if the message is stored in the buffers of the channel, 0 if it is in dangling_channel_data.
+/// The caller must hold a reference of the message. The channel must be locked.
+static int channel_holds(channel_buffers *cb, channel_data *cd)
+{
+    return (cd->slot >= 0) && (cd->slot < cb->capacity) &&
+           (cb->slots[cd->slot].cd == cd) && (cb->slots[cd->slot].generation == cd->generation);
+}
+
+channel_data *latest_channel_data(channel_buffers *cb)
+{
+    if (cb->latest < 0) return 0;
+    return cb->slots[cb->latest].cd;
+}
+
+void channel_buffers_usage(channel_buffers *cb, int *number_of_buffers, int *total_sum_of_ref_count)
+{
+    *number_of_buffers = cb->used;
+    *total_sum_of_ref_count = 0;
+    for (int slot = 0; slot < cb->capacity; slot++)
+    {
+        channel_data *cd = cb->slots[slot].cd;
+        if (cd) (*total_sum_of_ref_count) += cd->references;
+    }
+}
+
+int dangling_channel_data_count()
+{
+    pthread_mutex_lock(&dangling_mutex);
+        int count = g_hash_table_size(dangling_channel_data);
+    pthread_mutex_unlock(&dangling_mutex);
+    return count;
+}
+
+void delivery_started()
+{
+    atomic_fetch_add(&deliveries_in_progress, 1);
+}
+
+void delivery_finished()
+{
+    if ((atomic_fetch_sub(&deliveries_in_progress, 1) == 1) && atomic_load(&deliveries_waiting))
+    {
+        pthread_mutex_lock(&deliveries_mutex);
+            pthread_cond_broadcast(&deliveries_done);
+        pthread_mutex_unlock(&deliveries_mutex);
+    }
+}
+
+void wait_for_deliveries()
+{
+    pthread_mutex_lock(&deliveries_mutex);
+        atomic_fetch_add(&deliveries_waiting, 1);
+        while (program_runs && (atomic_load(&deliveries_in_progress) > 0))
+        {
+            // the program can terminate before all messages are delivered
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&deliveries_done, &deliveries_mutex, &deadline);
+        }
+        atomic_fetch_sub(&deliveries_waiting, 1);
+    pthread_mutex_unlock(&deliveries_mutex);
+}
+
+/// Copy a new most recent message of the channel to the snapshot of the channel that is not read now.
+/// The channel must be locked, so there is only one writer.
+static void store_channel_snapshot(channel_buffers *cb, channel_data *cd)
+{
+    unsigned int sequence = atomic_load_explicit(&cb->snapshot_sequence, memory_order_relaxed);
+    int snapshot = (sequence / 2) & 1;
+    atomic_store_explicit(&cb->snapshot_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+        cb->snapshot_length[snapshot] = cd->length;
+        if ((cd->length > 0) && (cd->length <= MATO_SNAPSHOT_SIZE))
+            memcpy(cb->snapshot[snapshot], cd->data, cd->length);
+    atomic_store_explicit(&cb->snapshot_sequence, sequence + 2, memory_order_release);
+}
+
+/// Return value of read_channel_snapshot() when the most recent message is longer than MATO_SNAPSHOT_SIZE.
+#define SNAPSHOT_NOT_AVAILABLE -2
+
+/// Copy the snapshot of the most recent message of the channel to the buffer without locking the channel.
+/// Returns the length of the message, 0 if there is none, -1 if it does not fit in the buffer, or SNAPSHOT_NOT_AVAILABLE.
+static int read_channel_snapshot(channel_buffers *cb, void *buffer, int capacity)
+{
+    while (1)
+    {
+        unsigned int sequence = atomic_load_explicit(&cb->snapshot_sequence, memory_order_acquire);
+        unsigned int messages = sequence / 2;
+        if (messages == 0) return 0;
+        int snapshot = (messages - 1) & 1;
+        int length = cb->snapshot_length[snapshot];
+        int result = length;
+        if (length > MATO_SNAPSHOT_SIZE) result = SNAPSHOT_NOT_AVAILABLE;
+        else if (length > capacity) result = -1;
+        else memcpy(buffer, cb->snapshot[snapshot], length);
+        atomic_thread_fence(memory_order_acquire);
+        // the snapshot is overwritten by the message after the next one, its writing starts at 2 * messages + 3
+        if (atomic_load_explicit(&cb->snapshot_sequence, memory_order_relaxed) - 2 * messages < 3)
+            return result;
+    }
+}
+
+/// Store a new message that already has the reference of the channel as the most recent message of the channel.
+/// The channel must be locked.
+static void store_latest_channel_data(channel_buffers *cb, channel_data *cd)
+{
+    store_channel_snapshot(cb, cd);
+    cb->messages++;
+    cb->bytes += cd->length;
+    // previous last valid data is not last valid data anymore => ref--
+    channel_data *previous = latest_channel_data(cb);
+    if (previous)
+        decrement_references(cb, previous);
+    store_in_channel_slot(cb, cd);
+    cb->latest = cd->slot;
+}
+
+channel_buffers *get_channel_buffers(int node_id, int module_id, int channel)
+{
+    GArray *node_buffers = g_array_index(buffers, GArray *, node_id);
+    if (module_id >= node_buffers->len) return 0;
+    GArray *module_buffers = g_array_index(node_buffers, GArray *, module_id);
+    if ((module_buffers == 0) || (channel >= module_buffers->len)) return 0;
+    return g_array_index(module_buffers, channel_buffers *, channel);
 }
 
 void mato_inc_system_thread_count(char *short_thread_name)
@@ -76,145 +293,288 @@ int mato_system_threads_running()
     return system_threads_started;
 }
 
-GList *decrement_references(GList *data_buffers, channel_data *to_be_decremented)
+void decrement_references(channel_buffers *cb, channel_data *to_be_decremented)
+{
+    if (--to_be_decremented->references == 0)
+    {
+        int slot = to_be_decremented->slot;
+        cb->slots[slot].cd = 0;
+        cb->used--;
+        if (cb->latest == slot) cb->latest = -1;
+        free_channel_data(to_be_decremented);
+    }
+}
+
+/// The same as decrement_references() for the messages in dangling_channel_data, that must be locked by the caller.
+static void decrement_dangling_references(channel_data *to_be_decremented)
+{
+    if (--to_be_decremented->references == 0)
+    {
+        g_hash_table_remove(dangling_channel_data, to_be_decremented);
+        free_channel_data(to_be_decremented);
+    }
+}
+
+void release_channel_data(channel_data *cd)
+{
+    channel_buffers *cb = get_channel_buffers(cd->node_id, cd->module_id, cd->channel_id);
+    if (cb)
+    {
+        lock_channel(cb);
+            int found = channel_holds(cb, cd);
+            if (found)
+                decrement_references(cb, cd);
+        unlock_channel(cb);
+        if (found) return;
+    }
+    pthread_mutex_lock(&dangling_mutex);
+        int dangling = g_hash_table_contains(dangling_channel_data, cd);
+        if (dangling)
+            decrement_dangling_references(cd);
+    pthread_mutex_unlock(&dangling_mutex);
+    // released twice, or never handed out by the framework
+    if (!dangling)
+        mato_log(ML_ERR, "releasing data that is not held by the framework, ignored");
+}
+
+/// At most one warning per this many microseconds is logged about the overruns of the budget of a single subscription.
+#define OVERRUN_WARNING_INTERVAL 1000000
+
+/// The callback of the subscription has just returned after the duration (in us): check it against its budget, log a warning
+/// and degrade the subscription if it is too slow. Called with the framework locked for reading.
+static void check_callback_budget(subscription *sub, channel_data *cd, long long duration, long long now)
 {
-    to_be_decremented->references--;
-    if (to_be_decremented->references == 0)
+    long budget = sub->budget;
+    if ((budget <= 0) || (duration <= budget)) return;
+    long overruns = ++sub->overruns;
+    sub->last_overrun_time = now;
+
+    long long last_warning = sub->last_overrun_warning;
+    if ((now - last_warning >= OVERRUN_WARNING_INTERVAL) &&
+        atomic_compare_exchange_strong(&sub->last_overrun_warning, &last_warning, now))
     {
-        free(to_be_decremented->data);
-        data_buffers = g_list_remove(data_buffers, to_be_decremented);
-        free(to_be_decremented);
+        char msg[200];
+        char *subscriber_name = g_array_index(g_array_index(module_names, GArray *, this_node_id), char *, sub->subscriber_module_id);
+        char *subscribed_name = g_array_index(g_array_index(module_names, GArray *, cd->node_id), char *, cd->module_id);
+        snprintf(msg, 200, "callback of %s on channel %d of %s took %lld us, budget %ld us, overruns so far: %ld",
+                 subscriber_name ? subscriber_name : "?", cd->channel_id, subscribed_name ? subscribed_name : "?", duration, budget, overruns);
+        mato_log(ML_WARN, msg);
+    }
+
+    if (sub->degrade_on_overrun && !sub->degraded && dispatch_degrade_subscription(sub))
+    {
+        char msg[200];
+        char *subscriber_name = g_array_index(g_array_index(module_names, GArray *, this_node_id), char *, sub->subscriber_module_id);
+        char *subscribed_name = g_array_index(g_array_index(module_names, GArray *, cd->node_id), char *, cd->module_id);
+        snprintf(msg, 200, "%s is too slow, it only receives the latest messages of channel %d of %s from now on",
+                 subscriber_name ? subscriber_name : "?", cd->channel_id, subscribed_name ? subscribed_name : "?");
+        mato_log(ML_WARN, msg);
     }
-    return data_buffers;
 }
 
+void deliver_channel_data(subscription *sub, channel_data *cd)
+{
+    if (sub->subscriber_node_id == this_node_id)
+    {
+        void *subscriber_instance_data = g_array_index(instance_data, void *, sub->subscriber_module_id);
+        long long dispatch_time = monotonic_usec();
+        latency_histogram_record(&sub->post_to_dispatch, dispatch_time - cd->post_time);
+        if ((sub->type == direct_data_ptr) || (sub->type == latest_only))
+        {
+            unlock_framework();
+                sub->callback(subscriber_instance_data, cd->module_id, cd->length, cd->data);
+            lock_framework_read();
+        }
+        else if (sub->type == data_copy)
+        {
+            void *copy_of_data = malloc(cd->length);
+            memcpy(copy_of_data, cd->data, cd->length);
+            unlock_framework();
+                sub->callback(subscriber_instance_data, cd->module_id, cd->length, copy_of_data);
+            lock_framework_read();
+        }
+        else if (sub->type == borrowed_pointer)
+        {
+            cd->references++;
+            unlock_framework();
+                sub->callback(subscriber_instance_data, cd->module_id, cd->length, cd->data);
+            lock_framework_read();
+        }
+        long long return_time = monotonic_usec();
+        latency_histogram_record(&sub->dispatch_to_return, return_time - dispatch_time);
+        check_callback_budget(sub, cd, return_time - dispatch_time, return_time);
+    }
+    else
+        sender_enqueue(sub->subscriber_node_id, cd);
+}
+
+/// Releases a posted message (or a whole batch) that has been dropped from the post_queue before it reached the core thread.
+static void drop_channel_data(void *item)
+{
+    channel_data *cd = (channel_data *)item;
+    while (cd)
+    {
+        channel_data *next = cd->next_in_batch;
+        free_channel_data(cd);
+        cd = next;
+    }
+    delivery_finished();
+}
+
+/// Store the posted message as the latest data of its channel. Must be called with the framework locked (for reading at least).
+static void store_posted_data(channel_data *cd)
+{
+    cd->references++; // last valid data from module channel
+    cd->references++; // currently being sent out to subscribers
+
+    if (cd->node_id == this_node_id) net_encode_subscribed_data(cd);
+
+    channel_buffers *cb = get_channel_buffers(cd->node_id, cd->module_id, cd->channel_id);
+    lock_channel(cb);
+        store_latest_channel_data(cb, cd);
+    unlock_channel(cb);
+}
+
+/// Pass a stored message to all subscribers of its channel and return the reference of the core thread.
+/// Must be called with the framework locked for reading.
+static void publish_posted_data(channel_data *cd)
+{
+    // the subscriptions could change under our hands while the framework is unlocked for the callbacks,
+    // but the list we hold stays the same, and the subscriptions cancelled meanwhile are marked removed
+    subscription_list *subscriptions_for_channel = get_channel_subscriptions(cd->node_id, cd->module_id, cd->channel_id);
+    acquire_subscription_list(subscriptions_for_channel);
+
+    for (int i = 0; i < subscriptions_for_channel->count; i++)
+    {
+        subscription *sub = subscriptions_for_channel->subs[i];
+        if (sub->removed) continue;
+        // messages for remote nodes are sent by this thread, so that the writes to a node socket do not interleave
+        if (dispatch_uses_pending(sub))
+            dispatch_to_subscription(sub, cd);
+        else
+            deliver_channel_data(sub, cd);
+    }
+    release_subscription_list(subscriptions_for_channel);
+
+    release_channel_data(cd);  // done with this channel data, ref--
+}
+
+/// Without dispatch workers, the core thread delivers the messages pending for the subscriptions with a queue policy
+/// after this many posted messages even if there are more messages waiting in the post_queue.
+#define PENDING_DELIVERY_INTERVAL 16
+
 /// The main loop of the framework thread that takes care of redistributing all the messages posted by the modules.
 static void *mato_core_thread(void *arg)
 {
     channel_data *cd;
+    int messages_since_pending_delivery = 0;
     mato_inc_system_thread_count("core");
     while (program_runs)
     {
-        int retval = read(post_data_pipe[0], &cd, sizeof(channel_data *));
-        if (retval < 0)
+        cd = (channel_data *)mato_queue_try_pop(post_queue);
+        if (dispatch_workers() == 0)
         {
-          perror("error reading from message pipe");
-          return 0;
+            if (cd == 0)
+            {
+                dispatch_run_pending(0);  // nothing else to do now
+                messages_since_pending_delivery = 0;
+            }
+            else if (++messages_since_pending_delivery == PENDING_DELIVERY_INTERVAL)
+            {
+                dispatch_run_pending(1);  // busy, but they should not starve
+                messages_since_pending_delivery = 0;
+            }
         }
-        //      printf("retrieved channel data from pipe: %" PRIuPTR "\n", (uintptr_t)cd);
+        if (cd == 0)
+            cd = (channel_data *)mato_queue_pop(post_queue);
+        //      printf("retrieved channel data from queue: %" PRIuPTR "\n", (uintptr_t)cd);
 
-        if (retval == 0) // pipe write has closed, framework terminates
+        if (cd == 0) // queue has been closed, framework terminates
           break;
 
-        cd->references++; // last valid data from module channel
-        cd->references++; // currently being sent out to subscribers
-
-        lock_framework();
-            if(g_array_index(nodes,node_info*,cd->node_id)->is_online == 0)
+        lock_framework_read();
+            if ((g_array_index(nodes,node_info*,cd->node_id)->is_online == 0) ||
+                (g_array_index(g_array_index(module_names, GArray *,cd->node_id), char *, cd->module_id) == 0))
             {
-                free(cd->data);
-                free(cd);
         unlock_framework();
+                drop_channel_data(cd);
                 continue;
             }
 
-            char *check_module_exists = g_array_index(g_array_index(module_names, GArray *,cd->node_id), char *, cd->module_id);
-            if (check_module_exists == 0)
+            // all messages of a batch are stored before any of them is delivered, and they are delivered one after another,
+            // so that the subscribers see the whole batch
+            for (channel_data *item = cd; item; item = item->next_in_batch)
+                store_posted_data(item);
+            while (cd)
             {
-                free(cd->data);
-                free(cd);
-        unlock_framework();
-                continue;
+                channel_data *next = cd->next_in_batch;
+                cd->next_in_batch = 0;
+                publish_posted_data(cd);
+                cd = next;
             }
+        unlock_framework();
+        delivery_finished();
+    }
+    mato_dec_system_thread_count();
+    return 0;
+}
 
-            GArray *module_buffers = g_array_index(g_array_index(buffers,GArray *,cd->node_id), GArray *, cd->module_id);
-            GList *channel_list = g_array_index(module_buffers, GList *, cd->channel_id);
-
-            if (channel_list)
-                // previous last valid data is not last valid data anymore => ref--
-                channel_list = decrement_references(channel_list, (channel_data *)(channel_list->data));
-            channel_list = g_list_prepend(channel_list, cd);
-
-            g_array_index(module_buffers, GList *, cd->channel_id) = channel_list;
+/// Deallocate a value of module_ids_by_name or module_ids_by_type.
+static void free_module_ids(gpointer ids)
+{
+    g_array_free((GArray *)ids, 1);
+}
 
-            GArray *subscriptions_for_channel = g_array_index(g_array_index(g_array_index(subscriptions,GArray *,cd->node_id), GArray *, cd->module_id), GArray *, cd->channel_id);
-            int n = subscriptions_for_channel->len;
+void index_module(int node_id, int module_id)
+{
+    char *module_name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id);
+    char *module_type = g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id);
+    int public_module_id = module_id + node_id * NODE_MULTIPLIER;
 
-            // extract the list of all subscriptions to call before unlocking framework
-            // as they could change under our hands meanwhile
-            // and then before calling each, check that the subscription is still valid
+    GArray *ids = (GArray *)g_hash_table_lookup(module_ids_by_name, module_name);
+    if (ids == 0)
+    {
+        ids = g_array_new(0, 0, sizeof(int));
+        g_hash_table_insert(module_ids_by_name, strdup(module_name), ids);
+    }
+    // the modules with the same name are kept ordered by node and module, the first one is found by its name
+    int i = ids->len;
+    while ((i > 0) && (g_array_index(ids, int, i - 1) > public_module_id)) i--;
+    g_array_insert_val(ids, i, public_module_id);
 
-            GList *list_of_subscriptions_to_use = 0;
-            for (int i = 0; i < n; i++)
-            {
-                subscription *sub = g_array_index(subscriptions_for_channel, subscription *, i);
-                int *sub_id = (int *)malloc(sizeof(int));
-                *sub_id = sub->subscription_id;
-                list_of_subscriptions_to_use = g_list_append(list_of_subscriptions_to_use, sub_id);
-            }
+    ids = (GArray *)g_hash_table_lookup(module_ids_by_type, module_type);
+    if (ids == 0)
+    {
+        ids = g_array_new(0, 0, sizeof(int));
+        g_hash_table_insert(module_ids_by_type, strdup(module_type), ids);
+    }
+    g_array_append_val(ids, public_module_id);
+}
 
-            GList *subscriber = list_of_subscriptions_to_use;
-            while (subscriber != 0)
-            {
-                int sub_id = *((int *)(subscriber->data));
+/// Remove the module from the list of the key in module_ids_by_name or module_ids_by_type, and the key if no module is left.
+static void remove_module_id(GHashTable *index, char *key, int public_module_id)
+{
+    GArray *ids = (GArray *)g_hash_table_lookup(index, key);
+    if (ids == 0) return;
+    for (int i = 0; i < ids->len; i++)
+        if (g_array_index(ids, int, i) == public_module_id)
+        {
+            g_array_remove_index(ids, i);
+            break;
+        }
+    if (ids->len == 0)
+        g_hash_table_remove(index, key);
+}
 
-                subscription *sub = 0;
-                for (int i = 0; i < n; i++)
-                {
-                    subscription *try_sub = g_array_index(subscriptions_for_channel, subscription *, i);
-                    if (try_sub->subscription_id == sub_id)
-                    {
-                        sub = try_sub;
-                        break;
-                    }
-                }
-                if (sub == 0)  // subscription removed meanwhile, skip
-                {
-                    subscriber = subscriber->next;
-                    continue;
-                }
-                if(sub->subscriber_node_id==this_node_id)
-                {
-                    void *subscriber_instance_data = g_array_index(instance_data, void *, sub->subscriber_module_id);
-                    if (sub->type == direct_data_ptr)
-                    {
-                        unlock_framework();
-                            sub->callback(subscriber_instance_data, cd->module_id, cd->length, cd->data);
-                        lock_framework();
-                    }
-                    else if (sub->type == data_copy)
-                    {
-                        void *copy_of_data = malloc(cd->length);
-                        memcpy(copy_of_data, cd->data, cd->length);
-                        unlock_framework();
-                            sub->callback(subscriber_instance_data, cd->module_id, cd->length, copy_of_data);
-                        lock_framework();
-                    }
-                    else if (sub->type == borrowed_pointer)
-                    {
-                        cd->references++;
-                        unlock_framework();
-                            sub->callback(subscriber_instance_data, cd->module_id, cd->length, cd->data);
-                        lock_framework();
-                    }
-                }
-                else
-                {
-                    unlock_framework();
-                        net_send_subscribed_data(sub->subscriber_node_id, cd);
-                    lock_framework();
-                }
-                free(subscriber->data);
-                subscriber = subscriber->next;
-            }
-            g_list_free(list_of_subscriptions_to_use);
+void unindex_module(int node_id, int module_id)
+{
+    char *module_name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id);
+    char *module_type = g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id);
+    if (module_name == 0) return;
+    int public_module_id = module_id + node_id * NODE_MULTIPLIER;
 
-            channel_list = decrement_references(channel_list, cd);  // done with this channel data, ref--
-            // no need to check for channel_list changed, since it is still the last valid, ie. refcount > 0
-        unlock_framework();
-    }
-    mato_dec_system_thread_count();
-    return 0;
+    remove_module_id(module_ids_by_name, module_name, public_module_id);
+    remove_module_id(module_ids_by_type, module_type, public_module_id);
 }
 
 /// Essentially removes traces about names and types of all modules of a particular node that has just disconnected.
@@ -224,6 +584,8 @@ void remove_names_types(int node_id)
     GArray* names = g_array_index(module_names, GArray*, node_id);
     GArray* types = g_array_index(module_types, GArray*, node_id);
     int module_number = names->len;
+    for(int module = 0; module < module_number; module++)
+        unindex_module(node_id, module);
     for(int module = 0; module < module_number; module++)
     {
         char* name = g_array_index(names, char*, 0);
@@ -245,16 +607,11 @@ static void remove_subscriptions_to_module_channels(int node_id, int module, GAr
     int channels_number = module_subscriptions->len;
     for (int channel = 0; channel < channels_number; channel++)
     {
-        GArray *channel_subscriptions = g_array_index(module_subscriptions, GArray *, channel);
-        int subscription_count = channel_subscriptions->len;
-        for (int sub = 0; sub < subscription_count; sub++)
-        {
-            subscription *s = g_array_index(channel_subscriptions, subscription *, sub);
-            g_array_index(channel_subscriptions, subscription *, sub) = 0;
-            free(s);
-        }
-        g_array_free(channel_subscriptions, 1);
-        g_array_index(module_subscriptions, GArray *, channel) = 0;
+        subscription_list *channel_subscriptions = g_array_index(module_subscriptions, subscription_list *, channel);
+        for (int sub = 0; sub < channel_subscriptions->count; sub++)
+            dispatch_retire_subscription(channel_subscriptions->subs[sub]);
+        release_subscription_list(channel_subscriptions);
+        g_array_index(module_subscriptions, subscription_list *, channel) = 0;
     }
     g_array_free(module_subscriptions, 1);
     g_array_index(node_subscriptions, GArray *, module) = 0;
@@ -278,26 +635,26 @@ void remove_node_from_subscriptions(int node_id)
     for (int module=0; module < modules_number; module++)
     {
         GArray *module_subscriptions = g_array_index(node_subscriptions, GArray *, module);
+        if (module_subscriptions == 0) continue;  // deleted module
         int channels_number = module_subscriptions->len;
         for (int channel = 0; channel < channels_number; channel++)
         {
-            GArray *channel_subscriptions = g_array_index(module_subscriptions, GArray *, channel);
-            int subscription_count = channel_subscriptions->len;
-            for (int sub = 0; sub < subscription_count; sub++)
+            subscription_list *channel_subscriptions = g_array_index(module_subscriptions, subscription_list *, channel);
+            for (int sub = 0; sub < channel_subscriptions->count; sub++)
             {
-                subscription *s = g_array_index(channel_subscriptions, subscription *, sub);
+                subscription *s = channel_subscriptions->subs[sub];
                 if (s->subscriber_node_id == node_id)
                 {
-                    g_array_remove_index_fast(channel_subscriptions, sub);
-                    free(s);
+                    remove_channel_subscription(this_node_id, module, channel, s);
+                    break;  // a node has at most one subscription to a channel
                 }
             }
         }
     }
 }
 
-/// Pass through all the buffers of the specified module of some remote node, and if any of our local modules
-/// is subscribed to the channel, decrement the reference count for the leading (latest) message,
+/// Pass through all the buffers of the specified module of some node, and decrement the reference count
+/// for the leading (latest) message of each channel,
 /// because the module is not valid anymore, so we will not be providing a most recent message from
 /// this time on.
 static void decrement_references_of_the_last_channel_messages_for_module(int node_id, int module_id)
@@ -305,15 +662,16 @@ static void decrement_references_of_the_last_channel_messages_for_module(int nod
     GArray *module_channels_subscriptions = g_array_index(g_array_index(subscriptions, GArray *, node_id), GArray *, module_id);
     if (module_channels_subscriptions == 0) // no channels => node must have been removed already
         return;
+    // the most recent message of a channel always holds the "last valid data" reference, even if the subscriptions
+    // that have brought it from a remote node have been cancelled meanwhile
     for (int channel = 0; channel < module_channels_subscriptions->len; channel++)
     {
-        if ((node_id == this_node_id) || (g_array_index(module_channels_subscriptions, GArray *, channel)->len > 0))
+        channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+        channel_data *latest = cb ? latest_channel_data(cb) : 0;
+        if (latest)
         {
-            GArray *channels = g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id);
-            GList *bufs = g_array_index(channels, GList *, channel);
-            if (bufs)
-                bufs = decrement_references(bufs, (channel_data *)bufs->data);
-            g_array_index(channels, GList *, channel) = bufs;
+            decrement_references(cb, latest);
+            cb->latest = -1;
         }
     }
 }
@@ -327,13 +685,16 @@ static void move_remaining_channel_data_to_dangling(int node_id, int module_id)
         return;
     for (int channel = 0; channel < module_channels_subscriptions->len; channel++)
     {
-        GList *bufs = g_array_index(g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id), GList *, channel);
-        while (bufs)
+        channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+        if (cb == 0) continue;
+        for (int slot = 0; slot < cb->capacity; slot++)
         {
-            dangling_channel_data = g_list_prepend(dangling_channel_data, bufs->data);
-            bufs = bufs->next;
+            channel_data *cd = cb->slots[slot].cd;
+            if (cd == 0) continue;
+            cd->slot = -1;
+            g_hash_table_insert(dangling_channel_data, cd, cd);
         }
-        g_list_free(bufs);
+        free_channel_buffers(cb);
     }
     g_array_free(g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id), 1);
     g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id) = 0;
@@ -362,6 +723,7 @@ void remove_node_buffers(int node_id)
 /// Deallocate and remove the name and type of a specified module from framework records.
 static void free_name_and_type(int node_id, int module_id)
 {
+    unindex_module(node_id, module_id);
     char *module_type = g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id);
     char *module_name = g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id);
     g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id) = 0;
@@ -393,22 +755,24 @@ void store_new_remote_module(int node_id, int module_id, char *module_name, char
             g_array_append_val(g_array_index(subscriptions, GArray *, node_id), zero);
             g_array_append_val(g_array_index(buffers, GArray *, node_id), zero);
         }
+        unindex_module(node_id, module_id);  // in case the module has been announced already
         g_array_index(g_array_index(module_names, GArray *, node_id), char *, module_id) = module_name;
         g_array_index(g_array_index(module_types, GArray *, node_id), char *, module_id) = module_type;
+        index_module(node_id, module_id);
 
-        GArray *channels_subscriptions = g_array_new(0, 0, sizeof(GArray *));
+        GArray *channels_subscriptions = g_array_new(0, 0, sizeof(subscription_list *));
         g_array_index(g_array_index(subscriptions, GArray *, node_id), GArray *, module_id) = channels_subscriptions;
 
-        GArray *module_buffers = g_array_new(0, 0, sizeof(GList *));
+        GArray *module_buffers = g_array_new(0, 0, sizeof(channel_buffers *));
         g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id) = module_buffers;
 
         for (int channel_id = 0; channel_id < number_of_channels; channel_id++)
         {
-           GArray *subs_for_channel = g_array_new(0, 0, sizeof(GArray *));
+           subscription_list *subs_for_channel = new_subscription_list();
            g_array_append_val(channels_subscriptions, subs_for_channel);
 
-           GList *channel_buffers = 0;
-           g_array_append_val(module_buffers, channel_buffers);
+           channel_buffers *cb = new_channel_buffers();
+           g_array_append_val(module_buffers, cb);
         }
     unlock_framework();
 
@@ -427,34 +791,22 @@ int get_free_subscription_id() // is not thread-safe
 
 void remove_subscription(int subscribed_node_id, int subscribed_module_id, int channel, int subscription_id)
 {
-    GArray *subscriptions_for_channel = g_array_index(g_array_index(g_array_index(subscriptions, GArray *,subscribed_node_id), GArray *, subscribed_module_id), GArray *, channel);
-    int number_of_channel_subscriptions = subscriptions_for_channel->len;
-    for (int i = 0; i < number_of_channel_subscriptions; i++)
+    subscription_list *subscriptions_for_channel = get_channel_subscriptions(subscribed_node_id, subscribed_module_id, channel);
+    if (subscriptions_for_channel == 0) return;
+    for (int i = 0; i < subscriptions_for_channel->count; i++)
     {
-        subscription *s = (subscription *)g_array_index(subscriptions_for_channel, GArray *, i);
+        subscription *s = subscriptions_for_channel->subs[i];
         if (s->subscription_id == subscription_id)
         {
-            free(s);
-            g_array_remove_index_fast(subscriptions_for_channel, i);
+            int remaining = remove_channel_subscription(subscribed_node_id, subscribed_module_id, channel, s);
             if (subscribed_node_id != this_node_id)
-                if (subscriptions_for_channel->len == 0)
+                if (remaining == 0)
                     net_send_unsubscribe(subscribed_node_id, subscribed_module_id, channel);
             break;
         }
     }
 }
 
-module_info *new_module_info(int node_id, int module_id, char *module_name, char *module_type)
-{
-    module_info *info = (module_info *)malloc(sizeof(module_info));
-    info->module_id = module_id;
-    info->node_id = node_id;
-    info->name = module_name;
-    info->name = module_name;
-    info->type = module_type;
-    return info;
-}
-
 /// signal handler, intercept CTRL-C
 static void intHandler(int signum)
 {
@@ -467,6 +819,22 @@ static void intHandler(int signum)
 #define DEFAULT_PRINT_DEBUG_LOGS 1
 #define DEFAULT_LOGS_PATH "logs"
 #define DEFAULT_LOG_FILENAME_SUFFIX "mato.log"
+#define DEFAULT_POST_QUEUE_CAPACITY 4096
+#define DEFAULT_POST_QUEUE_OVERFLOW "block"
+#define DEFAULT_DISPATCH_THREADS 0
+#define DEFAULT_CALLBACK_BUDGET 0
+#define DEFAULT_DEGRADE_SLOW_SUBSCRIBERS 0
+#define DEFAULT_METRICS_INTERVAL 0
+#define DEFAULT_EXECUTORS ""
+#define DEFAULT_THREAD_EXECUTORS ""
+#define DEFAULT_RECORD_FILE ""
+#define DEFAULT_RECORD_CHANNELS ""
+#define DEFAULT_GET_DATA_CACHE_TTL 1000
+#define DEFAULT_START_THREADS 8
+#define DEFAULT_NODE_SEND_QUEUE_CAPACITY 1024
+#define DEFAULT_NODE_SEND_QUEUE_OVERFLOW "drop_oldest"
+#define DEFAULT_NODE_SEND_BATCH_LATENCY 0
+#define DEFAULT_NODE_SEND_BATCH_SIZE 16384
 
 /// load framework variables from the config file (see mato.cnf file for the list)
 static void load_mato_config(char *mato_config_filename)
@@ -477,6 +845,24 @@ static void load_mato_config(char *mato_config_filename)
     mato_core_config.print_debug_logs = mato_config_get_intval(cfg, "print_debug_logs", DEFAULT_PRINT_DEBUG_LOGS);
     mato_core_config.logs_path = mato_config_get_alloc_strval(cfg, "logs_path", DEFAULT_LOGS_PATH);
     mato_core_config.log_filename_suffix = mato_config_get_alloc_strval(cfg, "log_filename_suffix", DEFAULT_LOG_FILENAME_SUFFIX);
+    mato_core_config.post_queue_capacity = mato_config_get_intval(cfg, "post_queue_capacity", DEFAULT_POST_QUEUE_CAPACITY);
+    char *overflow = mato_config_get_strval(cfg, "post_queue_overflow", DEFAULT_POST_QUEUE_OVERFLOW);
+    mato_core_config.post_queue_overflow = (strcmp(overflow, "drop_oldest") == 0) ? mato_queue_drop_oldest : mato_queue_block;
+    mato_core_config.dispatch_threads = mato_config_get_intval(cfg, "dispatch_threads", DEFAULT_DISPATCH_THREADS);
+    mato_core_config.callback_budget = mato_config_get_intval(cfg, "callback_budget", DEFAULT_CALLBACK_BUDGET);
+    mato_core_config.degrade_slow_subscribers = mato_config_get_intval(cfg, "degrade_slow_subscribers", DEFAULT_DEGRADE_SLOW_SUBSCRIBERS);
+    mato_core_config.metrics_interval = mato_config_get_intval(cfg, "metrics_interval", DEFAULT_METRICS_INTERVAL);
+    mato_core_config.executors = mato_config_get_alloc_strval(cfg, "executors", DEFAULT_EXECUTORS);
+    mato_core_config.thread_executors = mato_config_get_alloc_strval(cfg, "thread_executors", DEFAULT_THREAD_EXECUTORS);
+    mato_core_config.record_file = mato_config_get_alloc_strval(cfg, "record_file", DEFAULT_RECORD_FILE);
+    mato_core_config.record_channels = mato_config_get_alloc_strval(cfg, "record_channels", DEFAULT_RECORD_CHANNELS);
+    mato_core_config.get_data_cache_ttl = mato_config_get_intval(cfg, "get_data_cache_ttl", DEFAULT_GET_DATA_CACHE_TTL);
+    mato_core_config.start_threads = mato_config_get_intval(cfg, "start_threads", DEFAULT_START_THREADS);
+    mato_core_config.node_send_queue_capacity = mato_config_get_intval(cfg, "node_send_queue_capacity", DEFAULT_NODE_SEND_QUEUE_CAPACITY);
+    char *send_overflow = mato_config_get_strval(cfg, "node_send_queue_overflow", DEFAULT_NODE_SEND_QUEUE_OVERFLOW);
+    mato_core_config.node_send_queue_overflow = (strcmp(send_overflow, "drop_newest") == 0) ? send_drop_newest : send_drop_oldest;
+    mato_core_config.node_send_batch_latency = mato_config_get_intval(cfg, "node_send_batch_latency", DEFAULT_NODE_SEND_BATCH_LATENCY);
+    mato_core_config.node_send_batch_size = mato_config_get_intval(cfg, "node_send_batch_size", DEFAULT_NODE_SEND_BATCH_SIZE);
 
     mato_config_dispose(cfg);
 }
@@ -485,6 +871,7 @@ void core_mato_init_data(char *mato_config_filename)
 {
     signal(SIGINT, intHandler);
     load_mato_config(mato_config_filename);
+    executors_init();
 
     program_runs = 1;
     threads_started = 0;
@@ -493,16 +880,23 @@ void core_mato_init_data(char *mato_config_filename)
 
     instance_data = g_array_new(0, 0, sizeof(void *));
     module_specifications = g_hash_table_new(g_str_hash, g_str_equal);
-    thread_names = g_hash_table_new(g_int64_hash, g_int64_equal);
+    instance_specifications = g_array_new(0, 0, sizeof(module_specification *));
+    module_ids_by_name = g_hash_table_new_full(g_str_hash, g_str_equal, free, free_module_ids);
+    module_ids_by_type = g_hash_table_new_full(g_str_hash, g_str_equal, free, free_module_ids);
 
     module_names = g_array_new(0, 0, sizeof(GArray *));
     module_types = g_array_new(0, 0, sizeof(GArray *));
     buffers = g_array_new(0, 0, sizeof(GArray *));
-    dangling_channel_data = 0;
+    dangling_channel_data = g_hash_table_new(g_direct_hash, g_direct_equal);
     subscriptions = g_array_new(0, 0, sizeof(GArray *));
 
-    pthread_mutex_init(&framework_mutex, 0);
-    pthread_mutex_init(&threads_mutex, 0);
+    // writers are preferred, so that the registry changes are not starved by the continuous stream of readers
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&framework_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&dangling_mutex, 0);
 }
 
 void core_mato_init()
@@ -519,147 +913,375 @@ void core_mato_init()
         g_array_append_val(subscriptions , subsc);
     }
 
-    if (pipe(post_data_pipe) != 0)
-    {
-        perror("could not create pipe for framework");
-        return;
-    }
+    post_queue = mato_queue_new(mato_core_config.post_queue_capacity, mato_core_config.post_queue_overflow, drop_channel_data);
+    dispatch_init(mato_core_config.dispatch_threads);
+    timers_init();
+    senders_init();
 
     pthread_t t;
     if (pthread_create(&t, 0, mato_core_thread, 0) != 0)
         perror("could not create thread for framework");
+    metrics_init();
+}
+
+/// The channel_data is stored in the same memory block as the message, so that the usable memory remains aligned.
+#define CHANNEL_DATA_HEADER_SIZE ((sizeof(channel_data) + 15) & ~(size_t)15)
+
+void *new_data_buffer(int size)
+{
+    return (uint8_t *)mato_pool_alloc(CHANNEL_DATA_HEADER_SIZE + size) + CHANNEL_DATA_HEADER_SIZE;
+}
+
+void free_data_buffer(void *data)
+{
+    if (data) mato_pool_free((uint8_t *)data - CHANNEL_DATA_HEADER_SIZE);
+}
+
+channel_data *channel_data_of_buffer(void *data)
+{
+    return (channel_data *)((uint8_t *)data - CHANNEL_DATA_HEADER_SIZE);
 }
 
 channel_data *new_channel_data(int node_id, int module_id, int channel_id, int length, void *data)
 {
-    channel_data *cd = (channel_data *)malloc(sizeof(channel_data));
+    // empty messages (data == 0) get a block with the channel_data only
+    uint8_t *buffer = (data == 0) ? new_data_buffer(0) : data;
+    channel_data *cd = (channel_data *)(buffer - CHANNEL_DATA_HEADER_SIZE);
     cd->node_id = node_id;
     cd->module_id = module_id;
     cd->channel_id = channel_id;
     cd->length = length;
     cd->data = data;
     cd->references = 0;
+    cd->slot = -1;
+    cd->generation = 0;
+    cd->post_time = monotonic_usec();
+    cd->frame_id = 0;
+    cd->next_in_batch = 0;
     return cd;
 }
 
+void free_channel_data(channel_data *cd)
+{
+    mato_pool_free(cd);
+}
+
+subscription *new_subscription(subscription_type type, subscriber_callback callback, int subscriber_module_id, int subscriber_node_id)
+{
+    subscription *sub = (subscription *)malloc(sizeof(subscription));
+    sub->type = type;
+    sub->callback = callback;
+    sub->subscriber_module_id = subscriber_module_id;
+    sub->subscriber_node_id = subscriber_node_id;
+    sub->pending = 0;
+    sub->scheduled = 0;
+    sub->removed = 0;
+    sub->references = 0;
+    sub->policy = (type == latest_only) ? coalesce_to_latest : queue_all;
+    sub->max_pending = 1;
+    sub->dropped = 0;
+    latency_histogram_init(&sub->post_to_dispatch);
+    latency_histogram_init(&sub->dispatch_to_return);
+    sub->budget = mato_core_config.callback_budget;
+    sub->degrade_on_overrun = mato_core_config.degrade_slow_subscribers;
+    sub->degraded = 0;
+    sub->overruns = 0;
+    sub->last_overrun_time = 0;
+    sub->last_overrun_warning = 0;
+    return sub;
+}
+
+void free_subscription(subscription *sub)
+{
+    if (sub->pending) g_queue_free(sub->pending);
+    free(sub);
+}
+
+void release_subscription(subscription *sub)
+{
+    if (--sub->references == 0)
+        free_subscription(sub);
+}
+
+/// Allocate a subscription_list for count subscriptions with a single reference, the caller fills in the subscriptions.
+static subscription_list *allocate_subscription_list(int count)
+{
+    subscription_list *list = (subscription_list *)malloc(sizeof(subscription_list) + count * sizeof(subscription *));
+    list->references = 1;
+    list->count = count;
+    return list;
+}
+
+subscription_list *new_subscription_list()
+{
+    return allocate_subscription_list(0);
+}
+
+void acquire_subscription_list(subscription_list *list)
+{
+    list->references++;
+}
+
+void release_subscription_list(subscription_list *list)
+{
+    if (--list->references == 0)
+    {
+        for (int i = 0; i < list->count; i++)
+            release_subscription(list->subs[i]);
+        free(list);
+    }
+}
+
+subscription_list *get_channel_subscriptions(int node_id, int module_id, int channel)
+{
+    GArray *node_subscriptions = g_array_index(subscriptions, GArray *, node_id);
+    if (module_id >= node_subscriptions->len) return 0;
+    GArray *module_subscriptions = g_array_index(node_subscriptions, GArray *, module_id);
+    if ((module_subscriptions == 0) || (channel >= module_subscriptions->len)) return 0;
+    return g_array_index(module_subscriptions, subscription_list *, channel);
+}
+
+/// Put the new list of subscriptions of a channel in place of the current one, that loses the reference of the subscriptions structure.
+static void replace_channel_subscriptions(int node_id, int module_id, int channel, subscription_list *list)
+{
+    GArray *module_subscriptions = g_array_index(g_array_index(subscriptions, GArray *, node_id), GArray *, module_id);
+    subscription_list *old_list = g_array_index(module_subscriptions, subscription_list *, channel);
+    g_array_index(module_subscriptions, subscription_list *, channel) = list;
+    release_subscription_list(old_list);
+}
+
+int add_channel_subscription(int node_id, int module_id, int channel, subscription *sub)
+{
+    subscription_list *old_list = get_channel_subscriptions(node_id, module_id, channel);
+    subscription_list *list = allocate_subscription_list(old_list->count + 1);
+    for (int i = 0; i < old_list->count; i++)
+    {
+        list->subs[i] = old_list->subs[i];
+        list->subs[i]->references++;
+    }
+    list->subs[old_list->count] = sub;
+    sub->references++;
+    replace_channel_subscriptions(node_id, module_id, channel, list);
+    return list->count;
+}
+
+int remove_channel_subscription(int node_id, int module_id, int channel, subscription *sub)
+{
+    subscription_list *old_list = get_channel_subscriptions(node_id, module_id, channel);
+    subscription_list *list = allocate_subscription_list(old_list->count - 1);
+    int count = 0;
+    for (int i = 0; i < old_list->count; i++)
+    {
+        if (old_list->subs[i] == sub) continue;
+        list->subs[count] = old_list->subs[i];
+        list->subs[count++]->references++;
+    }
+    list->count = count;
+    dispatch_retire_subscription(sub);
+    replace_channel_subscriptions(node_id, module_id, channel, list);
+    return count;
+}
+
+/// Returns the subscription of the remote node to the channel of a local module, or 0. Must be called with the framework locked.
+static subscription *find_remote_subscription(subscription_list *subscriptions_for_channel, int remote_node_id)
+{
+    for (int i = 0; subscriptions_for_channel && (i < subscriptions_for_channel->count); i++)
+        if (subscriptions_for_channel->subs[i]->subscriber_node_id == remote_node_id)
+            return subscriptions_for_channel->subs[i];
+    return 0;
+}
+
 void subscribe_channel_from_remote_node(int remote_node_id, int subscribed_module_id, int channel)
 {
-    subscription *new_subscription = (subscription *)malloc(sizeof(subscription));
-    new_subscription->type = data_copy;
-    new_subscription->callback = 0;
-    new_subscription->subscriber_module_id = 0;
-    new_subscription->subscriber_node_id = remote_node_id;
+    subscription *remote_subscription = new_subscription(data_copy, 0, 0, remote_node_id);
     lock_framework();
-        new_subscription->subscription_id = get_free_subscription_id();
-        GArray *channel_subscriptions = g_array_index(g_array_index(g_array_index(subscriptions, GArray *, this_node_id), GArray *, subscribed_module_id), GArray *, channel);
-        g_array_append_val(channel_subscriptions, new_subscription);
+        remote_subscription->subscription_id = get_free_subscription_id();
+        subscription_list *subscriptions_for_channel = get_channel_subscriptions(this_node_id, subscribed_module_id, channel);
+        // a node receives each message once however many of its modules are subscribed, it announces only the first one,
+        // but the announcement may be repeated when the nodes reconnect
+        if (subscriptions_for_channel && !find_remote_subscription(subscriptions_for_channel, remote_node_id))
+            add_channel_subscription(this_node_id, subscribed_module_id, channel, remote_subscription);
+        else
+            free_subscription(remote_subscription);  // the module has been deleted meanwhile, or the node is subscribed already
     unlock_framework();
 }
 
 void unsubscribe_channel_from_remote_node(int remote_node_id, int subscribed_module_id, int channel)
 {
     lock_framework();
-        GArray *subscriptions_for_channel = g_array_index(g_array_index(g_array_index(subscriptions, GArray *, this_node_id), GArray *, subscribed_module_id), GArray *, channel);
-        int number_of_channel_subscriptions = subscriptions_for_channel->len;
-        for (int i = 0; i < number_of_channel_subscriptions; i++)
+        subscription_list *subscriptions_for_channel = get_channel_subscriptions(this_node_id, subscribed_module_id, channel);
+        subscription *remote_subscription = find_remote_subscription(subscriptions_for_channel, remote_node_id);
+        if (remote_subscription)
+            remove_channel_subscription(this_node_id, subscribed_module_id, channel, remote_subscription);
+    unlock_framework();
+}
+
+void pack_and_send_data_to_remote(int remote_node_id, int module_id, int channel, int request_id)
+{
+    channel_data *cd = 0;
+    lock_framework_read();
+        channel_buffers *cb = get_channel_buffers(this_node_id, module_id, channel);
+        if (cb)
         {
-            subscription *s = (subscription *)g_array_index(subscriptions_for_channel, GArray *, i);
-            if (s->subscriber_node_id == remote_node_id)
-            {
-                free(s);
-                g_array_remove_index_fast(subscriptions_for_channel, i);
-                break;
-            }
+            lock_channel(cb);
+                // retrieve the last valid data pointer (and increment reference count)
+                cd = latest_channel_data(cb);
+                if (cd) cd->references++;
+            unlock_channel(cb);
         }
     unlock_framework();
+
+    if (cd == 0)  // module has not provided any data yet, send 0 response
+    {
+        net_send_data(remote_node_id, request_id, 0, 0);
+        return;
+    }
+    // sending outside of the lock, could take some time
+    net_send_data(remote_node_id, request_id, cd->data, cd->length);
+    lock_framework_read();
+        release_channel_data(cd);
+    unlock_framework();
 }
 
-void pack_and_send_data_to_remote(int remote_node_id, int module_id, int channel, int get_data_id)
+/// Returns the most recent message of the channel, the channel must be locked by the caller.
+static channel_data *get_ptr_to_last_data_of_channel(channel_buffers *cb, int *data_length)
 {
-    lock_framework();
-        GArray *module_buffers = g_array_index(g_array_index(buffers, GArray *,this_node_id), GArray *, module_id);
-        GList *waiting_buffers = g_array_index(module_buffers, GList *, channel);
+    channel_data *cd = latest_channel_data(cb);
+    *data_length = cd ? cd->length : 0;
+    return cd;
+}
 
-        if (waiting_buffers == 0)  // module has not provided any data yet, send 0 response
+void copy_of_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data)
+{
+    *data = 0;
+    *data_length = 0;
+    channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+    if (cb == 0) return;
+    lock_channel(cb);
+        channel_data *cd = get_ptr_to_last_data_of_channel(cb, data_length);
+        if (cd)
         {
-    unlock_framework();
-            net_send_data(remote_node_id, get_data_id, 0, 0);
-            return;
+            *data = malloc(cd->length);
+            memcpy(*data, cd->data, cd->length);
         }
-        // retrieve the last valid data pointer (and increment reference count)
-        channel_data *cd = (channel_data *)(waiting_buffers->data);
-        cd->references++;
-    unlock_framework();
-        // sending outside of the lock, could take some time
-        net_send_data(remote_node_id, get_data_id, cd->data, cd->length);
-    lock_framework();
-        waiting_buffers = g_array_index(module_buffers, GList *, channel);
-        waiting_buffers = decrement_references(waiting_buffers, cd);
-        g_array_index(module_buffers, GList *, channel) = waiting_buffers;
-    unlock_framework();
+    unlock_channel(cb);
 }
 
-void return_data_to_waiting_module(int get_data_id, int32_t data_length, uint8_t *data)
+int copy_last_data_of_channel_into(int node_id, int module_id, int channel, void *buffer, int capacity)
 {
-    if (write(get_data_id, &data_length, sizeof(int32_t)) < 0)
-        perror("error writing data size to pipe");
-    else if (write(get_data_id, &data, sizeof(uint8_t *)) < 0)
-        perror("error writing data to pipe");
+    channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+    if (cb == 0) return 0;
+    int length = read_channel_snapshot(cb, buffer, capacity);
+    if (length != SNAPSHOT_NOT_AVAILABLE) return length;
+
+    lock_channel(cb);
+        channel_data *cd = get_ptr_to_last_data_of_channel(cb, &length);
+        if (length > capacity) length = -1;
+        else if (cd) memcpy(buffer, cd->data, length);
+    unlock_channel(cb);
+    return length;
 }
 
-static channel_data *get_ptr_to_last_data_of_channel(int node_id, int module_id, int channel, int *data_length)
+void borrow_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data)
 {
-    GList *waiting_buffers = g_array_index(g_array_index(g_array_index(buffers, GArray *, node_id), GArray *, module_id), GList *, channel);
-    if (waiting_buffers == 0)
-    {
-        *data_length = 0;
-        return 0;
-    }
-    channel_data *cd = (channel_data *)(waiting_buffers->data);
-    *data_length = cd->length;
-    return cd;
+    *data = 0;
+    *data_length = 0;
+    channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+    if (cb == 0) return;
+    lock_channel(cb);
+        channel_data *cd = get_ptr_to_last_data_of_channel(cb, data_length);
+        if (cd)
+        {
+            *data = cd->data;
+            cd->references++;
+        }
+    unlock_channel(cb);
 }
 
-void copy_of_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data)
+void store_borrowed_channel_data(channel_data *cd)
 {
-    channel_data *cd = get_ptr_to_last_data_of_channel(node_id, module_id, channel, data_length);
-    if (cd)
+    channel_buffers *cb = get_channel_buffers(cd->node_id, cd->module_id, cd->channel_id);
+    if (cb)
     {
-        *data = malloc(cd->length);
-        memcpy(*data, cd->data, cd->length);
+        lock_channel(cb);
+            // it becomes the last valid data of the channel, as if it was posted
+            cd->references++;
+            store_latest_channel_data(cb, cd);
+        unlock_channel(cb);
+        return;
     }
-    else *data = 0;
+    pthread_mutex_lock(&dangling_mutex);
+        g_hash_table_insert(dangling_channel_data, cd, cd);
+    pthread_mutex_unlock(&dangling_mutex);
 }
 
-void borrow_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data)
+void release_borrowed_data_of_channel(int node_id, int module_id, int channel, void *data)
 {
-    channel_data *cd = get_ptr_to_last_data_of_channel(node_id, module_id, channel, data_length);
-    if (cd)
+    if (data)
     {
-        *data = cd->data;
-        cd->references++;
+        // the channel_data is right in front of the data, and it knows its slot
+        channel_data *cd = channel_data_of_buffer(data);
+        if ((cd->node_id != node_id) || (cd->module_id != module_id) || (cd->channel_id != channel))
+        {
+            mato_log(ML_ERR, "releasing data of another channel, ignored");
+            return;
+        }
+        release_channel_data(cd);
+        return;
     }
-    else *data = 0;
+
+    // empty messages have no data buffer, any empty message of the channel can be released instead
+    channel_buffers *cb = get_channel_buffers(node_id, module_id, channel);
+    if (cb)
+    {
+        int removed = 0;
+        lock_channel(cb);
+            for (int slot = 0; slot < cb->capacity; slot++)
+            {
+                channel_data *buffer = cb->slots[slot].cd;
+                if (buffer && (buffer->data == 0))
+                {
+                    decrement_references(cb, buffer);
+                    removed = 1;
+                    break;
+                }
+            }
+        unlock_channel(cb);
+        if (removed) return;
+    }
+    pthread_mutex_lock(&dangling_mutex);
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, dangling_channel_data);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+        {
+            channel_data *buffer = (channel_data *)value;
+            if ((buffer->node_id == node_id) && (buffer->module_id == module_id) &&
+                (buffer->channel_id == channel) && (buffer->data == 0))
+            {
+                decrement_dangling_references(buffer);
+                break;
+            }
+        }
+    pthread_mutex_unlock(&dangling_mutex);
 }
 
+/// The name of the calling thread registered by core_register_thread(), empty if the thread has not been registered.
+/// Every thread has its own copy, so retrieving the name for each log message needs no locking.
+static __thread char thread_name[MAX_THREAD_NAME_LENGTH + 1];
+
 void core_register_thread(char *short_thread_name)
 {
-    int64_t *tid = (int64_t *)malloc(sizeof(int64_t));
-    *tid = (int64_t)pthread_self();
-    if (strlen(short_thread_name) > 12) short_thread_name = "TOOLONGNAME";
-    char *name = malloc(strlen(short_thread_name) + 1);
-    strcpy(name, short_thread_name);
-    pthread_mutex_lock(&threads_mutex);
-        g_hash_table_insert(thread_names, tid, name);
-    pthread_mutex_unlock(&threads_mutex);
+    if (strlen(short_thread_name) > MAX_THREAD_NAME_LENGTH) short_thread_name = "TOOLONGNAME";
+    strcpy(thread_name, short_thread_name);
+    // the name of the main thread is the name of the process, it is left as it is
+    if (syscall(SYS_gettid) != getpid())
+        pthread_setname_np(pthread_self(), thread_name);
+    apply_thread_executor(thread_name);
 }
 
 char *core_thread_name()
 {
-    int64_t tid = (int64_t)pthread_self();
-    pthread_mutex_lock(&threads_mutex);
-        char *thread_name = g_hash_table_lookup(thread_names, &tid);
-    pthread_mutex_unlock(&threads_mutex);
-    if (thread_name == 0) thread_name = "noname";
+    if (thread_name[0] == 0) return "noname";
     return thread_name;
 }
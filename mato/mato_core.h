@@ -15,23 +15,50 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "mato.h"
+#include "mato_queue.h"
+#include "mato_latency.h"
 
 #define NODE_MULTIPLIER          100000L
 #define MATO_MAIN_PROGRAM_MODULE  (NODE_MULTIPLIER - 1)
 
 #define NODES_CONFIG_FILENAME "mato_nodes.conf"
 
+/// A key that identifies an output channel of a module on some node, used to group the queued messages of the same channel.
+#define CHANNEL_KEY(node_id, module_id, channel_id)  ((((uint64_t)(node_id) * NODE_MULTIPLIER + (module_id)) << 32) | (uint32_t)(channel_id))
+
+/// A key of a batch of messages (see mato_post_data_batch()) in the post_queue, each batch has its own, so that the drop_oldest
+/// policy never drops a batch for a newer message, nor a message for a batch.
+#define BATCH_KEY(sequence)  ((1ULL << 63) | (uint64_t)(sequence))
+
 /// configurable variables of the mato framework are stored in this structure
 typedef struct {
     int print_all_logs_to_console;
     int print_debug_logs;
     char *logs_path;
     char *log_filename_suffix;
+    int post_queue_capacity;
+    mato_queue_overflow_policy post_queue_overflow;
+    int dispatch_threads;
+    int callback_budget;
+    int degrade_slow_subscribers;
+    int metrics_interval;
+    char *executors;
+    char *thread_executors;
+    char *record_file;
+    char *record_channels;
+    int get_data_cache_ttl;
+    int start_threads;
+    int node_send_queue_capacity;
+    node_send_policy node_send_queue_overflow;
+    int node_send_batch_latency;
+    int node_send_batch_size;
 } mato_config_structure;
 
 /// holds the configurable variables loaded from config file
@@ -40,32 +67,202 @@ extern mato_config_structure mato_core_config;
 /// The structure describes a single individual subscription to some channel of some module.
 /// Each subscription is identified by a computational node unique identifier (id_subscription)
 /// has one of the supported subscription types, pointer to a callback function of the subscriber
-/// and the module_id of the subscriber module.
+/// and the module_id of the subscriber module. The pending and scheduled fields are used by the dispatch workers
+/// (see mato_dispatch.h) and are protected by the dispatch lock.
 typedef struct {
     int subscription_id;
     subscription_type type;
     subscriber_callback callback;
     int subscriber_module_id;
     int subscriber_node_id;
+    /// messages waiting to be delivered by a dispatch worker (created on first use)
+    GQueue *pending;
+    /// the subscription is in the run queue of the workers, or some worker is delivering a message to it
+    int scheduled;
+    /// the subscription has been cancelled, it is not delivered to anymore (set with the framework locked for writing)
+    int removed;
+    /// limits the pending messages, the subscriptions of local modules with other policy than queue_all are always
+    /// served through the pending queue, also when there are no dispatch workers
+    subscription_queue_policy policy;
+    int max_pending;
+    /// number of messages dropped by the policy
+    atomic_long dropped;
+    /// held by each subscription_list that contains the subscription, and by the dispatch workers while it is scheduled
+    atomic_int references;
+    /// latencies of the deliveries to a local subscriber, see mato_get_channel_stats()
+    latency_histogram post_to_dispatch;
+    latency_histogram dispatch_to_return;
+    /// longest allowed duration of the callback in microseconds (0 = unlimited), see mato_set_callback_budget()
+    atomic_long budget;
+    /// switch the subscription to the coalesce_to_latest policy when its callback exceeds the budget
+    atomic_int degrade_on_overrun;
+    atomic_int degraded;
+    atomic_long overruns;
+    /// monotonic_usec() of the last overrun of the budget, and of the last warning about it in the log
+    atomic_llong last_overrun_time;
+    atomic_llong last_overrun_warning;
 } subscription;
 
+/// A constructor for the subscription structure, the subscription_id is to be filled in by the caller.
+subscription *new_subscription(subscription_type type, subscriber_callback callback, int subscriber_module_id, int subscriber_node_id);
+
+/// Deallocate the subscription structure, it must not be used anymore (see release_subscription()).
+void free_subscription(subscription *sub);
+
+/// Decrement the references of the subscription and deallocate it when there are none left.
+void release_subscription(subscription *sub);
+
+/// An immutable array of all subscriptions to a single channel. The array is never changed in place: each subscribe
+/// or unsubscribe replaces it with a modified copy (framework locked for writing). The core thread takes a reference
+/// of the current array for each message, so it can deliver the message to all subscribers without copying the array
+/// and without validating it again after each callback, although the framework is unlocked during the callbacks.
+/// Subscriptions cancelled meanwhile are marked as removed and skipped.
+typedef struct {
+    atomic_int references;
+    int count;
+    subscription *subs[];
+} subscription_list;
+
+/// A constructor for an empty subscription_list with a single reference (of the subscriptions structure).
+subscription_list *new_subscription_list();
+
+/// Take one more reference of the list, the framework must be locked (for reading at least).
+void acquire_subscription_list(subscription_list *list);
+
+/// Return a reference of the list, the list and the references of its subscriptions are released with the last one.
+void release_subscription_list(subscription_list *list);
+
+/// Returns the current subscriptions of a channel of the specified module, or 0 if the module does not exist (anymore).
+/// Must be called with the framework locked (for reading at least).
+subscription_list *get_channel_subscriptions(int node_id, int module_id, int channel);
+
+/// Append a new subscription to the subscriptions of a channel. Returns the number of subscriptions of the channel.
+/// Must be called with the framework locked for writing.
+int add_channel_subscription(int node_id, int module_id, int channel, subscription *sub);
+
+/// Remove a subscription from the subscriptions of a channel and mark it removed. Returns the number of remaining subscriptions
+/// of the channel. Must be called with the framework locked for writing.
+int remove_channel_subscription(int node_id, int module_id, int channel, subscription *sub);
+
 /// The structure holds one message that was posted by a module to one of its output channels.
 /// It contains the module_id of the posting module, the channel number where the message was posted,
-/// the length of the data and pointer to malloc-ed data buffer that holds the actual data,
+/// the length of the data and pointer to the data buffer that holds the actual data,
 /// and the number of references, i.e. how many users (typically modules) have received the data
-/// pointer and must return it back.
-typedef struct {
+/// pointer and must return it back. The references can be incremented by anyone who already holds a reference
+/// (or who holds the lock of the channel), but they are only decremented with the channel locked (see channel_buffers).
+typedef struct channel_data_struct {
     int module_id;
     int channel_id;
     int length;
     void* data;
-    int references;
+    atomic_int references;
     int node_id;
+    /// index of the slot in the channel_buffers of its channel, -1 when the message is in dangling_channel_data
+    int slot;
+    /// generation of that slot when the message was stored there
+    unsigned int generation;
+    /// monotonic_usec() when the message was posted, or when it arrived from its node
+    long long post_time;
+    /// frame id given to mato_post_data_batch(), 0 for the messages posted one by one
+    int frame_id;
+    /// the next message of the same batch (see mato_post_data_batch()), only the first message of a batch is in the post_queue
+    struct channel_data_struct *next_in_batch;
+    /// the header of the message for the subscribed nodes, encoded once when a message of a local module is stored
+    /// (see net_encode_subscribed_data())
+    int32_t encoded_header[4];
 } channel_data;
 
-/// A constructor for the channel_data structure.
+/// A constructor for the channel_data structure. The data must have been allocated by new_data_buffer() (or be 0),
+/// the structure is placed in the same memory block right in front of the data.
 channel_data *new_channel_data(int node_id, int module_id, int channel_id, int length, void *data);
 
+/// Returns the channel_data and its data back to the memory pool.
+void free_channel_data(channel_data *cd);
+
+/// Returns the channel_data of a message with the specified (non-zero) data, i.e. the header in front of the data buffer.
+channel_data *channel_data_of_buffer(void *data);
+
+/// Allocate a buffer for a message from the memory pool, with a space for its channel_data in front of it.
+void *new_data_buffer(int size);
+
+/// Return a buffer obtained by new_data_buffer() that has not been posted to the memory pool.
+void free_data_buffer(void *data);
+
+/// One slot of the channel_buffers, the generation is incremented each time a new message is stored in the slot,
+/// so that a message can verify that it still owns the slot in O(1).
+typedef struct {
+    channel_data *cd;
+    unsigned int generation;
+} channel_slot;
+
+/// All messages of a single output channel of a module that are still in use. The slots are protected by the lock
+/// of the channel, so that the messages of unrelated channels can be posted, borrowed and released in parallel
+/// while the framework is only locked for reading. With the framework locked for writing, the channel lock is not needed.
+/// The slots form a ring: new messages are stored to the next free slot after the previous one, and since the messages
+/// are mostly released in the order they were posted, the next slot is almost always free. Each message remembers its slot,
+/// therefore it is found and removed without searching. When all slots are occupied, the ring doubles its capacity.
+typedef struct {
+    pthread_mutex_t lock;
+    channel_slot *slots;
+    int capacity;
+    /// number of occupied slots
+    int used;
+    /// where to start looking for a free slot
+    int next_slot;
+    /// slot of the most recent message (it holds a reference of the channel), -1 if there is none
+    int latest;
+    /// number of messages stored to the channel and the sum of their lengths, see mato_get_metrics()
+    long messages;
+    long long bytes;
+    /// what is dropped when the send queue of a remote node is full, see mato_set_node_send_policy()
+    node_send_policy send_drop_policy;
+    /// The most recent message is also copied to one of the two snapshots for the readers that do not lock the channel.
+    /// The copying is guarded by the sequence (seqlock): it is odd while a snapshot is being written, and incremented
+    /// twice per message. The n-th message goes to the snapshot n % 2, so the readers copy from the other snapshot
+    /// while the next message is being written, and only retry if two messages are written during a single read.
+    atomic_uint snapshot_sequence;
+    /// the lengths of the messages in the snapshots, the data of longer messages than MATO_SNAPSHOT_SIZE are not copied
+    int snapshot_length[2];
+    uint8_t snapshot[2][MATO_SNAPSHOT_SIZE];
+} channel_buffers;
+
+/// A constructor for the channel_buffers structure.
+channel_buffers *new_channel_buffers();
+
+/// Deallocate the channel_buffers structure, its messages must have been moved away (framework locked for writing).
+void free_channel_buffers(channel_buffers *cb);
+
+/// Returns the most recent message of the channel, or 0 if there is none. The channel must be locked.
+channel_data *latest_channel_data(channel_buffers *cb);
+
+/// Count the messages of the channel that are still in use and the sum of their references. The channel must be locked.
+void channel_buffers_usage(channel_buffers *cb, int *number_of_buffers, int *total_sum_of_ref_count);
+
+/// Returns the number of messages of deleted modules that are still borrowed (see dangling_channel_data).
+/// The framework must be locked (for reading at least).
+int dangling_channel_data_count();
+
+/// A message delivery has started: a message has been posted, or it waits in the pending queue of a subscription (see mato_dispatch.h).
+void delivery_started();
+
+/// The delivery has finished: the posted message has been distributed by the core thread, the pending message has been delivered
+/// to its subscription, or the message has been dropped.
+void delivery_finished();
+
+/// Sleep until no message deliveries are in progress: all messages posted so far have been distributed and the callbacks of their
+/// subscribers have returned (including the messages posted by those callbacks meanwhile). Returns early when the program terminates.
+void wait_for_deliveries();
+
+/// Returns the buffers of a channel of the specified module, or 0 if the module does not exist (anymore).
+/// Must be called with the framework locked (for reading at least).
+channel_buffers *get_channel_buffers(int node_id, int module_id, int channel);
+
+/// Enter the mutually-exclusive area of a single channel, the framework must be locked (for reading at least).
+void lock_channel(channel_buffers *cb);
+
+/// Leave the mutually-exclusive area of a single channel.
+void unlock_channel(channel_buffers *cb);
+
 extern volatile int program_runs;
 
 /// Contains the number of threads that are running. Use the functions mato_inc_thread_count() and mato_dec_thread_count().
@@ -74,6 +271,9 @@ extern volatile int threads_started;
 /// Contains the number of internal framework threads that are running. Use the functions mato_inc_system_thread_count() and mato_dec_system_thread_count().
 extern volatile int system_threads_started;
 
+/// Set when mato_start() has started all modules created before it.
+extern volatile int modules_started;
+
 //global framework data
 
 /// Contains list of names of all module instances.
@@ -97,32 +297,48 @@ extern GArray *instance_data;   // [module_id]
 /// function of a module type.
 extern GHashTable *module_specifications;  // [type_name]
 
+/// Contains pointers to the module_specification of all local module instances, so that they do not need to be looked up
+/// by the type name. The GArray is indexed by module_id, the same way as instance_data, deleted modules have 0 here.
+extern GArray *instance_specifications;  // [module_id]
+
+/// Index of all modules of all nodes by their names, the values are GArrays of (public) module_ids with that name
+/// in the order of nodes and modules (a name is not unique across nodes), see index_module().
+extern GHashTable *module_ids_by_name;  // [module_name] -> GArray of module_id
+
+/// Index of all modules of all nodes by their types, the values are GArrays of (public) module_ids of that type in the order
+/// they have been created or announced.
+extern GHashTable *module_ids_by_type;  // [type_name] -> GArray of module_id
+
 /// Data of all messages that are maintained by the framework at any point of time are kept in this
 /// GArray. It is indexed by module_id and contains GArrays indexed by channel number of the particular
-/// module instance. Finally, the elements of the nested GArray are GLists - the list of all messages
+/// module instance. Finally, the elements of the nested GArray are channel_buffers with slots for all messages
 /// of the particular module in its particular channel that are still needed by the framework or
 /// any other module and thus have not been deallocated. Each time a module posts a new message
-/// to its channel, it is added to that list. The message is removed from the list when it has
+/// to its channel, it is stored in a free slot. The message is removed from its slot when it has
 /// have been forwarded to all the subscribers, no subscriber or another module has borrowed a pointer
 /// to it and a new message from the module on the same channel has already arrived.
-extern GArray *buffers;  // [node_id][module_id][channel_id] -> g_list (the most recent data buffer is at the beginning)
+extern GArray *buffers;  // [node_id][module_id][channel_id] -> channel_buffers (the most recent data buffer is in the latest slot)
 
 /// Contains the remains from the buffers after the module has been deleted, but some our local module
 /// still owns a pointer to some of the channel data. They are moved here when the buffers of that channel are cleared,
-/// and disappear as soon as the owning module returns the borrowed pointer to us.
-extern GList *dangling_channel_data;
+/// and disappear as soon as the owning module returns the borrowed pointer to us. The hash table is keyed
+/// by the channel_data pointers (values are the same pointers).
+/// The table is protected by its own lock while the framework is only locked for reading.
+extern GHashTable *dangling_channel_data;
 
 /// Contains all descriptions of subscriptions, instances of subscription structures.
 /// The GArray is indexed by the module_id and contains GArrays indexed by channel number
-/// Finally, the nested GArray elements are again GArrays containing all subscriptions
+/// Finally, the nested GArray elements are subscription_lists containing all subscriptions
 /// to that particular channel of that particular module.
-extern GArray *subscriptions;  // [node_id][module_id][channel_id][subscription_index] - contains "subcription"s
+extern GArray *subscriptions;  // [node_id][module_id][channel_id] -> subscription_list of "subcription"s
 
-/// New messages that are posted by the modules are allocated in dynamic memory. Pointers to that memory enter this pipe
+/// New messages that are posted by the modules are allocated in dynamic memory. Pointers to that memory enter this queue
 /// and are picked up by a message redistribution loop that takes care of them in a serial manner. Handling of each message
-/// is supposed to be done very quickly - assuming the subscriber callbacks return quickly. In the future release, we expect
-/// each subscriber callback to be called in a separate thread taken from a thread pool.
-extern int post_data_pipe[2];
+/// is supposed to be done very quickly - assuming the subscriber callbacks return quickly. If the dispatch_threads variable
+/// of the framework config is set, the subscriber callbacks are called in the threads of a worker pool (see mato_dispatch.h).
+/// The queue is lock-free for the posting modules, its capacity and overflow policy are configured by the post_queue_capacity
+/// and post_queue_overflow variables of the framework config.
+extern mato_queue *post_queue;
 
 /// Initialize data structures maintained by the core (should be called first, has no dependence)
 void core_mato_init_data();
@@ -134,10 +350,17 @@ void core_mato_init();
 /// Release resources used by the core.
 void core_mato_shutdown();
 
-/// Enter mutually-exclusive area accessing internal framework data structures.
+/// Enter mutually-exclusive area accessing internal framework data structures. This lock is needed for all changes
+/// of the registry of nodes, modules and subscriptions (module_names, module_types, instance_data, subscriptions,
+/// and the arrays of buffers).
 void lock_framework();
 
-/// Leave mutually-exclusive area with a protected acces to internal framework data structures.
+/// Enter the shared area for reading the internal framework data structures: any number of threads can read the registry
+/// at the same time. The messages in buffers can be changed in this area too, but only with the particular channel locked.
+/// Lock ordering: the framework is locked first, then a channel, and the dangling data are locked last.
+void lock_framework_read();
+
+/// Leave the area with a protected acces to internal framework data structures (both exclusive and shared).
 void unlock_framework();
 
 /// Returns the next available module_id.
@@ -151,12 +374,20 @@ int get_free_subscription_id(); // is not thread-safe
 /// then also send to the remote node a notification to remove subscription of our node to that remote channel.
 void remove_subscription(int subscribed_node_id, int subscribed_module_id, int channel, int subscription_id);
 
-/// Decrements the number of references to a particular buffer and deallocates the buffer itself as well
-/// as the structure describing the buffer. It also removes it from the list of the framework-maintained messages.
-GList *decrement_references(GList *data_buffers, channel_data *to_be_decremented);
+/// Decrements the number of references to a particular buffer kept in the channel buffers and deallocates the buffer
+/// itself as well as the structure describing the buffer when nobody uses it anymore. It also removes it from its slot.
+/// The channel must be locked by the caller (or the framework locked for writing).
+void decrement_references(channel_buffers *cb, channel_data *to_be_decremented);
 
-/// A constructor for the module_info structure.
-module_info *new_module_info(int node_id, int module_id, char *module_name, char *module_type);
+/// Decrements the number of references of a message wherever it is kept - in the buffers of its channel,
+/// or in dangling_channel_data if the module or node has been removed meanwhile. Must be called with the framework locked
+/// (for reading at least), the channel must not be locked. A message that is kept in neither place is logged and ignored.
+void release_channel_data(channel_data *cd);
+
+/// Pass a single message to a single subscriber: call its callback according to the subscription type,
+/// or send the message to the subscribed remote node. Must be called with the framework locked for reading, the lock is
+/// released while the callback runs. Borrowed pointers get their own reference, the caller keeps its reference.
+void deliver_channel_data(subscription *sub, channel_data *cd);
 
 /// The number of mato system threads that are currently running (not terminated yet).
 int mato_system_threads_running();
@@ -165,6 +396,14 @@ void remove_node_buffers(int node_id);
 void remove_node_from_subscriptions(int node_id);
 void remove_names_types(int node_id);
 
+/// Add a module to module_ids_by_name and module_ids_by_type, its name and type must be stored in module_names and module_types.
+/// Must be called with the framework locked for writing.
+void index_module(int node_id, int module_id);
+
+/// Remove a module from module_ids_by_name and module_ids_by_type before its name and type are removed from module_names and module_types
+/// (nothing happens if there is no module). Must be called with the framework locked for writing.
+void unindex_module(int node_id, int module_id);
+
 /// Update internal data structures as necessary when a new module announcement arrives from another node
 void store_new_remote_module(int node_id, int module_id, char *module_name, char *module_type, int number_of_channels);
 
@@ -181,22 +420,34 @@ void subscribe_channel_from_remote_node(int remote_node_id, int subscribed_modul
 void unsubscribe_channel_from_remote_node(int remote_node_id, int subscribed_module_id, int channel);
 
 /// Remote module is requesting data from our channel, retrieve them and send back
-void pack_and_send_data_to_remote(int remote_node_id, int module_id, int channel, int get_data_id);
-
-/// Remote node is sending data that some module of this node requested and waits for.
-/// Notify it through pipe so that the data is sent down to the module.
-void return_data_to_waiting_module(int get_data_id, int data_length, uint8_t *data);
+void pack_and_send_data_to_remote(int remote_node_id, int module_id, int channel, int request_id);
 
 /// From buffers, retrieve the most recent message from a specified module/channel, make a copy of it
 /// and return the pointer to and size of the message in the *data_length and *data variables.
 /// If there is no data posted by that module yet, both *data_length and *data will be 0.
+/// Must be called with the framework locked for reading at least, the channel is locked inside.
 void copy_of_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data);
 
+/// From buffers, copy the most recent message from a specified module/channel to the buffer of the specified capacity.
+/// Returns the length of the message, 0 if there is none, or -1 if it does not fit in the buffer. Must be called with the framework
+/// locked for reading at least. The snapshot of the channel is used for small messages, the channel is locked only for larger ones.
+int copy_last_data_of_channel_into(int node_id, int module_id, int channel, void *buffer, int capacity);
+
 /// From buffers, retrieve the most recent message from a specified module/channel, increase its
 /// reference count and return the pointer to and size of the message in the *data_length and *data variables.
 /// If there is no data posted by that module yet, both *data_length and *data will be 0.
+/// Must be called with the framework locked for reading at least, the channel is locked inside.
 void borrow_last_data_of_channel(int node_id, int module_id, int channel, int *data_length, uint8_t **data);
 
+/// Store a message that has been retrieved from a remote node and borrowed by a local module (it has its reference already)
+/// to the buffers of its channel as the last valid data, or to dangling_channel_data if the module has disappeared meanwhile.
+/// Must be called with the framework locked for reading at least.
+void store_borrowed_channel_data(channel_data *cd);
+
+/// Return a data pointer that was borrowed from the specified module/channel: find its message either in buffers,
+/// or in dangling_channel_data and decrement its references. Must be called with the framework locked for reading at least.
+void release_borrowed_data_of_channel(int node_id, int module_id, int channel, void *data);
+
 /// A remote node has announced that its module has been deleted, or module is deleted locally. We have to:
 /// 1) take care of the buffers of that module - decrement references
 /// if any local module is subscribed, the remaining channel_data should go
@@ -205,10 +456,15 @@ void borrow_last_data_of_channel(int node_id, int module_id, int channel, int *d
 /// subscriptions, it should also be removed from the list of module names and types.
 void delete_module_instance(int node_id, int module_id);
 
-/// Registers the name of the thread for better debugging/logging support.
+/// Thread names longer than this are replaced by TOOLONGNAME (the system allows 15 characters).
+#define MAX_THREAD_NAME_LENGTH 12
+
+/// Registers the name of the thread for better debugging/logging support. The name is kept in thread-local storage
+/// and it is also given to the system thread, so that it appears in top -H, perf, gdb and similar tools.
+/// The thread is also moved to its executor, if the thread_executors variable of the framework config assigns one to the name.
 void core_register_thread(char *short_thread_name);
 
-/// Returns the name of this thread that was previously registered with core_register_thread() function.
+/// Returns the name of this thread that was previously registered with core_register_thread() function (without any locking).
 char *core_thread_name();
 
 #endif
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+
+/// \file mato_dispatch.c
+/// Implementation of the Mato control framework - pool of worker threads calling the subscriber callbacks.
+/// Lock ordering: the framework lock is always taken before the dispatch lock.
+
+#include "mato_core.h"
+#include "mato_dispatch.h"
+#include "mato_timer.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// Protects the run queue and the pending, scheduled and removed fields of all subscriptions.
+static pthread_mutex_t dispatch_mutex;
+
+/// Signalled when a subscription has been appended to the run queue, a timer to the timer queue, or the workers should terminate.
+static pthread_cond_t work_available;
+
+/// Subscriptions that have some pending messages and wait for a worker, in the order they became ready.
+static GQueue *run_queue;
+
+/// Expired timers whose callbacks wait for a worker, they go before the subscriptions.
+static GQueue *timer_queue;
+
+/// Number of messages in the pending queues of all subscriptions, see dispatch_pending_messages().
+static int pending_messages;
+
+static int number_of_workers;
+static volatile int workers_run;
+
+/// Deliver the oldest pending message of a subscription that has been taken from the run queue. Called with the dispatch
+/// lock held, which is released during the delivery.
+static void serve_subscription(subscription *sub)
+{
+    channel_data *cd = (channel_data *)g_queue_pop_head(sub->pending);
+    if (cd) pending_messages--;
+    pthread_mutex_unlock(&dispatch_mutex);
+
+    if (cd)
+    {
+        lock_framework_read();
+            // removed is only set with both locks held (the framework one for writing), so it can be read under either of them
+            if (!sub->removed)
+                deliver_channel_data(sub, cd);
+            release_channel_data(cd);
+        unlock_framework();
+        delivery_finished();
+    }
+
+    pthread_mutex_lock(&dispatch_mutex);
+    if (!sub->removed && !g_queue_is_empty(sub->pending))
+        g_queue_push_tail(run_queue, sub);   // back to the end, the other subscriptions go first
+    else
+    {
+        sub->scheduled = 0;
+        release_subscription(sub);
+    }
+}
+
+static void *dispatch_worker_thread(void *arg)
+{
+    char thread_name[13];
+    sprintf(thread_name, "dispatch%d", (int)(intptr_t)arg);
+    mato_inc_system_thread_count(thread_name);
+
+    pthread_mutex_lock(&dispatch_mutex);
+    while (1)
+    {
+        while (workers_run && g_queue_is_empty(run_queue) && g_queue_is_empty(timer_queue))
+            pthread_cond_wait(&work_available, &dispatch_mutex);
+        if (!workers_run) break;
+
+        mato_timer *t = (mato_timer *)g_queue_pop_head(timer_queue);
+        if (t)
+        {
+            pthread_mutex_unlock(&dispatch_mutex);
+                fire_timer(t);
+                timer_fired(t);
+            pthread_mutex_lock(&dispatch_mutex);
+        }
+        else serve_subscription((subscription *)g_queue_pop_head(run_queue));
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
+
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+void dispatch_init(int workers)
+{
+    pthread_mutex_init(&dispatch_mutex, 0);
+    pthread_cond_init(&work_available, 0);
+    run_queue = g_queue_new();
+    timer_queue = g_queue_new();
+    workers_run = 1;
+    number_of_workers = 0;
+    pending_messages = 0;
+
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_t t;
+        if (pthread_create(&t, 0, dispatch_worker_thread, (void *)(intptr_t)i) != 0)
+        {
+            perror("could not create dispatch worker thread");
+            break;
+        }
+        number_of_workers++;
+    }
+    if (number_of_workers) mato_log_val(ML_INFO, "dispatch worker threads:", number_of_workers);
+}
+
+void dispatch_shutdown()
+{
+    pthread_mutex_lock(&dispatch_mutex);
+        workers_run = 0;
+        pthread_cond_broadcast(&work_available);
+    pthread_mutex_unlock(&dispatch_mutex);
+}
+
+int dispatch_workers()
+{
+    return number_of_workers;
+}
+
+int dispatch_pending_messages()
+{
+    pthread_mutex_lock(&dispatch_mutex);
+        int pending = pending_messages;
+    pthread_mutex_unlock(&dispatch_mutex);
+    return pending;
+}
+
+int dispatch_uses_pending(subscription *sub)
+{
+    if (sub->subscriber_node_id != this_node_id) return 0;
+    return (number_of_workers > 0) || (sub->policy != queue_all);
+}
+
+void dispatch_run_pending(int single_round)
+{
+    pthread_mutex_lock(&dispatch_mutex);
+        int turns = g_queue_get_length(run_queue);
+        while (!g_queue_is_empty(run_queue) && (!single_round || (turns-- > 0)))
+            serve_subscription((subscription *)g_queue_pop_head(run_queue));
+    pthread_mutex_unlock(&dispatch_mutex);
+}
+
+int dispatch_degrade_subscription(subscription *sub)
+{
+    int degraded = 0;
+    pthread_mutex_lock(&dispatch_mutex);
+        if (sub->policy == queue_all)
+        {
+            // dispatch_uses_pending() reads the policy without this lock only when there are no workers,
+            // and then it runs in the core thread, which is also the only one that calls this
+            sub->policy = coalesce_to_latest;
+            sub->max_pending = 1;
+            degraded = 1;
+        }
+        sub->degraded = 1;
+    pthread_mutex_unlock(&dispatch_mutex);
+    return degraded;
+}
+
+void dispatch_to_subscription(subscription *sub, channel_data *cd)
+{
+    cd->references++;  // being delivered by a worker
+    pthread_mutex_lock(&dispatch_mutex);
+        if (sub->pending == 0) sub->pending = g_queue_new();
+        if (sub->policy != queue_all)
+        {
+            // skip the stale messages instead of queueing them
+            unsigned int limit = (sub->policy == keep_last_n) ? sub->max_pending : 1;
+            while (g_queue_get_length(sub->pending) >= limit)
+            {
+                release_channel_data((channel_data *)g_queue_pop_head(sub->pending));
+                pending_messages--;
+                sub->dropped++;
+                delivery_finished();
+            }
+        }
+        g_queue_push_tail(sub->pending, cd);
+        pending_messages++;
+        delivery_started();
+        if (!sub->scheduled)
+        {
+            sub->scheduled = 1;
+            sub->references++;
+            g_queue_push_tail(run_queue, sub);
+            if (number_of_workers) pthread_cond_signal(&work_available);
+        }
+    pthread_mutex_unlock(&dispatch_mutex);
+}
+
+void dispatch_timer(mato_timer *t)
+{
+    pthread_mutex_lock(&dispatch_mutex);
+        g_queue_push_tail(timer_queue, t);
+        pthread_cond_signal(&work_available);
+    pthread_mutex_unlock(&dispatch_mutex);
+}
+
+void dispatch_retire_subscription(subscription *sub)
+{
+    pthread_mutex_lock(&dispatch_mutex);
+        sub->removed = 1;
+        if (sub->pending)
+        {
+            channel_data *cd;
+            while ((cd = (channel_data *)g_queue_pop_head(sub->pending)))
+            {
+                release_channel_data(cd);
+                pending_messages--;
+                delivery_finished();
+            }
+        }
+    pthread_mutex_unlock(&dispatch_mutex);
+}
@@ -0,0 +1,58 @@
+#ifndef __MATO_DISPATCH_H__
+#define __MATO_DISPATCH_H__
+
+/// \file mato_dispatch.h
+/// Mato control framework - a pool of worker threads that call the subscriber callbacks.
+/// When the dispatch_threads variable of the framework config is 0 (default), the core thread calls all subscriber
+/// callbacks by itself one after another, otherwise each message is appended to the pending queue of each
+/// subscription and the subscriptions with pending messages are served by the workers. A single subscription
+/// is served by at most one worker at a time (so its messages are delivered in the order they have been posted),
+/// different subscriptions are served in parallel, and a subscription only receives one message per turn,
+/// so that a slow subscriber cannot occupy the workers needed by the others. Subscriptions of remote nodes
+/// are still served by the core thread. The subscriptions with a queue policy (see subscription_queue_policy) always
+/// use the pending queue, where the policy drops the stale messages: without workers, the core thread delivers
+/// their pending messages whenever there is no new message to distribute, and regularly while it is busy.
+/// The callbacks of the expired timers (see mato_timer.h) are also called by the workers, before the subscriptions.
+
+#include "mato_core.h"
+#include "mato_timer.h"
+
+/// Start the specified number of worker threads (no threads are started for 0).
+void dispatch_init(int number_of_workers);
+
+/// Stop the worker threads, the messages still waiting for them are abandoned.
+void dispatch_shutdown();
+
+/// Returns the number of worker threads, 0 means the callbacks are called directly by the core thread.
+int dispatch_workers();
+
+/// Returns the number of messages waiting in the pending queues of all subscriptions.
+int dispatch_pending_messages();
+
+/// Returns 1 if the messages for the subscription should go through dispatch_to_subscription(), 0 if the core thread
+/// delivers them directly.
+int dispatch_uses_pending(subscription *sub);
+
+/// Deliver the pending messages in the calling thread (the core thread does this when there are no worker threads):
+/// all of them, or just one message for each subscription that is waiting. Must be called without the framework locked.
+void dispatch_run_pending(int single_round);
+
+/// Append the message to the pending messages of the subscription and schedule the subscription for a worker.
+/// The message gets one more reference that is returned by the worker after the delivery, and the subscription gets
+/// one more reference while it is scheduled. Must be called with the framework locked.
+void dispatch_to_subscription(subscription *sub, channel_data *cd);
+
+/// Append an expired timer to the timer queue of the workers, they call its callback before serving the subscriptions
+/// (see fire_timer()). The timer holds a reference for the callback. Must only be called when there are worker threads.
+void dispatch_timer(mato_timer *t);
+
+/// Switch a local subscription with the queue_all policy to coalesce_to_latest, because its callback is too slow (see the callback
+/// budget in mato_set_callback_budget()). Returns 1 if the policy has been changed, 0 if the subscription already had another policy.
+/// Must be called with the framework locked (for reading at least).
+int dispatch_degrade_subscription(subscription *sub);
+
+/// The subscription has been removed from the subscriptions structure: mark it removed, its pending messages are not delivered
+/// anymore. The subscription itself is released with its last reference. Must be called with the framework locked for writing.
+void dispatch_retire_subscription(subscription *sub);
+
+#endif
@@ -0,0 +1,230 @@
+/// \file mato_executor.c
+/// Implementation of the Mato control framework - executors with CPU affinity and scheduling policy for the threads.
+
+#include "mato_executor.h"
+#include "mato_logs.h"
+
+/// The executors and the assignments of the threads are parsed once at the start and never change, so they are read without locking.
+static mato_executor executors[MAX_EXECUTORS];
+static int number_of_executors;
+
+#define MAX_THREAD_EXECUTORS 64
+
+/// Assignment of the threads to the executors: the thread name, or its prefix if it ended with *.
+typedef struct {
+    char thread_name[MAX_THREAD_NAME_LENGTH + 1];
+    int is_prefix;
+    mato_executor *executor;
+} thread_executor;
+
+static thread_executor thread_executors[MAX_THREAD_EXECUTORS];
+static int number_of_thread_executors;
+
+/// Parse a list of cores like 0,2-3 (or "all") into the set. Returns 0 if it cannot be parsed.
+static int parse_cpus(char *list, cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+    if (strcmp(list, "all") == 0) return 1;
+    char *save;
+    for (char *range = strtok_r(list, ",", &save); range; range = strtok_r(0, ",", &save))
+    {
+        int first, last;
+        int n = sscanf(range, "%d-%d", &first, &last);
+        if (n < 1) return 0;
+        if (n == 1) last = first;
+        if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) return 0;
+        for (int cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+    }
+    return 1;
+}
+
+/// Parse a single executor: name cpus policy priority.
+static void parse_executor(char *definition)
+{
+    char name[MAX_EXECUTOR_NAME_LENGTH + 1], cpus[100], policy[10];
+    int priority = 0;
+    int n = sscanf(definition, "%15s %99s %9s %d", name, cpus, policy, &priority);
+    if (n <= 0) return;   // empty
+    if (n < 3)
+    {
+        printf("mato: could not parse executor '%s'\n", definition);
+        return;
+    }
+    if (number_of_executors == MAX_EXECUTORS)
+    {
+        printf("mato: too many executors, '%s' ignored\n", name);
+        return;
+    }
+
+    mato_executor *executor = &executors[number_of_executors];
+    strcpy(executor->name, name);
+    executor->priority = priority;
+    if (strcmp(policy, "fifo") == 0) executor->policy = SCHED_FIFO;
+    else if (strcmp(policy, "rr") == 0) executor->policy = SCHED_RR;
+    else if (strcmp(policy, "other") == 0)
+    {
+        executor->policy = SCHED_OTHER;
+        executor->priority = 0;
+    }
+    else
+    {
+        printf("mato: unknown scheduling policy '%s' of executor %s\n", policy, name);
+        return;
+    }
+    if (!parse_cpus(cpus, &executor->cpus))
+    {
+        printf("mato: could not parse the cores '%s' of executor %s\n", cpus, name);
+        return;
+    }
+    number_of_executors++;
+}
+
+/// Parse a single assignment: thread_name=executor.
+static void parse_thread_executor(char *assignment)
+{
+    char *equals = strchr(assignment, '=');
+    if ((equals == 0) || (equals == assignment))
+    {
+        printf("mato: could not parse thread executor '%s'\n", assignment);
+        return;
+    }
+    *equals = 0;
+    int length = strlen(assignment);
+    int is_prefix = (assignment[length - 1] == '*');
+    if (is_prefix) length--;
+    if (length > MAX_THREAD_NAME_LENGTH)
+    {
+        printf("mato: thread name '%s' of thread executor is too long\n", assignment);
+        return;
+    }
+    mato_executor *executor = find_executor(equals + 1);
+    if (executor == 0)
+    {
+        printf("mato: unknown executor '%s' of thread %s\n", equals + 1, assignment);
+        return;
+    }
+    if (number_of_thread_executors == MAX_THREAD_EXECUTORS) return;
+
+    thread_executor *te = &thread_executors[number_of_thread_executors++];
+    te->is_prefix = is_prefix;
+    assignment[length] = 0;
+    strcpy(te->thread_name, assignment);
+    te->executor = executor;
+}
+
+void executors_init()
+{
+    number_of_executors = 0;
+    number_of_thread_executors = 0;
+
+    char *definitions = strdup(mato_core_config.executors);
+    char *save;
+    for (char *definition = strtok_r(definitions, ";", &save); definition; definition = strtok_r(0, ";", &save))
+        parse_executor(definition);
+    free(definitions);
+
+    char *assignments = strdup(mato_core_config.thread_executors);
+    for (char *assignment = strtok_r(assignments, " \t", &save); assignment; assignment = strtok_r(0, " \t", &save))
+        parse_thread_executor(assignment);
+    free(assignments);
+}
+
+mato_executor *find_executor(const char *executor_name)
+{
+    for (int i = 0; i < number_of_executors; i++)
+        if (strcmp(executors[i].name, executor_name) == 0)
+            return &executors[i];
+    return 0;
+}
+
+int apply_executor(mato_executor *executor)
+{
+    int success = 1;
+    int error;
+    if (CPU_COUNT(&executor->cpus) > 0)
+        if ((error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &executor->cpus)) != 0)
+        {
+            mato_log_str_val(ML_WARN, "could not set the cores of the thread, executor ", executor->name, error);
+            success = 0;
+        }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(struct sched_param));
+    param.sched_priority = executor->priority;
+    if ((error = pthread_setschedparam(pthread_self(), executor->policy, &param)) != 0)
+    {
+        mato_log_str_val(ML_WARN, "could not set the scheduling policy of the thread, executor ", executor->name, error);
+        success = 0;
+    }
+    return success;
+}
+
+int mato_use_executor(const char *executor_name)
+{
+    mato_executor *executor = find_executor(executor_name);
+    if (executor == 0)
+    {
+        mato_log_str(ML_ERR, "there is no executor", executor_name);
+        return 0;
+    }
+    return apply_executor(executor);
+}
+
+/// What a thread started by mato_start_thread() should run.
+typedef struct {
+    char short_thread_name[MAX_THREAD_NAME_LENGTH + 1];
+    mato_executor *executor;
+    void *(*thread_function)(void *);
+    void *arg;
+} module_thread_start;
+
+static void *module_thread(void *arg)
+{
+    module_thread_start *start = (module_thread_start *)arg;
+    mato_inc_thread_count(start->short_thread_name);
+    if (start->executor) apply_executor(start->executor);
+    void *result = start->thread_function(start->arg);
+    free(start);
+    mato_dec_thread_count();
+    return result;
+}
+
+int mato_start_thread(const char *short_thread_name, const char *executor_name, void *(*thread_function)(void *), void *arg)
+{
+    mato_executor *executor = 0;
+    if (executor_name && ((executor = find_executor(executor_name)) == 0))
+    {
+        mato_log_str(ML_ERR, "there is no executor", executor_name);
+        return 0;
+    }
+    module_thread_start *start = (module_thread_start *)malloc(sizeof(module_thread_start));
+    strncpy(start->short_thread_name, short_thread_name, MAX_THREAD_NAME_LENGTH);
+    start->short_thread_name[MAX_THREAD_NAME_LENGTH] = 0;
+    start->executor = executor;
+    start->thread_function = thread_function;
+    start->arg = arg;
+
+    pthread_t t;
+    if (pthread_create(&t, 0, module_thread, start) != 0)
+    {
+        perror("could not create module thread");
+        free(start);
+        return 0;
+    }
+    pthread_detach(t);
+    return 1;
+}
+
+void apply_thread_executor(const char *short_thread_name)
+{
+    for (int i = 0; i < number_of_thread_executors; i++)
+    {
+        thread_executor *te = &thread_executors[i];
+        if (te->is_prefix ? (strncmp(short_thread_name, te->thread_name, strlen(te->thread_name)) == 0)
+                          : (strcmp(short_thread_name, te->thread_name) == 0))
+        {
+            apply_executor(te->executor);
+            return;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef __MATO_EXECUTOR_H__
+#define __MATO_EXECUTOR_H__
+
+/// \file mato_executor.h
+/// Mato control framework - executors: named sets of CPU cores with a scheduling policy and priority that the framework
+/// and module threads run on. The executors are defined by the executors variable of the framework config, and
+/// the thread_executors variable assigns them to the threads by their short names (see mato_inc_thread_count()), for example:
+/// ~~~~
+/// executors: safety 2-3 fifo 50; gui 0-1 other 0
+/// thread_executors: core=safety dispatch*=safety timers=safety logs=gui comm=gui viewer=gui
+/// ~~~~
+/// A thread is moved to its executor when it registers its name, the modules can also start their threads directly
+/// on an executor (mato_start_thread()). Threads that are not assigned to any executor keep the default scheduling.
+
+#include "mato_core.h"
+
+#include <sched.h>
+
+#define MAX_EXECUTORS 16
+#define MAX_EXECUTOR_NAME_LENGTH 15
+
+typedef struct {
+    char name[MAX_EXECUTOR_NAME_LENGTH + 1];
+    /// the cores the threads may run on, empty means all cores
+    cpu_set_t cpus;
+    /// SCHED_OTHER, SCHED_FIFO or SCHED_RR, and the real-time priority (0 for SCHED_OTHER)
+    int policy;
+    int priority;
+} mato_executor;
+
+/// Parse the executors and thread_executors variables of the framework config (see mato_config_structure).
+void executors_init();
+
+/// Returns the executor with the specified name, or 0 if there is none.
+mato_executor *find_executor(const char *executor_name);
+
+/// Move the calling thread to the executor. Returns 1 on success, 0 if the affinity or the scheduling could not be set
+/// (typically because a real-time policy requires privileges), which is logged.
+int apply_executor(mato_executor *executor);
+
+/// Move the calling thread to the executor assigned to its short name by the thread_executors variable of the framework config,
+/// if there is one. Called when the thread registers its name.
+void apply_thread_executor(const char *short_thread_name);
+
+#endif
@@ -0,0 +1,75 @@
+/// \file mato_latency.c
+/// Implementation of the Mato control framework - latency histograms of the message delivery.
+
+#include <string.h>
+
+#include "mato_latency.h"
+
+/// Returns the bucket of the latency: values below 8 have their own buckets, larger values are split by their highest bit
+/// and the next three bits.
+static int bucket_of(long long latency)
+{
+    if (latency < LATENCY_LINEAR_BUCKETS) return (latency < 0) ? 0 : (int)latency;
+    int highest_bit = 63 - __builtin_clzll((unsigned long long)latency);
+    int bucket = (highest_bit - 2) * 8 + (int)((latency >> (highest_bit - 3)) & 7);
+    return (bucket < LATENCY_BUCKETS) ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/// Returns the largest latency that is recorded in the bucket.
+static long long upper_bound_of(int bucket)
+{
+    if (bucket < LATENCY_LINEAR_BUCKETS) return bucket;
+    int highest_bit = bucket / 8 + 2;
+    long long lower = (long long)(8 + bucket % 8) << (highest_bit - 3);
+    return lower + (1LL << (highest_bit - 3)) - 1;
+}
+
+void latency_histogram_init(latency_histogram *h)
+{
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        atomic_init(&h->buckets[bucket], 0);
+    atomic_init(&h->count, 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+void latency_histogram_record(latency_histogram *h, long long latency)
+{
+    if (latency < 0) latency = 0;
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(latency)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, latency, memory_order_relaxed);
+    long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while ((latency > max) &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &max, latency, memory_order_relaxed, memory_order_relaxed));
+}
+
+void latency_histogram_summary(latency_histogram *h, mato_latency_stats *stats)
+{
+    unsigned int counts[LATENCY_BUCKETS];
+    long count = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        counts[bucket] = atomic_load_explicit(&h->buckets[bucket], memory_order_relaxed);
+        count += counts[bucket];
+    }
+    memset(stats, 0, sizeof(mato_latency_stats));
+    stats->count = count;
+    if (count == 0) return;
+    stats->mean = (double)atomic_load(&h->sum) / atomic_load(&h->count);
+    stats->max = atomic_load(&h->max);
+
+    static const double fractions[4] = { 0.5, 0.9, 0.99, 0.999 };
+    long long *percentiles[4] = { &stats->p50, &stats->p90, &stats->p99, &stats->p999 };
+    long seen = 0;
+    int bucket = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        long rank = (long)(fractions[i] * count + 0.999999);
+        if (rank < 1) rank = 1;
+        while ((seen + counts[bucket] < rank) && (bucket < LATENCY_BUCKETS - 1))
+            seen += counts[bucket++];
+        long long value = upper_bound_of(bucket);
+        *percentiles[i] = (value < stats->max) ? value : stats->max;
+    }
+}
@@ -77,6 +77,9 @@ static void *mato_logs_thread(void *arg)
         }        
     }
     close(log_queue[0]);
+    // only now, the messages logged just before the shutdown have been written
+    free(log_filename);
+    log_filename = 0;
     mato_dec_system_thread_count();
     return 0;
 }
@@ -132,8 +135,7 @@ void mato_logs_init()
 
 void mato_logs_shutdown()
 {
-    free(log_filename);
-    log_filename = 0;
+    // the logs thread writes what remains in the pipe and terminates
     close(log_queue[1]);
 }
 
@@ -295,4 +297,11 @@ long long usec()
     return (1000000L * (long long)tv.tv_sec) + tv.tv_usec;
 }
 
+long long monotonic_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (1000000L * (long long)ts.tv_sec) + ts.tv_nsec / 1000L;
+}
+
 
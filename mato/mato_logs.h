@@ -60,4 +60,7 @@ long long msec();
 /// Return current time in usec.
 long long usec();
 
+/// Return the time of a monotonic clock in usec, for measuring intervals (it does not jump when the system time is set).
+long long monotonic_usec();
+
 #endif
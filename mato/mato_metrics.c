@@ -0,0 +1,201 @@
+/// \file mato_metrics.c
+/// Implementation of the Mato control framework - snapshots of the framework metrics and their periodic dump.
+
+#include "mato_metrics.h"
+#include "mato_dispatch.h"
+#include "mato_net.h"
+#include "mato_sender.h"
+#include "mato_logs.h"
+
+/// Append the metrics of all channels of a module to the snapshot. The framework must be locked (for reading at least).
+static void collect_module_channels(GArray *channels, int node_id, int module_id, char *module_name, GArray *module_buffers)
+{
+    for (int channel = 0; channel < module_buffers->len; channel++)
+    {
+        channel_buffers *cb = g_array_index(module_buffers, channel_buffers *, channel);
+        mato_channel_metrics m;
+        memset(&m, 0, sizeof(mato_channel_metrics));
+        m.node_id = node_id;
+        m.module_id = node_id * NODE_MULTIPLIER + module_id;
+        m.channel = channel;
+        strncpy(m.module_name, module_name, MATO_METRICS_NAME_LENGTH - 1);
+
+        lock_channel(cb);
+            m.messages = cb->messages;
+            m.bytes = cb->bytes;
+            channel_buffers_usage(cb, &m.buffers, &m.references);
+        unlock_channel(cb);
+
+        subscription_list *list = get_channel_subscriptions(node_id, module_id, channel);
+        if (list) m.subscribers = list->count;
+        g_array_append_val(channels, m);
+    }
+}
+
+/// Compute the rates of the channels and nodes of the snapshot since the previous one. The channels of both snapshots
+/// are ordered by node, module and channel, so that they are matched in a single pass.
+static void compute_rates(mato_metrics *metrics, mato_metrics *previous)
+{
+    metrics->interval = (metrics->time - previous->time) / 1000000.0;
+    if (metrics->interval <= 0) return;
+
+    int j = 0;
+    for (int i = 0; i < metrics->number_of_channels; i++)
+    {
+        mato_channel_metrics *m = &metrics->channels[i];
+        while ((j < previous->number_of_channels) &&
+               ((previous->channels[j].module_id < m->module_id) ||
+                ((previous->channels[j].module_id == m->module_id) && (previous->channels[j].channel < m->channel))))
+            j++;
+        if ((j == previous->number_of_channels) || (previous->channels[j].module_id != m->module_id) ||
+            (previous->channels[j].channel != m->channel) || (previous->channels[j].messages > m->messages))
+            continue;   // a new channel, or a new module with the same module_id
+        m->messages_per_second = (m->messages - previous->channels[j].messages) / metrics->interval;
+        m->bytes_per_second = (m->bytes - previous->channels[j].bytes) / metrics->interval;
+    }
+
+    for (int node_id = 0; (node_id < metrics->number_of_nodes) && (node_id < previous->number_of_nodes); node_id++)
+    {
+        mato_node_metrics *n = &metrics->nodes[node_id];
+        n->bytes_sent_per_second = (n->bytes_sent - previous->nodes[node_id].bytes_sent) / metrics->interval;
+        n->bytes_received_per_second = (n->bytes_received - previous->nodes[node_id].bytes_received) / metrics->interval;
+    }
+}
+
+mato_metrics *mato_get_metrics(mato_metrics *previous)
+{
+    mato_metrics *metrics = (mato_metrics *)calloc(1, sizeof(mato_metrics));
+    GArray *channels = g_array_new(0, 0, sizeof(mato_channel_metrics));
+
+    metrics->this_node_id = this_node_id;
+    metrics->number_of_nodes = nodes->len;
+    metrics->nodes = (mato_node_metrics *)calloc(nodes->len, sizeof(mato_node_metrics));
+
+    lock_framework_read();
+        metrics->time = monotonic_usec();
+        for (int node_id = 0; node_id < nodes->len; node_id++)
+        {
+            mato_node_metrics *n = &metrics->nodes[node_id];
+            n->node_id = node_id;
+            n->is_online = g_array_index(nodes, node_info *, node_id)->is_online;
+            if (node_id != this_node_id)
+            {
+                net_traffic(node_id, &n->bytes_sent, &n->bytes_received);
+                sender_queue_usage(node_id, &n->send_queue_length, &n->send_queue_dropped);
+            }
+
+            GArray *names = g_array_index(module_names, GArray *, node_id);
+            GArray *node_buffers = g_array_index(buffers, GArray *, node_id);
+            for (int module_id = 0; module_id < names->len; module_id++)
+            {
+                char *name = g_array_index(names, char *, module_id);
+                if (name == 0) continue;
+                n->modules++;
+                if (module_id >= node_buffers->len) continue;
+                GArray *module_buffers = g_array_index(node_buffers, GArray *, module_id);
+                if (module_buffers) collect_module_channels(channels, node_id, module_id, name, module_buffers);
+            }
+        }
+        metrics->post_queue_length = mato_queue_length(post_queue);
+        metrics->post_queue_dropped = mato_queue_dropped(post_queue);
+        metrics->pending_messages = dispatch_pending_messages();
+        metrics->dangling_buffers = dangling_channel_data_count();
+    unlock_framework();
+
+    metrics->threads = mato_threads_running();
+    metrics->system_threads = mato_system_threads_running();
+    metrics->dispatch_threads = dispatch_workers();
+    metrics->number_of_channels = channels->len;
+    metrics->channels = (mato_channel_metrics *)malloc(channels->len * sizeof(mato_channel_metrics) + 1);
+    memcpy(metrics->channels, channels->data, channels->len * sizeof(mato_channel_metrics));
+    g_array_free(channels, 1);
+
+    if (previous) compute_rates(metrics, previous);
+    return metrics;
+}
+
+void mato_free_metrics(mato_metrics *metrics)
+{
+    if (metrics == 0) return;
+    free(metrics->nodes);
+    free(metrics->channels);
+    free(metrics);
+}
+
+void mato_write_metrics(FILE *f, mato_metrics *metrics)
+{
+    fprintf(f, "snapshot %ld %d %.3f\n", (long)time(0), metrics->this_node_id, metrics->interval);
+    fprintf(f, "queues %d %ld %d %d\n", metrics->post_queue_length, metrics->post_queue_dropped,
+            metrics->pending_messages, metrics->dangling_buffers);
+    fprintf(f, "threads %d %d %d\n", metrics->threads, metrics->system_threads, metrics->dispatch_threads);
+    for (int node_id = 0; node_id < metrics->number_of_nodes; node_id++)
+    {
+        mato_node_metrics *n = &metrics->nodes[node_id];
+        if (node_id == metrics->this_node_id) continue;
+        fprintf(f, "net %d %d %d %lld %lld %.0f %.0f %d %ld\n", n->node_id, n->is_online, n->modules,
+                n->bytes_sent, n->bytes_received, n->bytes_sent_per_second, n->bytes_received_per_second,
+                n->send_queue_length, n->send_queue_dropped);
+    }
+    for (int i = 0; i < metrics->number_of_channels; i++)
+    {
+        mato_channel_metrics *m = &metrics->channels[i];
+        char name[MATO_METRICS_NAME_LENGTH];
+        strcpy(name, m->module_name);
+        for (char *c = name; *c; c++)
+            if ((*c == ' ') || (*c == '\t')) *c = '_';
+        fprintf(f, "channel %d %d %s %ld %lld %.1f %.0f %d %d %d\n", m->module_id, m->channel, name[0] ? name : "_",
+                m->messages, m->bytes, m->messages_per_second, m->bytes_per_second, m->subscribers, m->buffers, m->references);
+    }
+    fprintf(f, "end\n");
+}
+
+/// Takes a snapshot of the metrics every metrics_interval seconds and appends it to the metrics file until the framework shuts down.
+static void *metrics_thread(void *arg)
+{
+    char *filename = (char *)arg;
+    mato_inc_system_thread_count("metrics");
+
+    mato_metrics *previous = mato_get_metrics(0);
+    long long next_dump = monotonic_usec();
+    while (program_runs)
+    {
+        next_dump += mato_core_config.metrics_interval * 1000000LL;
+        // sleep in short steps, so that the shutdown is not delayed
+        while (program_runs && (monotonic_usec() < next_dump)) usleep(50000);
+        if (!program_runs) break;
+
+        mato_metrics *metrics = mato_get_metrics(previous);
+        mato_free_metrics(previous);
+        previous = metrics;
+
+        FILE *f = fopen(filename, "a");
+        if (f == 0)
+        {
+            mato_log_str(ML_ERR, "could not open metrics file", filename);
+            continue;
+        }
+        mato_write_metrics(f, metrics);
+        fclose(f);
+    }
+    mato_free_metrics(previous);
+    free(filename);
+
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+void metrics_init()
+{
+    if (mato_core_config.metrics_interval <= 0) return;
+
+    char *filename = (char *)malloc(strlen(mato_core_config.logs_path) + 50);
+    sprintf(filename, "%s/%ld_node%d_metrics.txt", mato_core_config.logs_path, (long)time(0), this_node_id);
+    mato_log_str(ML_INFO, "writing metrics to", filename);
+
+    pthread_t t;
+    if (pthread_create(&t, 0, metrics_thread, filename) != 0)
+    {
+        perror("could not create thread for metrics");
+        free(filename);
+    }
+}
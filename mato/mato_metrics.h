@@ -0,0 +1,24 @@
+#ifndef __MATO_METRICS_H__
+#define __MATO_METRICS_H__
+
+/// \file mato_metrics.h
+/// Mato control framework - snapshots of the framework metrics (see mato_get_metrics()) and their periodic dump.
+/// When the metrics_interval variable of the framework config is set, a thread takes a snapshot every metrics_interval
+/// seconds and appends it to the file logs_path/TIME_nodeN_metrics.txt in a compact text format, one record per line:
+/// ~~~~
+/// snapshot unix_time this_node_id interval
+/// queues post_queue_length post_queue_dropped pending_messages dangling_buffers
+/// threads module_threads system_threads dispatch_threads
+/// net node_id is_online modules bytes_sent bytes_received bytes_sent_per_second bytes_received_per_second
+/// channel module_id channel module_name messages bytes messages_per_second bytes_per_second subscribers buffers references
+/// end
+/// ~~~~
+/// There is a net record for each other node and a channel record for each channel, the spaces in the module names
+/// are replaced by underscores. The files can be viewed by the tools/mato_metrics_view program.
+
+#include "mato_core.h"
+
+/// Start the thread that dumps the metrics, if the metrics_interval variable of the framework config is not 0.
+void metrics_init();
+
+#endif
@@ -4,6 +4,7 @@
 #include "mato_net.h"
 #include "mato_core.h"
 #include "mato_logs.h"
+#include "mato_requests.h"
 
 /// \file mato_net.c
 /// Implementation of the Mato control framework - networking with other nodes.
@@ -19,9 +20,43 @@ static int listening_socket;
 /// Communication sockets with all the other nodes.
 static GArray *sockets;   // [node_id]
 
-/// pipe for sending a signal to select() waiting on msgs from nodes - it has to be interrupted when new node
-/// connects (or similar events occur)
-static int select_wakeup_pipe[2];
+/// Locked while a frame is being written to the socket of the node, so that the frames of different threads do not interleave.
+static pthread_mutex_t *send_locks;   // [node_id]
+
+/// Bytes sent to and received from each node, see net_traffic().
+static atomic_llong *bytes_sent;       // [node_id]
+static atomic_llong *bytes_received;   // [node_id]
+
+/// pipe for waking up the communication thread waiting for the messages from nodes when the framework shuts down
+static int wakeup_pipe[2];
+
+/// the communication thread waits for the listening socket, the wakeup pipe and the sockets of the nodes
+static int epoll_fd;
+
+/// The data received from a node that have not been processed yet: the beginning of a message that has not arrived
+/// completely. Only used by the communication thread.
+typedef struct {
+    /// the socket of the node the data came from
+    int socket;
+    uint8_t *buffer;
+    int capacity;
+    int used;
+} node_connection;
+
+static node_connection *connections;   // [node_id]
+
+/// Set the options of a new socket connected to another node: the small messages are sent right away
+/// rather than waiting for more data (the messages are written as whole frames, see net_send_frame()), and a node
+/// that stops receiving blocks the senders for at most NODE_SEND_TIMEOUT (see net_send_parts()).
+static void set_node_socket_options(int s)
+{
+    int nodelay = 1;
+    if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(int)) < 0)
+        mato_log_val(ML_WARN, "setsockopt TCP_NODELAY", errno);
+    struct timeval timeout = { NODE_SEND_TIMEOUT, 0 };
+    if (setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval)) < 0)
+        mato_log_val(ML_WARN, "setsockopt SO_SNDTIMEO", errno);
+}
 
 //-------------- reading network config file ----------------------
 
@@ -106,6 +141,24 @@ void net_mato_init(int this_node_identifier)
         mato_log_val(ML_ERR, "Error loading nodes config file", errno);
         exit(1);
     }
+    bytes_sent = (atomic_llong *)calloc(nodes->len, sizeof(atomic_llong));
+    bytes_received = (atomic_llong *)calloc(nodes->len, sizeof(atomic_llong));
+    connections = (node_connection *)calloc(nodes->len, sizeof(node_connection));
+    for (int node_id = 0; node_id < nodes->len; node_id++)
+    {
+        connections[node_id].capacity = RECEIVE_BUFFER_SIZE;
+        connections[node_id].buffer = (uint8_t *)malloc(RECEIVE_BUFFER_SIZE);
+        connections[node_id].socket = -1;
+    }
+    send_locks = (pthread_mutex_t *)malloc(nodes->len * sizeof(pthread_mutex_t));
+    for (int node_id = 0; node_id < nodes->len; node_id++)
+        pthread_mutex_init(&send_locks[node_id], 0);
+}
+
+void net_traffic(int node_id, long long *sent, long long *received)
+{
+    *sent = atomic_load_explicit(&bytes_sent[node_id], memory_order_relaxed);
+    *received = atomic_load_explicit(&bytes_received[node_id], memory_order_relaxed);
 }
 
 void net_mato_shutdown()
@@ -113,228 +166,287 @@ void net_mato_shutdown()
     uint8_t wakeup_byte = 123;
     program_runs = 0;
 
-    if (write(select_wakeup_pipe[1], &wakeup_byte, 1) < 0)
+    if (write(wakeup_pipe[1], &wakeup_byte, 1) < 0)
         mato_log_val(ML_ERR, "could not wakeup networking thread", errno);
 
     core_mato_shutdown();
 
-    close(select_wakeup_pipe[0]);
-    close(select_wakeup_pipe[1]);
+    close(wakeup_pipe[0]);
+    close(wakeup_pipe[1]);
+    close(epoll_fd);
     close(listening_socket);
 }
 
 /// Clean up all traces of a node (and its modules) after it got disconnected.
 static void node_disconnected(int s, int node_id)
 {
-    g_array_index(nodes, node_info *, node_id)->is_online = 0;
-    close(s);
+    // a sender may be blocked writing to the socket while holding the send lock, this makes it fail right away
+    shutdown(s, SHUT_RDWR);
+    pthread_mutex_lock(&send_locks[node_id]);
+        g_array_index(nodes, node_info *, node_id)->is_online = 0;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s, 0);
+        close(s);
+    pthread_mutex_unlock(&send_locks[node_id]);
     mato_log_val(ML_WARN, "node has disconnected", node_id);
+    // the rest of a message from the closed socket is thrown away, even if the next socket gets the same number
+    connections[node_id].used = 0;
+    connections[node_id].socket = -1;
     lock_framework();
         remove_node_buffers(node_id);
         remove_node_from_subscriptions(node_id);
         remove_names_types(node_id);
     unlock_framework();
+    remote_requests_node_disconnected(node_id);
 }
 
 //-------------- low-level incoming data receiving ---------------------
 
-/// Receive one 32-bit integer from a socket. Returns 0 on failure (and the sending node is updated to be off-line), otherwise returns 1.
-/// See net_send_int32_t() function.
-static int net_recv_int32t(int s, int32_t *num, int sending_node_id)
-{
-    int retval = recv(s, num, sizeof(int32_t), MSG_WAITALL);
-    if(retval<0)
-    {
-        mato_log_val(ML_ERR, "reading from socket", errno);
-        return 0;
-    }
-    else if (retval == 0) // node disconnected
+/// Reads the fields of a message from the data received from a node. The messages are only processed when they have arrived
+/// completely: reading past the received data clears complete, and the message is then processed after the next receive.
+typedef struct {
+    uint8_t *position;
+    int available;
+    int complete;
+    /// set if the message is malformed, the node is disconnected then
+    int invalid;
+} net_cursor;
+
+/// Read one 32-bit integer. See frame_int32t() function.
+static int32_t cursor_int32t(net_cursor *c)
+{
+    int32_t num = 0;
+    if (c->available < sizeof(int32_t))
     {
-        node_disconnected(s, sending_node_id);
+        c->complete = 0;
+        c->available = 0;
         return 0;
     }
-    return 1;
+    memcpy(&num, c->position, sizeof(int32_t));
+    c->position += sizeof(int32_t);
+    c->available -= sizeof(int32_t);
+    return num;
 }
 
-/// Receive string of bytes from a socket. This could be a zero-terminated string,
-/// or any other bunch of bytes. String is sent as int32_t (length+1) and then data.
-/// Returns 0 on failure (and the sending node is updated to be off-line), otherwise returns 1.
-/// See net_send_string() function.
-static int net_recv_bytes(int s, uint8_t **str, int32_t *str_len, int sending_node_id)
+/// Read a string of bytes: its length as int32_t and then data. Returns the pointer to the data in the received data
+/// (valid until the message is processed), or 0 for the empty string or if it has not arrived completely.
+/// See frame_bytes() and frame_string() functions.
+static uint8_t *cursor_bytes(net_cursor *c, int32_t *length)
 {
-    if (!net_recv_int32t(s, str_len, sending_node_id))
-        return 0;
-    if (*str_len == 0)
+    *length = cursor_int32t(c);
+    if ((*length < 0) || (*length > MAX_NET_MESSAGE_LENGTH))
     {
-        *str = 0;
-        return 1;
+        c->invalid = 1;
+        *length = 0;
     }
-    *str = (uint8_t *)malloc(*str_len);
-    int retval = recv(s, *str, *str_len, MSG_WAITALL);
-    if (retval < 0)
+    if (!c->complete || c->invalid || (*length == 0)) return 0;
+    if (c->available < *length)
     {
-        mato_log_val(ML_ERR, "reading from socket", errno);
+        c->complete = 0;
+        c->available = 0;
         return 0;
     }
-    else if (retval == 0) // node disconnected
-    {
-        node_disconnected(s, sending_node_id);
-        return 0;
-    }
-    return 1;
+    uint8_t *data = c->position;
+    c->position += *length;
+    c->available -= *length;
+    return data;
+}
+
+/// A malloc()-ed copy of the received bytes, 0 for the empty ones.
+static uint8_t *copy_of_bytes(uint8_t *data, int32_t length)
+{
+    if (length == 0) return 0;
+    uint8_t *copy = (uint8_t *)malloc(length);
+    memcpy(copy, data, length);
+    return copy;
+}
+
+/// A zero-terminated malloc()-ed copy of the received string.
+static char *copy_of_string(uint8_t *str, int32_t length)
+{
+    char *copy = (char *)malloc(length + 1);
+    if (length > 0) memcpy(copy, str, length);
+    copy[length] = 0;
+    return copy;
 }
 
 //-------------- handling incoming messages ----------------------
 
-/// Receive and process new module instance message from another node. For the packet format, see net_broadcast_new_module() function.
-static void net_process_new_module(int s, int sending_node_id)
-{
-    int32_t module_id, number_of_channels, ignore;
-    char *module_name, *module_type;
-    if (
-        !net_recv_int32t(s, &module_id, sending_node_id) ||
-        !net_recv_bytes(s, (uint8_t **)&module_name, &ignore, sending_node_id)  ||
-        !net_recv_bytes(s, (uint8_t **)&module_type, &ignore, sending_node_id)  ||
-        !net_recv_int32t(s, &number_of_channels, sending_node_id)
-    )
-        return;
-    store_new_remote_module(sending_node_id, module_id, module_name, module_type, number_of_channels);
+/// Process new module instance message from another node. For the packet format, see net_broadcast_new_module() function.
+static void net_process_new_module(net_cursor *c, int sending_node_id)
+{
+    int32_t name_length, type_length;
+    int32_t module_id = cursor_int32t(c);
+    uint8_t *module_name = cursor_bytes(c, &name_length);
+    uint8_t *module_type = cursor_bytes(c, &type_length);
+    int32_t number_of_channels = cursor_int32t(c);
+    if (!c->complete || c->invalid) return;
+    store_new_remote_module(sending_node_id, module_id, copy_of_string(module_name, name_length),
+                            copy_of_string(module_type, type_length), number_of_channels);
 }
 
-/// Receive and process a delete module message from another node. For the packet format see net_send_delete_module() function.
-static void net_process_delete_module(int s, int sending_node_id)
+/// Process a delete module message from another node. For the packet format see net_send_delete_module() function.
+static void net_process_delete_module(net_cursor *c, int sending_node_id)
 {
-    int32_t module_id;
-    if (
-        !net_recv_int32t(s, &module_id, sending_node_id)
-    )
-        return;
+    int32_t module_id = cursor_int32t(c);
+    if (!c->complete) return;
     lock_framework();
         delete_module_instance(sending_node_id, module_id);
     unlock_framework();
 }
 
-/// Receive and process a subscribe channel message from another node. For the packet format see net_send_subscribe() function.
-static void net_process_subscribe_module(int s, int sending_node_id)
+/// Process a subscribe channel message from another node. For the packet format see net_send_subscribe() function.
+static void net_process_subscribe_module(net_cursor *c, int sending_node_id)
 {
-    int32_t subscribed_module_id, channel;
-    if (
-        !net_recv_int32t(s, &subscribed_module_id, sending_node_id) ||
-        !net_recv_int32t(s, &channel, sending_node_id)
-    )
-        return;
+    int32_t subscribed_module_id = cursor_int32t(c);
+    int32_t channel = cursor_int32t(c);
+    if (!c->complete) return;
     subscribe_channel_from_remote_node(sending_node_id, subscribed_module_id, channel);
 }
 
-/// Receive and process a unsubscribe channel message from another node. For the packet format see net_send_subscribe() function.
-static void net_process_unsubscribe_module(int s, int sending_node_id)
+/// Process a unsubscribe channel message from another node. For the packet format see net_send_subscribe() function.
+static void net_process_unsubscribe_module(net_cursor *c, int sending_node_id)
 {
-    int32_t subscribed_module_id, channel;
-    if (
-        !net_recv_int32t(s, &subscribed_module_id, sending_node_id) ||
-        !net_recv_int32t(s, &channel, sending_node_id)
-    )
-        return;
+    int32_t subscribed_module_id = cursor_int32t(c);
+    int32_t channel = cursor_int32t(c);
+    if (!c->complete) return;
     unsubscribe_channel_from_remote_node(sending_node_id, subscribed_module_id, channel);
 }
 
-/// Receive and process a get_data message from another node. For the packet format see net_send_get_data() function.
-static void net_process_get_data(int s, int sending_node_id)
+/// Process a get_data message from another node. For the packet format see net_send_get_data() function.
+static void net_process_get_data(net_cursor *c, int sending_node_id)
 {
-    int32_t module_id, channel, get_data_id;
-
-    if (
-        !net_recv_int32t(s, &module_id, sending_node_id) ||
-        !net_recv_int32t(s, &channel, sending_node_id) ||
-        !net_recv_int32t(s, &get_data_id, sending_node_id)
-    )
-        return;
-    pack_and_send_data_to_remote(sending_node_id, module_id, channel, get_data_id);
+    int32_t module_id = cursor_int32t(c);
+    int32_t channel = cursor_int32t(c);
+    int32_t request_id = cursor_int32t(c);
+    if (!c->complete) return;
+    pack_and_send_data_to_remote(sending_node_id, module_id, channel, request_id);
 }
 
-/// Receive and process a data message that this node have requested by get_data message earlier. For the packet format see net_send_data() function.
-static void net_process_data(int s, int sending_node_id)
+/// Process a data message that this node have requested by get_data message earlier. For the packet format see net_send_data() function.
+static void net_process_data(net_cursor *c, int sending_node_id)
 {
-    int32_t get_data_id;
     int32_t data_length;
-    uint8_t *data;
-
-    if (
-       !net_recv_int32t(s, &get_data_id, sending_node_id) ||
-       !net_recv_bytes(s, &data, &data_length, sending_node_id)
-    )
-       return;
-
-    return_data_to_waiting_module(get_data_id, data_length, data);
+    int32_t request_id = cursor_int32t(c);
+    uint8_t *data = cursor_bytes(c, &data_length);
+    if (!c->complete || c->invalid) return;
+    return_data_to_waiting_module(request_id, data_length, copy_of_bytes(data, data_length));
 }
 
-/// Receive and process a subscribed data message from another node. For the packet format see net_send_subscribed_data() function.
-static void net_process_subscribed_data(int s, int sending_node_id)
+/// Process a subscribed data message from another node. For the packet format see net_send_subscribed_data() function.
+static void net_process_subscribed_data(net_cursor *c, int sending_node_id)
 {
-    int32_t sending_module_id, channel, data_length;
-    uint8_t *data;
-    if (
-        !net_recv_int32t(s, &sending_module_id, sending_node_id) ||
-        !net_recv_int32t(s, &channel, sending_node_id) ||
-        !net_recv_bytes(s, &data, &data_length, sending_node_id)
-    )
-        return;
-    mato_post_data(sending_module_id + sending_node_id * NODE_MULTIPLIER, channel, data_length, data);
+    int32_t data_length;
+    int32_t sending_module_id = cursor_int32t(c);
+    int32_t channel = cursor_int32t(c);
+    uint8_t *data = cursor_bytes(c, &data_length);
+    if (!c->complete || c->invalid) return;
+    uint8_t *buffer = 0;
+    if (data_length > 0)
+    {
+        buffer = (uint8_t *)mato_get_data_buffer(data_length);
+        memcpy(buffer, data, data_length);
+    }
+    mato_post_data(sending_module_id + sending_node_id * NODE_MULTIPLIER, channel, data_length, buffer);
 }
 
-/// Receive and process a global message from another node. For the packet format see net_send_global_message() function.
-static void net_process_global_message(int s, int sending_node_id)
+/// Process a global message from another node. For the packet format see net_send_global_message() function.
+static void net_process_global_message(net_cursor *c, int sending_node_id)
 {
-    int32_t sending_module_id, receiving_module_id, message_id, msg_length;
-    uint8_t *message_data;
-    if (
-        !net_recv_int32t(s, &sending_module_id, sending_node_id) ||
-        !net_recv_int32t(s, &receiving_module_id, sending_node_id) ||
-        !net_recv_int32t(s, &message_id, sending_node_id) ||
-        !net_recv_bytes(s, &message_data, &msg_length, sending_node_id)
-    )
-        return;
+    int32_t msg_length;
+    int32_t sending_module_id = cursor_int32t(c);
+    int32_t receiving_module_id = cursor_int32t(c);
+    int32_t message_id = cursor_int32t(c);
+    uint8_t *received_data = cursor_bytes(c, &msg_length);
+    if (!c->complete || c->invalid) return;
+    // the modules receive aligned data that are only valid during the call
+    uint8_t *message_data = copy_of_bytes(received_data, msg_length);
     if (receiving_module_id == MATO_BROADCAST)
         mato_send_global_message(sending_module_id, message_id, msg_length, message_data);
     else
         mato_send_message(sending_module_id, receiving_module_id, message_id, msg_length, message_data);
+    free(message_data);
 }
 
-/// Receive, unpack, and process a new message arriving from another node from socket s.
-static void process_node_message(int s, int sending_node_id)
+static void process_node_message(net_cursor *c, int sending_node_id);
+
+/// Process a batch of messages from another node, it is processed when the whole batch has arrived. The messages are read
+/// from the receive buffer directly. For the packet format see net_send_batch() function.
+static void net_process_batch(net_cursor *c, int sending_node_id)
 {
-    int32_t message_type;
-    if (!net_recv_int32t(s, &message_type, sending_node_id))
-        return;
+    int32_t length;
+    int32_t number_of_messages = cursor_int32t(c);
+    uint8_t *messages = cursor_bytes(c, &length);
+    if (!c->complete || c->invalid) return;
+
+    net_cursor message;
+    message.position = messages;
+    message.available = length;
+    message.complete = 1;
+    message.invalid = 0;
+    for (int i = 0; (i < number_of_messages) && message.complete && !message.invalid; i++)
+    {
+        // batches are not nested
+        int32_t message_type = 0;
+        if (message.available >= sizeof(int32_t)) memcpy(&message_type, message.position, sizeof(int32_t));
+        if (message_type == MSG_MESSAGE_BATCH) message.invalid = 1;
+        else process_node_message(&message, sending_node_id);
+    }
+    // the messages must fill the batch exactly
+    if (!message.complete || message.invalid || (message.available > 0)) c->invalid = 1;
+}
+
+/// Process the message at the cursor received from another node, if it has arrived completely.
+static void process_node_message(net_cursor *c, int sending_node_id)
+{
+    int32_t message_type = cursor_int32t(c);
+    if (!c->complete) return;
 
     switch(message_type){
         case MSG_NEW_MODULE_INSTANCE:
-            net_process_new_module(s, sending_node_id);
+            net_process_new_module(c, sending_node_id);
             break;
         case MSG_DELETED_MODULE_INSTANCE:
-            net_process_delete_module(s, sending_node_id);
+            net_process_delete_module(c, sending_node_id);
             break;
         case MSG_SUBSCRIBE:
-            net_process_subscribe_module(s, sending_node_id);
+            net_process_subscribe_module(c, sending_node_id);
             break;
         case MSG_UNSUBSCRIBE:
-            net_process_unsubscribe_module(s, sending_node_id);
+            net_process_unsubscribe_module(c, sending_node_id);
             break;
         case MSG_GET_DATA:
-            net_process_get_data(s, sending_node_id);
+            net_process_get_data(c, sending_node_id);
             break;
         case MSG_DATA:
-            net_process_data(s, sending_node_id);
+            net_process_data(c, sending_node_id);
             break;
         case MSG_SUBSCRIBED_DATA:
-            net_process_subscribed_data(s, sending_node_id);
+            net_process_subscribed_data(c, sending_node_id);
             break;
         case MSG_GLOBAL_MESSAGE:
-            net_process_global_message(s, sending_node_id);
+            net_process_global_message(c, sending_node_id);
+            break;
+        case MSG_MESSAGE_BATCH:
+            net_process_batch(c, sending_node_id);
             break;
+        default:
+            c->invalid = 1;
     }
 }
 
+/// Start receiving from the new socket of a node (it may replace the previous socket of the node that has disconnected).
+/// The socket is identified by both the node and the socket in the epoll events, so that the communication thread
+/// recognizes the events of the previous socket.
+static void watch_node_socket(int node_id, int s)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)node_id << 32) | (uint32_t)s;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s, &event) < 0)
+        mato_log_val(ML_ERR, "could not watch the socket of node", node_id);
+}
+
 /// Send information about all our modules to a specific node after it has been connected.
 static void inform_about_our_modules(int node_id)
 {
@@ -352,6 +464,8 @@ static void inform_about_our_modules(int node_id)
 
 /// This thread monitors connections to all nodes according to config file and tries to connect/reconnect
 /// those that are not currently connected. It runs in the background from the start till the framework shutdown.
+/// It is not a framework timer (see mato_timer.h): connect() to a node that is down may block for the whole TCP connect
+/// timeout, and it would hold up the timers of all modules meanwhile.
 static void *reconnecting_thread(void *arg)
 {
     struct sockaddr_in my_addr;
@@ -362,6 +476,7 @@ static void *reconnecting_thread(void *arg)
     {
         for(int node_id = this_node_id + 1; node_id < nodes->len; node_id++)
         {
+            // the previous socket of the node has been closed by node_disconnected() by now
             if (g_array_index(nodes, node_info*, node_id)->is_online == 0)
             {
                 int s = socket(AF_INET, SOCK_STREAM, 0);
@@ -382,6 +497,7 @@ static void *reconnecting_thread(void *arg)
                 }
                 if (connect(s, (struct sockaddr *)&my_addr, sizeof(struct sockaddr_in)) < 0)
                     continue;
+                set_node_socket_options(s);
                 int retval = send(s, &this_node_id, sizeof(int32_t), 0);
                 if (retval < 0)
                 {
@@ -390,121 +506,153 @@ static void *reconnecting_thread(void *arg)
                     continue;
                 }
                 g_array_index(sockets, int, node_id) = s;
+                watch_node_socket(node_id, s);
                 g_array_index(nodes, node_info*, node_id)->is_online = 1;
                 mato_log_val(ML_INFO, "connected to ", node_id);
 
-                uint8_t wakeup_byte = 123;
-                if (write(select_wakeup_pipe[1], &wakeup_byte, 1) < 0)
-                    mato_log_val(ML_ERR, "could not wakeup networking thread", errno);
-
                 inform_about_our_modules(node_id);
                 continue;
             }
         }
-        //for (int i = 0; i < 10; i++)
-        //    if (!program_runs) break;
-                sleep(1);
+        usleep(RECONNECT_PERIOD);
     }
     mato_dec_system_thread_count();
     return 0;
 }
 
-/// Fills the set of "read" file descriptor sets for the communication_thread() function.
-/// Includes the listening_socket, read end of the select_wakeup_pipe, and all open sockets with the other connected nodes.
-static void fill_select_fd_set(fd_set *rfds, int *nfd)
+/// In case the listening socket has a pending connection, accept the new connection,
+/// retrieve the login packet from the other node, store its socket, and mark it online.
+static void handle_incomming_connection()
 {
-    FD_ZERO(rfds);
-    for(int i = 0; i < nodes->len; i++)
+    struct sockaddr_in incomming;
+    socklen_t size = sizeof(struct sockaddr_in);
+    int s = accept(listening_socket, (struct sockaddr *)&incomming, &size);
+    if (s < 0)
     {
-        if (i == this_node_id) continue;
-        if (g_array_index(nodes,node_info*, i)->is_online == 1)
-        {
-            int s = g_array_index(sockets, int, i);
-            FD_SET(s, rfds);
-            if (s > *nfd) *nfd = s;
-        }
+        mato_log_val(ML_ERR, "accept", errno);
+        return;
+    }
+    // the login packet is sent right after connecting, a node that does not send it does not block the other nodes for long
+    struct timeval timeout = { LOGIN_TIMEOUT, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+    int32_t new_node_id;
+    int retval = recv(s, &new_node_id, sizeof(int32_t), MSG_WAITALL);
+    if (retval != sizeof(int32_t))
+    {
+        mato_log_val(ML_ERR, "reading from socket", errno);
+        close(s);
+        return;
+    }
+    if ((new_node_id < 0) || (new_node_id >= nodes->len) || (new_node_id == this_node_id))
+    {
+        mato_log_val(ML_ERR, "connection from unknown node", new_node_id);
+        close(s);
+        return;
+    }
+    mato_log_val(ML_INFO, "connection from node", new_node_id);
+    if (g_array_index(nodes, node_info*, new_node_id)->is_online)
+    {
+        // the node has reconnected before we noticed its previous connection was lost, close it first
+        node_disconnected(g_array_index(sockets, int, new_node_id), new_node_id);
     }
-    FD_SET(listening_socket, rfds);
-    if (listening_socket > *nfd) *nfd = listening_socket;
-    FD_SET(select_wakeup_pipe[0], rfds);
-    if (select_wakeup_pipe[0] > *nfd) *nfd = select_wakeup_pipe[0];
-    (*nfd)++;
+    set_node_socket_options(s);
+    g_array_index(sockets, int, new_node_id) = s;
+    watch_node_socket(new_node_id, s);
+    g_array_index(nodes, node_info*, new_node_id)->is_online = 1;
+    inform_about_our_modules(new_node_id);
 }
 
-/// In case the listening socket is selected in rfds, accept the new connection,
-/// retrieve the login packet from the other node, store its socket, and mark it online.
-static void handle_incomming_connections(fd_set *rfds)
+/// Receive what has arrived from a node into its receive buffer, and process all messages that have arrived completely.
+static void receive_from_node(int node_id, int s)
 {
-    if (FD_ISSET(listening_socket, rfds))
+    node_connection *conn = &connections[node_id];
+    if (conn->socket != s)
     {
-        struct sockaddr_in incomming;
-        socklen_t size = sizeof(struct sockaddr_in);
-        int s = accept(listening_socket, (struct sockaddr *)&incomming, &size);
-        int32_t new_node_id;
-        int retval = recv(s, &new_node_id, sizeof(int32_t), MSG_WAITALL);
-        if(retval < 0)
-        {
-            mato_log_val(ML_ERR, "reading from socket", errno);
-            return;
-        }
-        mato_log_val(ML_INFO, "connection from node", new_node_id);
-        g_array_index(sockets, int, new_node_id) = s;
-        g_array_index(nodes, node_info*, new_node_id)->is_online = 1;
-        inform_about_our_modules(new_node_id);
+        // a new connection of the node, the rest of a message from the previous one is thrown away
+        conn->socket = s;
+        conn->used = 0;
+    }
+    if (conn->used == conn->capacity)
+    {
+        // a message larger than the buffer
+        conn->capacity *= 2;
+        conn->buffer = (uint8_t *)realloc(conn->buffer, conn->capacity);
     }
-}
 
-/// In case a notifications from other threads through wakeup pipe arrives, pick it up.
-static void handle_wakeup_signal(fd_set *rfds)
-{
-    if (FD_ISSET(select_wakeup_pipe[0], rfds))
+    ssize_t received = recv(s, conn->buffer + conn->used, conn->capacity - conn->used, MSG_DONTWAIT);
+    if (received < 0)
     {
-        uint8_t b;
-        read(select_wakeup_pipe[0], &b, 1);
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return;
+        mato_log_val(ML_ERR, "reading from socket", errno);
     }
-}
+    if (received <= 0)  // node disconnected
+    {
+        node_disconnected(s, node_id);
+        return;
+    }
+    atomic_fetch_add_explicit(&bytes_received[node_id], received, memory_order_relaxed);
+    conn->used += received;
 
-/// For the messages received from other nodes: process them.
-static void handle_messages_from_other_nodes(fd_set *rfds)
-{
-    for(int i = 0; i < nodes->len; i++)
-        if (g_array_index(nodes,node_info*,i)->is_online == 1)
+    net_cursor c;
+    c.position = conn->buffer;
+    c.available = conn->used;
+    while (c.available > 0)
+    {
+        net_cursor message = c;
+        message.complete = 1;
+        message.invalid = 0;
+        process_node_message(&message, node_id);
+        if (message.invalid)
         {
-            int s = g_array_index(sockets, int, i);
-            if (FD_ISSET(s, rfds))
-                process_node_message(s, i);
+            mato_log_val(ML_ERR, "malformed message from node", node_id);
+            node_disconnected(s, node_id);
+            return;
         }
-}
-
-/// Call the select() OS system call to wait for any communication arriving.
-static int wait_on_select(fd_set *rfds, int nfd)
-{
-    int retval = select(nfd, rfds, 0, 0, 0);
-    if (retval < 0)
-    {
-        mato_log_val(ML_ERR, "Select error", errno);
-        return 0;
+        if (!message.complete) break;
+        c = message;
     }
-    return 1;
+    // keep the beginning of the next message
+    conn->used = c.available;
+    if ((c.available > 0) && (c.position != conn->buffer))
+        memmove(conn->buffer, c.position, c.available);
 }
 
-/// The network receiving thread: uses select() to wait for data arriving from all nodes including new nodes connecting.
-/// Dispatches the arriving messages to the process_node_message() function.
+/// The network receiving thread: waits with epoll for data arriving from all nodes including new nodes connecting,
+/// and processes the arriving messages by process_node_message().
 static void *communication_thread(void *arg)
 {
     mato_inc_system_thread_count("comm");
-    fd_set rfds;
-    int nfd = 0;
-    while (program_runs){
-
-        fill_select_fd_set(&rfds, &nfd);
-        if (
-            !wait_on_select(&rfds, nfd)
-        ) break;
-        handle_wakeup_signal(&rfds);
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    while (program_runs)
+    {
+        int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            mato_log_val(ML_ERR, "epoll error", errno);
+            break;
+        }
         if (!program_runs) break;
-        handle_incomming_connections(&rfds);
-        handle_messages_from_other_nodes(&rfds);
+        for (int i = 0; i < n; i++)
+        {
+            uint64_t key = events[i].data.u64;
+            if (key == LISTENING_SOCKET_KEY)
+                handle_incomming_connection();
+            else if (key == WAKEUP_PIPE_KEY)
+            {
+                uint8_t b;
+                if (read(wakeup_pipe[0], &b, 1) < 0)
+                    mato_log_val(ML_ERR, "could not read wakeup pipe", errno);
+            }
+            else
+            {
+                int node_id = (int)(key >> 32);
+                int s = (int)(uint32_t)key;
+                // the events of a socket that has been closed meanwhile are ignored
+                if (g_array_index(nodes, node_info*, node_id)->is_online && (g_array_index(sockets, int, node_id) == s))
+                    receive_from_node(node_id, s);
+            }
+        }
     }
     mato_dec_system_thread_count();
     return 0;
@@ -523,14 +671,19 @@ void start_networking()
     my_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     my_addr.sin_port = htons(g_array_index(nodes,node_info*,this_node_id)->port);
 
+    // do not wait for the connections of the previous run of the program in TIME_WAIT state to expire
+    int reuse = 1;
+    if (setsockopt(listening_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) < 0)
+        mato_log_val(ML_WARN, "setsockopt SO_REUSEADDR", errno);
+
     int i = 0;
     do {
         if (bind(listening_socket, (struct sockaddr *) &my_addr, sizeof(struct sockaddr_in)) == -1)
             mato_log_val(ML_WARN, "bind, will retry...", errno);
         else break;
-        sleep(6);
-    } while (program_runs && (++i < 20));
-    if (i >= 20) exit(1);
+        usleep(BIND_RETRY_PERIOD);
+    } while (program_runs && (++i < BIND_RETRIES));
+    if (i >= BIND_RETRIES) exit(1);
 
     int rv = listen(listening_socket, MAX_PENDINGS_CONNECTIONS);
     if (rv < 0)
@@ -539,12 +692,26 @@ void start_networking()
         return;
     }
 
-    if (pipe(select_wakeup_pipe) < 0)
+    if (pipe(wakeup_pipe) < 0)
     {
-        mato_log_val(ML_ERR, "could not create pipe for select", errno);
+        mato_log_val(ML_ERR, "could not create pipe for waking up the communication thread", errno);
         return;
     }
 
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+        mato_log_val(ML_ERR, "could not create epoll", errno);
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN;
+    event.data.u64 = LISTENING_SOCKET_KEY;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listening_socket, &event);
+    event.data.u64 = WAKEUP_PIPE_KEY;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_pipe[0], &event);
+
     pthread_t t;
     if (pthread_create(&t, 0, reconnecting_thread, 0) != 0)
           mato_log_val(ML_ERR, "could not create reconnecting thread for framework", errno);
@@ -554,70 +721,181 @@ void start_networking()
 
 //-------------- low-level outgoing data sending ----------------------
 
-/// Send a zero-terminated character string to socket.
-/// First send its length+1 as int32_t and then data.
-/// See net_send_bytes() and net_recv_bytes() functions.
-static int net_send_string(int socket, char *str)
+/// One outgoing message to another node, assembled from its integers and data parts, so that it is written to the socket
+/// by a single system call. The integers are stored in the frame itself, the data parts point to the memory of the caller.
+typedef struct {
+    struct iovec parts[NET_FRAME_MAX_PARTS];
+    int number_of_parts;
+    int32_t ints[NET_FRAME_MAX_INTS];
+    int number_of_ints;
+} net_frame;
+
+/// Append a 32-bit signed integer to the frame, the consecutive integers form a single part.
+/// See net_recv_int32_t() function.
+static void frame_int32t(net_frame *f, int32_t num)
 {
-    int32_t len = strlen(str) + 1;
-    if (write(socket, &len, sizeof(int32_t)) < 0)
-        return 0;
-    if (write(socket, str, len) < 0)
-        return 0;
-    return 1;
+    int32_t *slot = &f->ints[f->number_of_ints++];
+    *slot = num;
+    struct iovec *last = (f->number_of_parts > 0) ? &f->parts[f->number_of_parts - 1] : 0;
+    if (last && ((uint8_t *)last->iov_base + last->iov_len == (uint8_t *)slot))
+        last->iov_len += sizeof(int32_t);
+    else
+    {
+        f->parts[f->number_of_parts].iov_base = slot;
+        f->parts[f->number_of_parts++].iov_len = sizeof(int32_t);
+    }
 }
 
-/// Send an array of bytes to socket.
-/// First send its length as int32_t and then data.
-/// See net_send_string() and net_recv_bytes() functions.
-static int net_send_bytes(int socket, uint8_t *data, int32_t length)
+/// Start a new frame of the message type.
+static void frame_init(net_frame *f, int32_t message_type)
 {
-    if (write(socket, &length, sizeof(int32_t)) < 0)
-        return 0;
+    f->number_of_parts = 0;
+    f->number_of_ints = 0;
+    frame_int32t(f, message_type);
+}
+
+/// Append an array of bytes to the frame: its length as int32_t and then data (that must stay valid until the frame is sent).
+/// See net_recv_bytes() function.
+static void frame_bytes(net_frame *f, uint8_t *data, int32_t length)
+{
+    frame_int32t(f, length);
     if (length > 0)
-        if (write(socket, data, length) < 0)
-            return 0;
-    return 1;
+    {
+        f->parts[f->number_of_parts].iov_base = data;
+        f->parts[f->number_of_parts++].iov_len = length;
+    }
 }
 
-/// Send 32-bit signed integer to a socket.
-/// See net_recv_int32_t() function.
-static int net_send_int32t(int socket, int32_t num)
+/// Append a zero-terminated character string to the frame: its length+1 as int32_t and then data.
+/// See net_recv_bytes() function.
+static void frame_string(net_frame *f, char *str)
 {
-    if (write(socket, &num, sizeof(int32_t)) < 0)
-        return 0;
-    else return 1;
+    frame_bytes(f, (uint8_t *)str, strlen(str) + 1);
+}
+
+/// Write all parts of a message to the socket of the node, and count the bytes that were sent to the node. The messages of different
+/// threads do not interleave, the partial writes are continued (and they move the parts). When the message cannot be sent, or the node
+/// has not received anything for NODE_SEND_TIMEOUT, the connection is shut down, and the communication thread disconnects the node when
+/// it finds the socket closed (the senders may hold the framework lock, they must not disconnect it themselves).
+static void net_send_parts(int node_id, struct iovec *parts, int number_of_parts)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = parts;
+    msg.msg_iovlen = number_of_parts;
+    pthread_mutex_lock(&send_locks[node_id]);
+        int socket = g_array_index(sockets, int, node_id);
+        // the socket of a node that has been disconnected meanwhile may already belong to another file
+        if (!g_array_index(nodes, node_info *, node_id)->is_online) msg.msg_iovlen = 0;
+        while (msg.msg_iovlen > 0)
+        {
+            ssize_t written = sendmsg(socket, &msg, MSG_NOSIGNAL);
+            if (written < 0)
+            {
+                if (errno == EINTR) continue;
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                    mato_log_val(ML_ERR, "node does not receive, disconnecting", node_id);
+                shutdown(socket, SHUT_RDWR);
+                break;
+            }
+            atomic_fetch_add_explicit(&bytes_sent[node_id], written, memory_order_relaxed);
+            // skip the parts that have been written completely, and the written beginning of the next one
+            while ((msg.msg_iovlen > 0) && (written >= msg.msg_iov->iov_len))
+            {
+                written -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+            if (msg.msg_iovlen > 0)
+            {
+                msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + written;
+                msg.msg_iov->iov_len -= written;
+            }
+        }
+    pthread_mutex_unlock(&send_locks[node_id]);
+}
+
+/// Write the whole frame to the socket of the node, see net_send_parts().
+static void net_send_frame(int node_id, net_frame *f)
+{
+    // the same frame may be sent to several nodes, the partial writes only move in a copy of its parts
+    struct iovec parts[NET_FRAME_MAX_PARTS];
+    memcpy(parts, f->parts, f->number_of_parts * sizeof(struct iovec));
+    net_send_parts(node_id, parts, f->number_of_parts);
 }
 
 //-------------- outgoing messages -------------------------
 
-void net_send_data(int node_id, int get_data_id, uint8_t *data, int32_t data_length)
+void net_send_data(int node_id, int request_id, uint8_t *data, int32_t data_length)
+{
+    net_frame f;
+    frame_init(&f, MSG_DATA);
+    frame_int32t(&f, request_id);
+    frame_bytes(&f, data, data_length);
+    net_send_frame(node_id, &f);
+}
+
+void net_send_subscribed_data(int subscribed_node_id, channel_data *cd)
 {
-    int socket = g_array_index(sockets, int, node_id);
+    struct iovec parts[2];
+    parts[0].iov_base = cd->encoded_header;
+    parts[0].iov_len = sizeof(cd->encoded_header);
+    parts[1].iov_base = cd->data;
+    parts[1].iov_len = cd->length;
+    net_send_parts(subscribed_node_id, parts, (cd->length > 0) ? 2 : 1);
+}
 
-    if (
-      !net_send_int32t(socket, MSG_DATA)  ||
-      !net_send_int32t(socket, get_data_id) ||
-      !net_send_bytes(socket, data, data_length)
-    )
+void net_encode_subscribed_data(channel_data *cd)
+{
+    cd->encoded_header[0] = MSG_SUBSCRIBED_DATA;
+    cd->encoded_header[1] = cd->module_id;
+    cd->encoded_header[2] = cd->channel_id;
+    cd->encoded_header[3] = cd->length;
+}
+
+int net_batch_subscribed_data_size(channel_data *cd)
+{
+    return sizeof(cd->encoded_header) + cd->length;
+}
+
+void net_batch_subscribed_data(net_batch *batch, channel_data *cd)
+{
+    // the first part is left for the header of the batch
+    if (batch->number_of_parts == 0) batch->number_of_parts = 1;
+    batch->parts[batch->number_of_parts].iov_base = cd->encoded_header;
+    batch->parts[batch->number_of_parts++].iov_len = sizeof(cd->encoded_header);
+    if (cd->length > 0)
     {
-        node_disconnected(socket, node_id);
+        batch->parts[batch->number_of_parts].iov_base = cd->data;
+        batch->parts[batch->number_of_parts++].iov_len = cd->length;
     }
+    batch->length += net_batch_subscribed_data_size(cd);
+    batch->number_of_messages++;
 }
 
-void net_send_subscribed_data(int subscribed_node_id, channel_data *cd)
+void net_send_batch(int node_id, net_batch *batch)
 {
-    int socket = g_array_index(sockets, int, subscribed_node_id);
-
-    if (
-        !net_send_int32t(socket, MSG_SUBSCRIBED_DATA)  ||
-        !net_send_int32t(socket, cd->module_id) ||
-        !net_send_int32t(socket, cd->channel_id) ||
-        !net_send_bytes(socket, cd->data, cd->length)
-    )
+    if (batch->number_of_messages == 0) return;
+    struct iovec *parts = batch->parts;
+    int number_of_parts = batch->number_of_parts;
+    if (batch->number_of_messages > 1)
     {
-        node_disconnected(socket, subscribed_node_id);
+        batch->header[0] = MSG_MESSAGE_BATCH;
+        batch->header[1] = batch->number_of_messages;
+        batch->header[2] = batch->length;
+        parts[0].iov_base = batch->header;
+        parts[0].iov_len = sizeof(batch->header);
     }
+    else
+    {
+        // a single message is sent alone
+        parts++;
+        number_of_parts--;
+    }
+    net_send_parts(node_id, parts, number_of_parts);
+    batch->number_of_parts = 0;
+    batch->length = 0;
+    batch->number_of_messages = 0;
 }
 
 void net_broadcast_new_module(int module_id)
@@ -633,125 +911,96 @@ void net_broadcast_new_module(int module_id)
 
 void net_send_new_module(int node_id, int module_id)
 {
-    int s = g_array_index(sockets, int, node_id);
     char *module_name = g_array_index(g_array_index(module_names, GArray *, this_node_id), char *, module_id);
     char *module_type = g_array_index(g_array_index(module_types, GArray *, this_node_id), char *, module_id);
-    module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, module_type);
+    module_specification *spec = g_array_index(instance_specifications, module_specification *, module_id);
     int32_t number_of_channels = spec->number_of_channels;
 
-    if (
-        !net_send_int32t(s, MSG_NEW_MODULE_INSTANCE)  ||
-        !net_send_int32t(s, module_id) ||
-        !net_send_string(s, module_name) ||
-        !net_send_string(s, module_type) ||
-        !net_send_int32t(s, number_of_channels)
-    )
-    {
-        node_disconnected(s, node_id);
-    }
+    net_frame f;
+    frame_init(&f, MSG_NEW_MODULE_INSTANCE);
+    frame_int32t(&f, module_id);
+    frame_string(&f, module_name);
+    frame_string(&f, module_type);
+    frame_int32t(&f, number_of_channels);
+    net_send_frame(node_id, &f);
 }
 
-void net_send_get_data(int node_id, int module_id, int channel, int get_data_id)
+void net_send_get_data(int node_id, int module_id, int channel, int request_id)
 {
-    int s = g_array_index(sockets, int, node_id);
-    if (
-      !net_send_int32t(s, MSG_GET_DATA)  ||
-      !net_send_int32t(s, module_id) ||
-      !net_send_int32t(s, channel) ||
-      !net_send_int32t(s, get_data_id)
-    )
-    {
-        node_disconnected(s, node_id);
-    }
+    net_frame f;
+    frame_init(&f, MSG_GET_DATA);
+    frame_int32t(&f, module_id);
+    frame_int32t(&f, channel);
+    frame_int32t(&f, request_id);
+    net_send_frame(node_id, &f);
 }
 
 void net_send_delete_module(int module_id)
 {
+    net_frame f;
+    frame_init(&f, MSG_DELETED_MODULE_INSTANCE);
+    frame_int32t(&f, module_id);
     for (int node_id = 0; node_id < nodes->len; node_id++)
     {
         if (node_id == this_node_id) continue;
         node_info *ni = g_array_index(nodes, node_info *, node_id);
         if (ni->is_online == 0) continue;
 
-        int s = g_array_index(sockets, int, node_id);
-
-        if (
-            !net_send_int32t(s, MSG_DELETED_MODULE_INSTANCE)  ||
-            !net_send_int32t(s, module_id)
-        )
-        {
-            node_disconnected(s, node_id);
-        }
+        net_send_frame(node_id, &f);
     }
 }
 
 void net_send_subscribe(int node_id, int module_id, int channel)
 {
-    int s = g_array_index(sockets, int, node_id);
-    if (
-      !net_send_int32t(s, MSG_SUBSCRIBE)  ||
-      !net_send_int32t(s, module_id) ||
-      !net_send_int32t(s, channel)
-    )
-    {
-        node_disconnected(s, node_id);
-    }
+    net_frame f;
+    frame_init(&f, MSG_SUBSCRIBE);
+    frame_int32t(&f, module_id);
+    frame_int32t(&f, channel);
+    net_send_frame(node_id, &f);
 }
 
 void net_send_unsubscribe(int node_id, int module_id, int channel)
 {
-    int s = g_array_index(sockets, int, node_id);
-    if (
-      !net_send_int32t(s, MSG_UNSUBSCRIBE)  ||
-      !net_send_int32t(s, module_id) ||
-      !net_send_int32t(s, channel)
-    )
-    {
-        node_disconnected(s, node_id);
-    }
+    net_frame f;
+    frame_init(&f, MSG_UNSUBSCRIBE);
+    frame_int32t(&f, module_id);
+    frame_int32t(&f, channel);
+    net_send_frame(node_id, &f);
 }
 
 void net_send_global_message(int sending_module_id, int message_id, uint8_t *message_data, int message_length)
 {
-    lock_framework();
+    net_frame f;
+    frame_init(&f, MSG_GLOBAL_MESSAGE);
+    frame_int32t(&f, sending_module_id);
+    frame_int32t(&f, MATO_BROADCAST);
+    frame_int32t(&f, message_id);
+    frame_bytes(&f, message_data, message_length);
+    // the frames are not interleaved thanks to the send locks, the framework is locked just for the list of nodes
+    lock_framework_read();
         for (int node_id = 0; node_id < nodes->len; node_id++)
         {
             if (node_id == this_node_id) continue;
             node_info *ni = g_array_index(nodes, node_info *, node_id);
             if (ni->is_online == 0) continue;
-            int s = g_array_index(sockets, int, node_id);
-
-            if (
-                !net_send_int32t(s, MSG_GLOBAL_MESSAGE) ||
-                !net_send_int32t(s, sending_module_id) ||
-                !net_send_int32t(s, MATO_BROADCAST) ||
-                !net_send_int32t(s, message_id) ||
-                !net_send_bytes(s, message_data, message_length)
-            )
-            {
-                node_disconnected(s, node_id);
-            }
+
+            net_send_frame(node_id, &f);
         }
     unlock_framework();
 }
 
 void net_send_message(int sending_module_id, int receiving_node_id, int module_id_receiver, int message_id, uint8_t *message_data, int message_length)
 {
-    lock_framework();
-        node_info *ni = g_array_index(nodes, node_info *, receiving_node_id);
-        if (ni->is_online == 0) return;
-
-        int s = g_array_index(sockets, int, receiving_node_id);
-
-        if (
-            !net_send_int32t(s, MSG_GLOBAL_MESSAGE) ||
-            !net_send_int32t(s, sending_module_id) ||
-            !net_send_int32t(s, module_id_receiver) ||
-            !net_send_int32t(s, message_id) ||
-            !net_send_bytes(s, message_data, message_length)
-        )
-        {
-            node_disconnected(s, receiving_node_id);
-        }
+    net_frame f;
+    frame_init(&f, MSG_GLOBAL_MESSAGE);
+    frame_int32t(&f, sending_module_id);
+    frame_int32t(&f, module_id_receiver);
+    frame_int32t(&f, message_id);
+    frame_bytes(&f, message_data, message_length);
+    lock_framework_read();
+        int is_online = g_array_index(nodes, node_info *, receiving_node_id)->is_online;
     unlock_framework();
+    if (is_online == 0) return;
+
+    net_send_frame(receiving_node_id, &f);
 }
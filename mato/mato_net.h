@@ -5,14 +5,40 @@
 /// Mato control framework - internal networking definitions.
 
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 #include "mato_core.h"
 
 #define MAX_PENDINGS_CONNECTIONS 10
 
+/// how many times and how often (in microseconds) binding the listening port is retried when it is still in use
+#define BIND_RETRIES 120
+#define BIND_RETRY_PERIOD 1000000
+/// how often (in microseconds) the nodes that are not connected are tried again
+#define RECONNECT_PERIOD 1000000
+
+/// initial size of the receive buffer of each node, it grows when a larger message arrives
+#define RECEIVE_BUFFER_SIZE (256 * 1024)
+/// messages with longer data are considered malformed
+#define MAX_NET_MESSAGE_LENGTH (1024 * 1024 * 1024)
+/// how many events the communication thread takes from epoll at once
+#define MAX_EPOLL_EVENTS 16
+/// epoll keys of the listening socket and the wakeup pipe, the sockets of the nodes have (node_id << 32) | socket
+#define LISTENING_SOCKET_KEY 0xFFFFFFFFFFFFFFFFULL
+#define WAKEUP_PIPE_KEY 0xFFFFFFFFFFFFFFFEULL
+/// how many seconds a connecting node has to send its node_id
+#define LOGIN_TIMEOUT 2
+/// how many seconds a message to a node may wait for the node to receive anything, then the node is disconnected
+#define NODE_SEND_TIMEOUT 2
+
+/// the largest number of parts and integers of an outgoing message to another node
+#define NET_FRAME_MAX_PARTS 8
+#define NET_FRAME_MAX_INTS 16
+
 // messages of node to node communication protocol
 #define MSG_NEW_MODULE_INSTANCE 1
 #define MSG_DELETED_MODULE_INSTANCE 2
@@ -22,6 +48,22 @@
 #define MSG_DATA 6
 #define MSG_SUBSCRIBED_DATA 7
 #define MSG_GLOBAL_MESSAGE 8
+#define MSG_MESSAGE_BATCH 9
+
+/// the largest number of messages in a batch, each message takes two parts of the batch (and the header of the batch one),
+/// and sendmsg() accepts at most IOV_MAX (1024) parts
+#define NET_BATCH_MAX_MESSAGES 256
+#define NET_BATCH_MAX_PARTS (1 + 2 * NET_BATCH_MAX_MESSAGES)
+
+/// Several messages for the same node to be sent as a single MSG_MESSAGE_BATCH message (see net_send_batch()).
+/// The parts point to the encoded headers and the data of the messages, nothing is copied.
+typedef struct {
+    struct iovec parts[NET_BATCH_MAX_PARTS];
+    int number_of_parts;
+    int32_t header[3];
+    int length;
+    int number_of_messages;
+} net_batch;
 
 /// receiving_module_id for broadcast messages
 #define MATO_BROADCAST            (NODE_MULTIPLIER - 2)
@@ -35,6 +77,9 @@ extern GArray *nodes;   // [node_id]
 /// Initialize data structures maintained by the networking.
 void net_mato_init();
 
+/// Returns the number of bytes sent to and received from the specified node since the start.
+void net_traffic(int node_id, long long *sent, long long *received);
+
 /// Close and release resources used by the networking.
 void net_mato_shutdown();
 
@@ -72,17 +117,43 @@ void net_send_new_module(int node_id, int module_id);
 /// ~~~~
 void net_send_subscribed_data(int subscribed_node_id, channel_data *cd);
 
+/// Encode the header of the subscribed data message of a message of a local module into its channel_data. It is encoded only once
+/// when the message is stored, and it is shared by the send queues of all subscribed nodes together with the message.
+void net_encode_subscribed_data(channel_data *cd);
+
+/// The number of bytes that the message adds to a batch.
+int net_batch_subscribed_data_size(channel_data *cd);
+
+/// Append the subscribed data message (in the format of net_send_subscribed_data()) to the batch. The batch refers
+/// to the encoded header and the data of the message, the caller keeps its reference until the batch is sent.
+/// The batch must not be full (see NET_BATCH_MAX_MESSAGES).
+void net_batch_subscribed_data(net_batch *batch, channel_data *cd);
+
+/// Send all messages of the batch to the node in a single message and empty the batch. A batch of a single message
+/// is sent as that message alone.
+/// ~~~~
+/// Packet format:
+/// -------------------------------------
+/// MSG_MESSAGE_BATCH                 int32
+/// number_of_messages        int32
+/// length                    int32
+/// messages                  variable
+/// -------------------------------------
+/// ~~~~
+/// The messages have the same format as when they are sent alone, they are processed in their order by the receiving node.
+void net_send_batch(int node_id, net_batch *batch);
+
 /// Send data that were requested by MSG_GET_DATA message to the node that requested.
 /// ~~~~
 /// Packet format:
 /// -------------------------------------
 /// MSG_DATA                  int32
-/// get_data_id               int32
+/// request_id                int32
 /// len(data)                 int32
 /// data                      variable
 /// -------------------------------------
 /// ~~~~
-void net_send_data(int node_id, int get_data_id, uint8_t *data, int32_t data_length);
+void net_send_data(int node_id, int request_id, uint8_t *data, int32_t data_length);
 
 /// Request data from a channel of a module on a different node.
 /// ~~~~
@@ -91,10 +162,10 @@ void net_send_data(int node_id, int get_data_id, uint8_t *data, int32_t data_len
 /// MSG_GET_DATA              int32
 /// module_id                 int32
 /// channel                   int32
-/// get_data_id               int32
+/// request_id                int32
 /// -------------------------------------
 /// ~~~~
-void net_send_get_data(int node_id, int module_id, int channel, int get_data_id);
+void net_send_get_data(int node_id, int module_id, int channel, int request_id);
 
 /// Broadcast information that module at this node has been deleted.
 /// ~~~~
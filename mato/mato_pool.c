@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+
+/// \file mato_pool.c
+/// Implementation of the Mato control framework - memory pool for the message buffers.
+/// Each block starts with a small header that remembers its size class, the thread caches and the depot
+/// keep the free blocks in singly-linked lists threaded through the same header.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "mato_pool.h"
+#include "mato_logs.h"
+
+/// Header of each block, the usable memory follows after POOL_HEADER_SIZE bytes.
+typedef struct pool_block_struct {
+    /// next free block while the block is in a cache or in the depot
+    struct pool_block_struct *next;
+    int size_class;
+} pool_block;
+
+/// Keeps the usable memory aligned to 16 bytes.
+#define POOL_HEADER_SIZE ((sizeof(pool_block) + 15) & ~(size_t)15)
+
+/// The thread caches of the size classes hold at most this many bytes (but at least MIN_CACHED_BLOCKS blocks).
+#define CACHED_BYTES_PER_CLASS (256 * 1024)
+#define MIN_CACHED_BLOCKS 2
+#define MAX_CACHED_BLOCKS 64
+
+/// Global free blocks and usage counters of one size class (the last one counts the blocks above the largest class).
+typedef struct {
+    /// each depot is on its own cache line, the usage counters are updated with every allocation
+    _Alignas(64) pthread_mutex_t lock;
+    pool_block *free_blocks;
+    atomic_int blocks_allocated;
+    atomic_int blocks_in_use;
+    atomic_int high_water_mark;
+} pool_depot;
+
+/// Free blocks owned by a single thread, no locking is needed to use them.
+typedef struct {
+    pool_block *free_blocks[MATO_POOL_SIZE_CLASSES];
+    int count[MATO_POOL_SIZE_CLASSES];
+    int registered;
+} thread_cache;
+
+static const int class_sizes[MATO_POOL_SIZE_CLASSES] = MATO_POOL_CLASS_SIZES;
+static int cache_limit[MATO_POOL_SIZE_CLASSES];
+static pool_depot depot[MATO_POOL_SIZE_CLASSES + 1];
+
+static __thread thread_cache cache;
+
+/// Used only to return the cache of a terminating thread to the depot.
+static pthread_key_t cache_key;
+static pthread_once_t pool_initialized = PTHREAD_ONCE_INIT;
+
+static atomic_long allocations;
+
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static long allocations_at_last_rate;
+static long long time_of_last_rate;
+
+/// Move the free blocks linked from first to last to the depot of the size class.
+static void return_to_depot(int size_class, pool_block *first, pool_block *last)
+{
+    pthread_mutex_lock(&depot[size_class].lock);
+        last->next = depot[size_class].free_blocks;
+        depot[size_class].free_blocks = first;
+    pthread_mutex_unlock(&depot[size_class].lock);
+}
+
+/// Called when a thread terminates, its cached blocks would be lost otherwise.
+static void release_thread_cache(void *arg)
+{
+    thread_cache *c = (thread_cache *)arg;
+    for (int size_class = 0; size_class < MATO_POOL_SIZE_CLASSES; size_class++)
+    {
+        pool_block *first = c->free_blocks[size_class];
+        if (first == 0) continue;
+        pool_block *last = first;
+        while (last->next) last = last->next;
+        return_to_depot(size_class, first, last);
+        c->free_blocks[size_class] = 0;
+        c->count[size_class] = 0;
+    }
+}
+
+static void pool_init()
+{
+    for (int size_class = 0; size_class <= MATO_POOL_SIZE_CLASSES; size_class++)
+    {
+        pthread_mutex_init(&depot[size_class].lock, 0);
+        depot[size_class].free_blocks = 0;
+        atomic_init(&depot[size_class].blocks_allocated, 0);
+        atomic_init(&depot[size_class].blocks_in_use, 0);
+        atomic_init(&depot[size_class].high_water_mark, 0);
+    }
+    for (int size_class = 0; size_class < MATO_POOL_SIZE_CLASSES; size_class++)
+    {
+        int limit = CACHED_BYTES_PER_CLASS / class_sizes[size_class];
+        if (limit < MIN_CACHED_BLOCKS) limit = MIN_CACHED_BLOCKS;
+        if (limit > MAX_CACHED_BLOCKS) limit = MAX_CACHED_BLOCKS;
+        cache_limit[size_class] = limit;
+    }
+    pthread_key_create(&cache_key, release_thread_cache);
+    time_of_last_rate = usec();
+}
+
+static void register_thread_cache()
+{
+    if (cache.registered) return;
+    cache.registered = 1;
+    pthread_setspecific(cache_key, &cache);
+}
+
+static int size_class_of(int size)
+{
+    int size_class = 0;
+    while ((size_class < MATO_POOL_SIZE_CLASSES) && (class_sizes[size_class] < size)) size_class++;
+    return size_class;
+}
+
+static void count_in_use(int size_class, int delta)
+{
+    pool_depot *d = &depot[size_class];
+    int in_use = atomic_fetch_add_explicit(&d->blocks_in_use, delta, memory_order_relaxed) + delta;
+    int high_water_mark = atomic_load_explicit(&d->high_water_mark, memory_order_relaxed);
+    while ((in_use > high_water_mark) &&
+           !atomic_compare_exchange_weak_explicit(&d->high_water_mark, &high_water_mark, in_use, memory_order_relaxed, memory_order_relaxed));
+}
+
+/// The cache of the size class is empty: take half of its capacity from the depot, or from the system if the depot is empty.
+static void refill_thread_cache(int size_class)
+{
+    int batch = cache_limit[size_class] / 2;
+    if (batch < 1) batch = 1;
+    register_thread_cache();
+
+    pool_block *taken = 0;
+    int count = 0;
+    pthread_mutex_lock(&depot[size_class].lock);
+        while ((count < batch) && depot[size_class].free_blocks)
+        {
+            pool_block *b = depot[size_class].free_blocks;
+            depot[size_class].free_blocks = b->next;
+            b->next = taken;
+            taken = b;
+            count++;
+        }
+    pthread_mutex_unlock(&depot[size_class].lock);
+
+    while (count < batch)
+    {
+        pool_block *b = (pool_block *)malloc(POOL_HEADER_SIZE + class_sizes[size_class]);
+        if (b == 0)
+        {
+            if (count) break;
+            perror("could not allocate memory for message buffers");
+            exit(1);
+        }
+        b->size_class = size_class;
+        b->next = taken;
+        taken = b;
+        count++;
+        atomic_fetch_add_explicit(&depot[size_class].blocks_allocated, 1, memory_order_relaxed);
+    }
+    cache.free_blocks[size_class] = taken;
+    cache.count[size_class] = count;
+}
+
+/// The cache of the size class is over its limit: return all but half of the limit to the depot.
+static void flush_thread_cache(int size_class)
+{
+    int keep = cache_limit[size_class] / 2;
+    pool_block *first = cache.free_blocks[size_class];
+    pool_block *last = first;
+    for (int i = cache.count[size_class] - keep; i > 1; i--)
+        last = last->next;
+    cache.free_blocks[size_class] = last->next;
+    cache.count[size_class] = keep;
+    return_to_depot(size_class, first, last);
+}
+
+void *mato_pool_alloc(int size)
+{
+    pthread_once(&pool_initialized, pool_init);
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+
+    int size_class = size_class_of(size);
+    pool_block *b;
+    if (size_class == MATO_POOL_SIZE_CLASSES)
+    {
+        b = (pool_block *)malloc(POOL_HEADER_SIZE + size);
+        if (b == 0)
+        {
+            perror("could not allocate memory for message buffer");
+            exit(1);
+        }
+        b->size_class = size_class;
+        atomic_fetch_add_explicit(&depot[size_class].blocks_allocated, 1, memory_order_relaxed);
+    }
+    else
+    {
+        if (cache.count[size_class] == 0) refill_thread_cache(size_class);
+        b = cache.free_blocks[size_class];
+        cache.free_blocks[size_class] = b->next;
+        cache.count[size_class]--;
+    }
+    count_in_use(size_class, 1);
+    return (uint8_t *)b + POOL_HEADER_SIZE;
+}
+
+void mato_pool_free(void *block)
+{
+    if (block == 0) return;
+    pool_block *b = (pool_block *)((uint8_t *)block - POOL_HEADER_SIZE);
+    int size_class = b->size_class;
+    count_in_use(size_class, -1);
+    if (size_class == MATO_POOL_SIZE_CLASSES)
+    {
+        free(b);
+        return;
+    }
+    register_thread_cache();
+    b->next = cache.free_blocks[size_class];
+    cache.free_blocks[size_class] = b;
+    if (++cache.count[size_class] > cache_limit[size_class])
+        flush_thread_cache(size_class);
+}
+
+int mato_pool_class_usage(int size_class, mato_pool_usage *usage)
+{
+    if ((size_class < 0) || (size_class > MATO_POOL_SIZE_CLASSES)) return 0;
+    pthread_once(&pool_initialized, pool_init);
+    usage->block_size = (size_class < MATO_POOL_SIZE_CLASSES) ? class_sizes[size_class] : 0;
+    usage->blocks_allocated = atomic_load(&depot[size_class].blocks_allocated);
+    usage->blocks_in_use = atomic_load(&depot[size_class].blocks_in_use);
+    usage->high_water_mark = atomic_load(&depot[size_class].high_water_mark);
+    return 1;
+}
+
+long mato_pool_allocations()
+{
+    return atomic_load(&allocations);
+}
+
+double mato_pool_allocation_rate()
+{
+    pthread_once(&pool_initialized, pool_init);
+    double rate = 0;
+    pthread_mutex_lock(&rate_lock);
+        long long now = usec();
+        long count = atomic_load(&allocations);
+        if (now > time_of_last_rate)
+            rate = (count - allocations_at_last_rate) * 1000000.0 / (now - time_of_last_rate);
+        allocations_at_last_rate = count;
+        time_of_last_rate = now;
+    pthread_mutex_unlock(&rate_lock);
+    return rate;
+}
+
+void mato_pool_log_usage()
+{
+    char msg[120];
+    mato_pool_usage usage;
+    for (int size_class = 0; size_class <= MATO_POOL_SIZE_CLASSES; size_class++)
+    {
+        mato_pool_class_usage(size_class, &usage);
+        if (usage.blocks_allocated == 0) continue;
+        sprintf(msg, "message buffers of size %d: allocated %d, in use %d, high water mark %d",
+                usage.block_size, usage.blocks_allocated, usage.blocks_in_use, usage.high_water_mark);
+        mato_log(ML_DEBUG, msg);
+    }
+    mato_log_val(ML_DEBUG, "message buffer allocations:", (int)mato_pool_allocations());
+}
@@ -0,0 +1,51 @@
+#ifndef __MATO_POOL_H__
+#define __MATO_POOL_H__
+
+/// \file mato_pool.h
+/// Mato control framework - memory pool for the message buffers.
+/// Blocks are served from a fixed set of size classes tuned to the messages of the typical modules
+/// (small base data, laser scans, lines and segments, depth frames). Every thread keeps a small cache
+/// of free blocks of each class, so that allocating and releasing a block only touches thread-local data,
+/// the caches exchange the blocks with a global depot in batches. Blocks are never returned to the system,
+/// therefore once the pool has grown to the working set of the application, no more malloc()/free() takes place.
+/// Larger blocks than the largest size class are allocated and freed directly by malloc()/free().
+
+/// Number of size classes of the pool.
+#define MATO_POOL_SIZE_CLASSES 8
+
+/// Usable sizes of the blocks of the individual size classes.
+#define MATO_POOL_CLASS_SIZES { 64, 256, 1024, 4096, 8192, 16384, 65536, 655360 }
+
+/// Usage of a single size class, see mato_pool_class_usage().
+typedef struct {
+    /// usable size of the blocks of this class
+    int block_size;
+    /// blocks allocated from the system so far (they are never released)
+    int blocks_allocated;
+    /// blocks currently held by the users of the pool
+    int blocks_in_use;
+    /// maximum of blocks_in_use since the start
+    int high_water_mark;
+} mato_pool_usage;
+
+/// Returns a block with at least size usable bytes, it must be returned by mato_pool_free().
+/// Can be called from any thread.
+void *mato_pool_alloc(int size);
+
+/// Returns a block allocated by mato_pool_alloc() back to the pool, can be called from any thread.
+void mato_pool_free(void *block);
+
+/// Retrieve the usage of the specified size class (0..MATO_POOL_SIZE_CLASSES - 1), or of the blocks larger
+/// than the largest class for size_class == MATO_POOL_SIZE_CLASSES (then block_size is 0). Returns 0 for other values.
+int mato_pool_class_usage(int size_class, mato_pool_usage *usage);
+
+/// Total number of mato_pool_alloc() calls so far.
+long mato_pool_allocations();
+
+/// Number of allocations per second since the previous call of this function (or since the start).
+double mato_pool_allocation_rate();
+
+/// Write the usage of all size classes to the log.
+void mato_pool_log_usage();
+
+#endif
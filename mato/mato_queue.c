@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+/// \file mato_queue.c
+/// Implementation of the Mato control framework - bounded lock-free multi-producer/single-consumer queue.
+/// The ring follows the well-known bounded queue design with per-cell sequence numbers: producers claim
+/// a position by a single compare-and-swap, fill the cell and publish it by advancing the cell sequence.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+#include "mato_queue.h"
+#include "mato_logs.h"
+
+mato_queue *mato_queue_new(int capacity, mato_queue_overflow_policy policy, mato_queue_drop_callback drop)
+{
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    mato_queue *q = (mato_queue *)aligned_alloc(64, (sizeof(mato_queue) + 63) & ~63);
+    q->cells = (mato_queue_cell *)malloc(size * sizeof(mato_queue_cell));
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&q->cells[i].sequence, i);
+        atomic_init(&q->cells[i].key, 0);
+        atomic_init(&q->cells[i].item, 0);
+    }
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->consumer_idle, 0);
+    atomic_init(&q->waiting_producers, 0);
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->dropped, 0);
+    q->policy = policy;
+    q->drop = drop;
+    pthread_mutex_init(&q->space_lock, 0);
+    pthread_cond_init(&q->space_available, 0);
+
+    q->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if (q->wakeup_fd < 0)
+        mato_log_val(ML_ERR, "could not create eventfd for queue", errno);
+    return q;
+}
+
+void mato_queue_free(mato_queue *q)
+{
+    close(q->wakeup_fd);
+    pthread_mutex_destroy(&q->space_lock);
+    pthread_cond_destroy(&q->space_available);
+    free(q->cells);
+    free(q);
+}
+
+/// Wake up the consumer, but only if it is sleeping (or just about to sleep) - this is the only syscall on the producer side.
+static void wakeup_consumer(mato_queue *q)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->consumer_idle, memory_order_relaxed) &&
+        atomic_exchange(&q->consumer_idle, 0))
+    {
+        uint64_t one = 1;
+        if (write(q->wakeup_fd, &one, sizeof(uint64_t)) < 0)
+            mato_log_val(ML_ERR, "could not wakeup queue consumer", errno);
+    }
+}
+
+/// Claim a free cell and publish the item in it. Returns 0 if the queue is full.
+static int try_enqueue(mato_queue *q, uint64_t key, void *item)
+{
+    mato_queue_cell *cell;
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    while (1)
+    {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0)
+            return 0;
+        else
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+    atomic_store_explicit(&cell->key, key, memory_order_relaxed);
+    atomic_store_explicit(&cell->item, item, memory_order_relaxed);
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+/// Implements the mato_queue_drop_oldest policy on a full queue: all waiting items with the same key are
+/// shifted by one position towards the head of the queue (walking from the newest one), so that the new
+/// item takes the place of the newest one and the oldest one falls out. Each step is a single
+/// compare-and-swap of a published cell, so that no item is ever duplicated; if the consumer takes a cell
+/// meanwhile, the item in hand is dropped instead, which still keeps the order of the remaining items.
+/// Two producers shifting at the same time could swap items of the same key, therefore the shifting
+/// itself is serialized (it is only done on a full queue). Returns 0 if there is no item with the same key waiting in the queue.
+static int shift_out_oldest_with_key(mato_queue *q, uint64_t key, void *item)
+{
+    pthread_mutex_lock(&q->space_lock);
+    size_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&q->enqueue_pos, memory_order_acquire);
+    void *carry = item;
+
+    for (size_t pos = tail; pos-- > head; )
+    {
+        mato_queue_cell *cell = &q->cells[pos & q->mask];
+        if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + 1) continue;
+        if (atomic_load_explicit(&cell->key, memory_order_relaxed) != key) continue;
+        void *waiting = atomic_load_explicit(&cell->item, memory_order_acquire);
+        if (waiting == 0) break;  // taken by the consumer, so are all the older ones
+        if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + 1) continue;
+        if (!atomic_compare_exchange_strong(&cell->item, &waiting, carry))
+            break;
+        carry = waiting;
+    }
+    pthread_mutex_unlock(&q->space_lock);
+    if (carry == item) return 0;
+
+    atomic_fetch_add(&q->dropped, 1);
+    if (q->drop) q->drop(carry);
+    return 1;
+}
+
+/// The slow path of a producer that has found the queue full: wait for the consumer to make some space.
+static int wait_and_enqueue(mato_queue *q, uint64_t key, void *item)
+{
+    int queued = 0;
+    atomic_fetch_add(&q->waiting_producers, 1);
+    pthread_mutex_lock(&q->space_lock);
+        while (!atomic_load(&q->closed))
+        {
+            if ((queued = try_enqueue(q, key, item))) break;
+            wakeup_consumer(q);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 10000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&q->space_available, &q->space_lock, &deadline);
+        }
+    pthread_mutex_unlock(&q->space_lock);
+    atomic_fetch_sub(&q->waiting_producers, 1);
+    return queued;
+}
+
+int mato_queue_push(mato_queue *q, uint64_t key, void *item)
+{
+    int queued = 0;
+    if (!atomic_load_explicit(&q->closed, memory_order_relaxed))
+    {
+        queued = try_enqueue(q, key, item);
+        if (!queued && (q->policy == mato_queue_drop_oldest))
+        {
+            if (shift_out_oldest_with_key(q, key, item)) return 1;
+        }
+        if (!queued)
+            queued = wait_and_enqueue(q, key, item);
+    }
+    if (!queued)
+    {
+        if (q->drop) q->drop(item);
+        return 0;
+    }
+    wakeup_consumer(q);
+    return 1;
+}
+
+int mato_queue_push_nowait(mato_queue *q, uint64_t key, void *item, int drop_oldest)
+{
+    if (!atomic_load_explicit(&q->closed, memory_order_relaxed))
+    {
+        if (try_enqueue(q, key, item))
+        {
+            wakeup_consumer(q);
+            return 1;
+        }
+        if (drop_oldest && shift_out_oldest_with_key(q, key, item)) return 1;
+        atomic_fetch_add(&q->dropped, 1);
+    }
+    if (q->drop) q->drop(item);
+    return 0;
+}
+
+int mato_queue_try_push(mato_queue *q, uint64_t key, void *item)
+{
+    if (atomic_load_explicit(&q->closed, memory_order_relaxed)) return 0;
+    if (!try_enqueue(q, key, item)) return 0;
+    wakeup_consumer(q);
+    return 1;
+}
+
+void *mato_queue_try_pop(mato_queue *q)
+{
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    mato_queue_cell *cell = &q->cells[pos & q->mask];
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != pos + 1)
+        return 0;
+    // exchange (and not just load) so that shift_out_oldest_with_key() can see that the cell is gone
+    void *item = atomic_exchange_explicit(&cell->item, 0, memory_order_acq_rel);
+    atomic_store_explicit(&q->dequeue_pos, pos + 1, memory_order_relaxed);
+    atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+
+    if (atomic_load_explicit(&q->waiting_producers, memory_order_relaxed))
+    {
+        pthread_mutex_lock(&q->space_lock);
+            pthread_cond_signal(&q->space_available);
+        pthread_mutex_unlock(&q->space_lock);
+    }
+    return item;
+}
+
+void *mato_queue_pop(mato_queue *q)
+{
+    while (1)
+    {
+        void *item = mato_queue_try_pop(q);
+        if (item) return item;
+
+        // announce we are going to sleep, then check once more to not miss an item published meanwhile
+        atomic_store(&q->consumer_idle, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        item = mato_queue_try_pop(q);
+        if (item)
+        {
+            atomic_store(&q->consumer_idle, 0);
+            return item;
+        }
+        if (atomic_load(&q->closed))
+            return 0;
+
+        uint64_t wakeups;
+        if (read(q->wakeup_fd, &wakeups, sizeof(uint64_t)) < 0)
+        {
+            if (errno == EINTR) continue;
+            mato_log_val(ML_ERR, "error waiting on queue", errno);
+            return 0;
+        }
+    }
+}
+
+static long long queue_clock_usec()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+void *mato_queue_pop_timeout(mato_queue *q, long timeout_usec)
+{
+    long long deadline = queue_clock_usec() + timeout_usec;
+    while (1)
+    {
+        void *item = mato_queue_try_pop(q);
+        if (item) return item;
+
+        atomic_store(&q->consumer_idle, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        item = mato_queue_try_pop(q);
+        long long remaining = deadline - queue_clock_usec();
+        if (item || atomic_load(&q->closed) || (remaining <= 0))
+        {
+            // a producer that has seen the consumer idle meanwhile leaves a spurious wakeup, the next wait handles it
+            atomic_store(&q->consumer_idle, 0);
+            return item;
+        }
+
+        struct pollfd wakeup;
+        wakeup.fd = q->wakeup_fd;
+        wakeup.events = POLLIN;
+        wakeup.revents = 0;
+        int ready = poll(&wakeup, 1, (int)((remaining + 999) / 1000));
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            mato_log_val(ML_ERR, "error waiting on queue", errno);
+            atomic_store(&q->consumer_idle, 0);
+            return 0;
+        }
+        uint64_t wakeups;
+        if ((ready > 0) && (read(q->wakeup_fd, &wakeups, sizeof(uint64_t)) < 0) && (errno != EINTR))
+            mato_log_val(ML_ERR, "error waiting on queue", errno);
+    }
+}
+
+void mato_queue_close(mato_queue *q)
+{
+    atomic_store(&q->closed, 1);
+    atomic_store(&q->consumer_idle, 1);
+    wakeup_consumer(q);
+    pthread_mutex_lock(&q->space_lock);
+        pthread_cond_broadcast(&q->space_available);
+    pthread_mutex_unlock(&q->space_lock);
+}
+
+int mato_queue_length(mato_queue *q)
+{
+    size_t tail = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    return (tail > head) ? (int)(tail - head) : 0;
+}
+
+long mato_queue_dropped(mato_queue *q)
+{
+    return atomic_load(&q->dropped);
+}
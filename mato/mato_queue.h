@@ -0,0 +1,97 @@
+#ifndef __MATO_QUEUE_H__
+#define __MATO_QUEUE_H__
+
+/// \file mato_queue.h
+/// Mato control framework - bounded lock-free multi-producer/single-consumer queue of pointers.
+/// Producers never enter the kernel unless the consumer is idle (then a single eventfd write wakes it up),
+/// the consumer only sleeps in the kernel when the queue is empty. Items are delivered in the order
+/// in which the producers have claimed their positions in the queue, i.e. in the same order as a pipe would.
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// What happens when a producer finds the queue full:
+typedef enum mato_queue_overflow_policy_enum {
+    /// the producer waits until the consumer makes some space,
+    mato_queue_block = 1,
+    /// the oldest item with the same key that is still waiting in the queue is dropped to make space
+    /// for the new one (the order of the remaining items with that key is preserved); if there is no such
+    /// item in the queue, the producer waits as with mato_queue_block.
+    mato_queue_drop_oldest = 2
+} mato_queue_overflow_policy;
+
+/// Called for each item that was dropped from the queue (either by the overflow policy, or because
+/// it was pushed to a queue that has already been closed), so that its owner can release it.
+typedef void (* mato_queue_drop_callback)(void *item);
+
+/// One slot of the ring. The sequence number tells whether the slot is free for the producer
+/// at a particular position (sequence == position), or filled and ready for the consumer (sequence == position + 1).
+typedef struct {
+    atomic_size_t sequence;
+    atomic_uint_fast64_t key;
+    _Atomic(void *) item;
+} mato_queue_cell;
+
+/// The queue itself, see mato_queue_new().
+typedef struct {
+    mato_queue_cell *cells;
+    size_t mask;
+    /// next position to be claimed by producers (kept on its own cache line, it is the only contended variable)
+    _Alignas(64) atomic_size_t enqueue_pos;
+    /// next position to be taken by the consumer
+    _Alignas(64) atomic_size_t dequeue_pos;
+    /// the consumer is (about to be) sleeping on wakeup_fd
+    atomic_int consumer_idle;
+    /// number of producers waiting for a free slot
+    atomic_int waiting_producers;
+    atomic_int closed;
+    atomic_long dropped;
+    int wakeup_fd;
+    pthread_mutex_t space_lock;
+    pthread_cond_t space_available;
+    mato_queue_overflow_policy policy;
+    mato_queue_drop_callback drop;
+} mato_queue;
+
+/// Create a new queue with space for at least capacity items (rounded up to a power of two).
+mato_queue *mato_queue_new(int capacity, mato_queue_overflow_policy policy, mato_queue_drop_callback drop);
+
+/// Release the queue. There must be no producers or consumer using it anymore.
+void mato_queue_free(mato_queue *q);
+
+/// Append an item to the queue. The key groups the items for the mato_queue_drop_oldest policy
+/// (the framework uses the node/module/channel of a message). Can be called from any thread.
+/// Returns 1 if the item was queued, 0 if it had to be dropped (the queue was closed).
+int mato_queue_push(mato_queue *q, uint64_t key, void *item);
+
+/// Append an item to the queue only if there is a free slot, never waits and never drops other items.
+/// Returns 1 if the item was queued, 0 otherwise (the caller still owns the item).
+int mato_queue_try_push(mato_queue *q, uint64_t key, void *item);
+
+/// Append an item to the queue without ever waiting: if the queue is full, the oldest item with the same key that is still
+/// waiting in the queue is dropped if drop_oldest is set, otherwise (or if there is no such item) the new item is dropped.
+/// Both count as dropped items. Returns 1 if the item was queued, 0 if it was dropped (or the queue was closed).
+int mato_queue_push_nowait(mato_queue *q, uint64_t key, void *item, int drop_oldest);
+
+/// Take the oldest item from the queue, sleep while the queue is empty. Returns 0 when the queue
+/// has been closed and all the items have been taken. Only a single consumer thread may call this function.
+void *mato_queue_pop(mato_queue *q);
+
+/// Take the oldest item from the queue, or return 0 immediately if it is empty. Only the consumer thread may call this function.
+void *mato_queue_try_pop(mato_queue *q);
+
+/// Take the oldest item from the queue, sleep at most timeout_usec microseconds while the queue is empty. Returns 0 if no item
+/// has arrived meanwhile, or the queue has been closed and all the items have been taken. Only the consumer thread may call this function.
+void *mato_queue_pop_timeout(mato_queue *q, long timeout_usec);
+
+/// No more items will be accepted, the consumer is woken up and it receives 0 after the remaining items are taken.
+void mato_queue_close(mato_queue *q);
+
+/// Approximate number of items currently waiting in the queue.
+int mato_queue_length(mato_queue *q);
+
+/// Total number of items dropped by the overflow policy so far.
+long mato_queue_dropped(mato_queue *q);
+
+#endif
@@ -0,0 +1,458 @@
+/// \file mato_recorder.c
+/// Implementation of the Mato control framework - session recorder that writes the messages of the channels into a memory-mapped binary log.
+
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "mato_recorder.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// A channel selected for the recording: the module name and the channel, or -1 for all its channels.
+typedef struct {
+    char *module_name;
+    int channel;
+} recorded_channel;
+
+/// A module whose registry record has been written, with one of its subscriptions to check that they still exist
+/// (the subscriptions are removed when its node disconnects, and the module_id can then belong to another module).
+typedef struct {
+    char *name;
+    int channel;
+    int subscription_id;
+} recorded_module;
+
+typedef struct {
+    int module_id;
+    int channel;
+    int subscription_id;
+} recorder_subscription;
+
+/// Protects the selection, the recorded modules and the subscriptions, and the start and stop of the recording.
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Protects the file: the registry records are written by the thread that subscribes to the modules, the messages by the recorder thread.
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile int recording;
+static int recorder_module_id = -1;
+static int scan_timer_id = -1;
+static mato_queue *recorder_queue;
+static pthread_t recorder_thread_id;
+
+/// of recorded_channel, empty means all channels
+static GArray *selection;
+/// public module_id -> recorded_module
+static GHashTable *recorded_modules;
+/// of recorder_subscription
+static GArray *recorder_subscriptions;
+
+static atomic_long messages_recorded;
+static atomic_long messages_dropped;
+static atomic_llong bytes_recorded;
+
+/// the file and its chunk that is currently mapped
+static int record_fd = -1;
+static long long file_size;
+static uint8_t *chunk;
+static recording_chunk_header *chunk_header;
+/// offsets of the records in the current chunk
+static GArray *chunk_index;
+/// set when the file could not be extended, the messages are dropped from then on
+static int write_failed;
+
+static void free_recorded_module(void *data)
+{
+    recorded_module *rm = (recorded_module *)data;
+    free(rm->name);
+    free(rm);
+}
+
+/// Parse the list of channels to record: module names or name:channel separated by spaces.
+static void parse_selection(const char *channels)
+{
+    selection = g_array_new(0, 0, sizeof(recorded_channel));
+    if (channels == 0) return;
+    char *list = strdup(channels);
+    char *save;
+    for (char *item = strtok_r(list, " \t", &save); item; item = strtok_r(0, " \t", &save))
+    {
+        recorded_channel rc;
+        rc.channel = -1;
+        char *colon = strrchr(item, ':');
+        if (colon)
+        {
+            *colon = 0;
+            rc.channel = atoi(colon + 1);
+        }
+        rc.module_name = strdup(item);
+        g_array_append_val(selection, rc);
+    }
+    free(list);
+}
+
+static void free_selection()
+{
+    for (int i = 0; i < selection->len; i++)
+        free(g_array_index(selection, recorded_channel, i).module_name);
+    g_array_free(selection, 1);
+    selection = 0;
+}
+
+static int is_selected(const char *module_name, int channel)
+{
+    if (selection->len == 0) return 1;
+    for (int i = 0; i < selection->len; i++)
+    {
+        recorded_channel *rc = &g_array_index(selection, recorded_channel, i);
+        if ((strcmp(rc->module_name, module_name) == 0) && ((rc->channel < 0) || (rc->channel == channel)))
+            return 1;
+    }
+    return 0;
+}
+
+//-------------- the file ---------------------
+
+/// Append the index to the current chunk and unmap it. The last chunk (final != 0) is truncated right behind its index.
+static void seal_chunk(int final)
+{
+    if (chunk == 0) return;
+    uint32_t index_offset = sizeof(recording_chunk_header) + chunk_header->used;
+    memcpy(chunk + index_offset, chunk_index->data, chunk_index->len * sizeof(uint32_t));
+    chunk_header->index_offset = index_offset;
+
+    long long chunk_size = chunk_header->size;
+    if (final)
+    {
+        chunk_header->size = index_offset + chunk_index->len * sizeof(uint32_t);
+        file_size -= chunk_size - chunk_header->size;
+    }
+    msync(chunk, chunk_size, MS_ASYNC);
+    munmap(chunk, chunk_size);
+    if (final && (ftruncate(record_fd, file_size) < 0))
+        mato_log_val(ML_ERR, "could not truncate the recording", errno);
+
+    chunk = 0;
+    chunk_header = 0;
+    g_array_set_size(chunk_index, 0);
+}
+
+/// Extend the file by a new chunk with space for at least one record of the size (and its index entry) and map it.
+static int open_chunk(long long record_size)
+{
+    long long page_size = sysconf(_SC_PAGESIZE);
+    long long size = RECORDING_CHUNK_SIZE;
+    long long needed = sizeof(recording_chunk_header) + record_size + sizeof(uint32_t);
+    if (needed > size) size = (needed + page_size - 1) / page_size * page_size;
+
+    if (ftruncate(record_fd, file_size + size) < 0)
+    {
+        mato_log_val(ML_ERR, "could not extend the recording", errno);
+        return 0;
+    }
+    chunk = (uint8_t *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, record_fd, file_size);
+    if (chunk == MAP_FAILED)
+    {
+        mato_log_val(ML_ERR, "could not map the recording", errno);
+        chunk = 0;
+        return 0;
+    }
+    file_size += size;
+
+    chunk_header = (recording_chunk_header *)chunk;
+    memcpy(chunk_header->magic, RECORDING_CHUNK_MAGIC, 8);
+    chunk_header->size = size;
+    return 1;
+}
+
+/// Append a record to the file, the file must be locked. Returns 0 if the file could not be extended.
+static int write_record(long long time, int node_id, int module_id, int channel, int length, const void *payload)
+{
+    if (write_failed) return 0;
+    long long record_size = RECORDING_RECORD_SIZE(length);
+    if (chunk && (sizeof(recording_chunk_header) + chunk_header->used + record_size +
+                  (chunk_index->len + 1) * sizeof(uint32_t) > chunk_header->size))
+        seal_chunk(0);
+    if ((chunk == 0) && !open_chunk(record_size))
+    {
+        write_failed = 1;
+        return 0;
+    }
+
+    uint32_t offset = sizeof(recording_chunk_header) + chunk_header->used;
+    recording_record *record = (recording_record *)(chunk + offset);
+    record->time = time;
+    record->node_id = node_id;
+    record->module_id = module_id;
+    record->channel = channel;
+    record->length = length;
+    if (length > 0) memcpy(record + 1, payload, length);
+    g_array_append_val(chunk_index, offset);
+
+    if (chunk_header->number_of_records == 0) chunk_header->first_time = time;
+    chunk_header->last_time = time;
+    chunk_header->used += record_size;
+    chunk_header->number_of_records++;
+    return 1;
+}
+
+/// Write the registry record of a module, the file must be locked.
+static void write_module_record(int module_id, const char *name, const char *type, int number_of_channels)
+{
+    int name_length = strlen(name) + 1;
+    int type_length = strlen(type) + 1;
+    int length = sizeof(int32_t) + name_length + type_length;
+    uint8_t *payload = (uint8_t *)malloc(length);
+    *(int32_t *)payload = number_of_channels;
+    memcpy(payload + sizeof(int32_t), name, name_length);
+    memcpy(payload + sizeof(int32_t) + name_length, type, type_length);
+    write_record(monotonic_usec(), module_id / NODE_MULTIPLIER, module_id, RECORDING_MODULE_RECORD, length, payload);
+    free(payload);
+}
+
+static int open_recording_file(const char *filename)
+{
+    record_fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (record_fd < 0)
+    {
+        mato_log_str_val(ML_ERR, "could not create recording file ", filename, errno);
+        return 0;
+    }
+    recording_file_header header;
+    memset(&header, 0, sizeof(recording_file_header));
+    memcpy(header.magic, RECORDING_FILE_MAGIC, 8);
+    header.version = RECORDING_VERSION;
+    header.node_id = this_node_id;
+    header.start_time = monotonic_usec();
+    header.start_unix_time = usec();
+    header.first_chunk = sysconf(_SC_PAGESIZE);
+    if (write(record_fd, &header, sizeof(recording_file_header)) < (int)sizeof(recording_file_header))
+    {
+        mato_log_str_val(ML_ERR, "could not write recording file ", filename, errno);
+        close(record_fd);
+        record_fd = -1;
+        return 0;
+    }
+    file_size = header.first_chunk;
+    write_failed = 0;
+    chunk_index = g_array_new(0, 0, sizeof(uint32_t));
+    return 1;
+}
+
+static void close_recording_file()
+{
+    seal_chunk(1);
+    close(record_fd);
+    record_fd = -1;
+    g_array_free(chunk_index, 1);
+}
+
+//-------------- the recorder module ---------------------
+
+/// Subscriber callback of the recorder: it keeps the borrowed message for the recorder thread, or drops it if the queue is full.
+static void record_message(void *instance_data, int sender_module_id, int data_length, void *data)
+{
+    if (data == 0) return;  // empty messages are not recorded
+    channel_data *cd = channel_data_of_buffer(data);
+    if (!mato_queue_try_push(recorder_queue, CHANNEL_KEY(cd->node_id, cd->module_id, cd->channel_id), cd))
+    {
+        atomic_fetch_add_explicit(&messages_dropped, 1, memory_order_relaxed);
+        mato_release_data(sender_module_id, cd->channel_id, data);
+    }
+}
+
+/// Write the registry record of the module and subscribe to its selected channels, unless it has been done already.
+/// Must be called with the scan_lock locked.
+static void record_module(module_info *info)
+{
+    recorded_module *rm = (recorded_module *)g_hash_table_lookup(recorded_modules, GINT_TO_POINTER(info->module_id));
+    if (rm && (strcmp(rm->name, info->name) == 0) &&
+        ((rm->channel < 0) || (mato_subscription_dropped(info->module_id, rm->channel, rm->subscription_id) >= 0)))
+        return;
+
+    rm = (recorded_module *)malloc(sizeof(recorded_module));
+    rm->name = strdup(info->name);
+    rm->channel = -1;
+    g_hash_table_replace(recorded_modules, GINT_TO_POINTER(info->module_id), rm);
+
+    pthread_mutex_lock(&file_lock);
+        write_module_record(info->module_id, info->name, info->type, info->number_of_channels);
+    pthread_mutex_unlock(&file_lock);
+
+    for (int channel = 0; channel < info->number_of_channels; channel++)
+    {
+        if (!is_selected(info->name, channel)) continue;
+        recorder_subscription rs;
+        rs.module_id = info->module_id;
+        rs.channel = channel;
+        rs.subscription_id = mato_subscribe(recorder_module_id, info->module_id, channel, record_message, borrowed_pointer);
+        g_array_append_val(recorder_subscriptions, rs);
+        if (rm->channel < 0)
+        {
+            rm->channel = channel;
+            rm->subscription_id = rs.subscription_id;
+        }
+    }
+}
+
+/// Subscribe to the channels of the modules that have appeared since the last scan.
+static void scan_modules()
+{
+    pthread_mutex_lock(&scan_lock);
+        if (recording)
+        {
+            GArray *modules = mato_get_list_of_all_modules();
+            for (int i = 0; i < modules->len; i++)
+            {
+                module_info *info = g_array_index(modules, module_info *, i);
+                if (strcmp(info->type, RECORDER_MODULE_TYPE) != 0) record_module(info);
+            }
+            mato_free_list_of_modules(modules);
+        }
+    pthread_mutex_unlock(&scan_lock);
+}
+
+static void scan_timer(void *instance_data, int timer_id)
+{
+    scan_modules();
+}
+
+static void *create_recorder(int module_id)
+{
+    return 0;
+}
+
+static void start_recorder(void *instance_data)
+{
+}
+
+static void delete_recorder(void *instance_data)
+{
+}
+
+static void recorder_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+/// Writes the messages taken by the recorder callback into the file and returns them.
+static void *recorder_thread(void *arg)
+{
+    mato_inc_system_thread_count("recorder");
+    channel_data *cd;
+    while ((cd = (channel_data *)mato_queue_pop(recorder_queue)))
+    {
+        int module_id = cd->node_id * NODE_MULTIPLIER + cd->module_id;
+        pthread_mutex_lock(&file_lock);
+            int written = write_record(cd->post_time, cd->node_id, module_id, cd->channel_id, cd->length, cd->data);
+        pthread_mutex_unlock(&file_lock);
+        if (written)
+        {
+            atomic_fetch_add_explicit(&messages_recorded, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&bytes_recorded, cd->length, memory_order_relaxed);
+        }
+        else atomic_fetch_add_explicit(&messages_dropped, 1, memory_order_relaxed);
+        mato_release_data(module_id, cd->channel_id, cd->data);
+    }
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+/// Create the recorder module of this node when the recording starts for the first time.
+static void create_recorder_module()
+{
+    static module_specification recorder_specification;
+    recorder_specification.create_instance = create_recorder;
+    recorder_specification.start_instance = start_recorder;
+    recorder_specification.delete_instance = delete_recorder;
+    recorder_specification.global_message = recorder_global_message;
+    recorder_specification.number_of_channels = 0;
+    mato_register_new_type_of_module(RECORDER_MODULE_TYPE, &recorder_specification);
+
+    char name[30];
+    sprintf(name, "recorder_node%d", this_node_id);
+    recorder_module_id = mato_create_new_module_instance(RECORDER_MODULE_TYPE, name);
+}
+
+int mato_start_recording(const char *filename, const char *channels)
+{
+    pthread_mutex_lock(&scan_lock);
+        if (recording || !open_recording_file(filename))
+        {
+            pthread_mutex_unlock(&scan_lock);
+            return 0;
+        }
+        if (recorder_module_id < 0) create_recorder_module();
+
+        parse_selection(channels);
+        recorded_modules = g_hash_table_new_full(g_direct_hash, g_direct_equal, 0, free_recorded_module);
+        recorder_subscriptions = g_array_new(0, 0, sizeof(recorder_subscription));
+        // the queue of the previous recording is only released now, its late callbacks have certainly finished
+        if (recorder_queue) mato_queue_free(recorder_queue);
+        recorder_queue = mato_queue_new(RECORDER_QUEUE_CAPACITY, mato_queue_block, 0);
+        atomic_store(&messages_recorded, 0);
+        atomic_store(&messages_dropped, 0);
+        atomic_store(&bytes_recorded, 0);
+
+        if (pthread_create(&recorder_thread_id, 0, recorder_thread, 0) != 0)
+        {
+            perror("could not create thread for recorder");
+            close_recording_file();
+            pthread_mutex_unlock(&scan_lock);
+            return 0;
+        }
+        recording = 1;
+    pthread_mutex_unlock(&scan_lock);
+
+    scan_modules();
+    scan_timer_id = mato_add_timer(recorder_module_id, RECORDER_SCAN_PERIOD, scan_timer);
+    mato_log_str(ML_INFO, "recording to", filename);
+    return 1;
+}
+
+void mato_stop_recording()
+{
+    pthread_mutex_lock(&scan_lock);
+        if (!recording)
+        {
+            pthread_mutex_unlock(&scan_lock);
+            return;
+        }
+        recording = 0;
+        mato_remove_timer(scan_timer_id);
+        for (int i = 0; i < recorder_subscriptions->len; i++)
+        {
+            recorder_subscription *rs = &g_array_index(recorder_subscriptions, recorder_subscription, i);
+            mato_unsubscribe(rs->module_id, rs->channel, rs->subscription_id);
+        }
+        g_array_free(recorder_subscriptions, 1);
+        g_hash_table_destroy(recorded_modules);
+        free_selection();
+    pthread_mutex_unlock(&scan_lock);
+
+    // the callbacks that are still running return their messages themselves when the queue is closed
+    mato_queue_close(recorder_queue);
+    pthread_join(recorder_thread_id, 0);
+    pthread_mutex_lock(&file_lock);
+        close_recording_file();
+    pthread_mutex_unlock(&file_lock);
+    mato_log_val(ML_INFO, "recording stopped, messages recorded:", atomic_load(&messages_recorded));
+}
+
+void mato_get_recording_stats(mato_recording_stats *stats)
+{
+    stats->active = recording;
+    stats->messages = atomic_load(&messages_recorded);
+    stats->dropped = atomic_load(&messages_dropped);
+    stats->bytes = atomic_load(&bytes_recorded);
+}
+
+void recorder_init()
+{
+    if (*mato_core_config.record_file)
+        mato_start_recording(mato_core_config.record_file, mato_core_config.record_channels);
+}
+
+void recorder_shutdown()
+{
+    mato_stop_recording();
+}
@@ -0,0 +1,85 @@
+#ifndef __MATO_RECORDER_H__
+#define __MATO_RECORDER_H__
+
+/// \file mato_recorder.h
+/// Mato control framework - session recorder that writes the messages of the channels into a binary log (see mato_start_recording()).
+/// The recorder is an internal module (of type RECORDER_MODULE_TYPE) that subscribes in the borrowed_pointer mode to all
+/// (or the selected) channels of the local and remote modules. Its callback only queues the borrowed message, so that
+/// the dispatcher is never blocked (when the queue is full, the message is dropped and counted), and the recorder thread
+/// copies the messages straight from the borrowed buffers into the memory-mapped file and returns them.
+///
+/// The file starts with a recording_file_header, followed by the chunks from the offset first_chunk. Each chunk is mapped
+/// into the memory while it is written (it is RECORDING_CHUNK_SIZE long, or longer when a single message does not fit),
+/// it starts with a recording_chunk_header, the records follow, and when the chunk is complete, an index of the offsets
+/// of its records (uint32_t from the chunk start) is appended and the index_offset is set. The last chunk is truncated
+/// right behind its index when the recording stops. The used and number_of_records of the chunk header are updated
+/// after each record, so the records of an interrupted recording can still be read sequentially.
+/// Each record is a recording_record followed by the payload, padded to 8 bytes. Before the first message of a module,
+/// a registry record (channel RECORDING_MODULE_RECORD) describes it: int32_t number_of_channels, the name and the type
+/// (zero-terminated). All numbers are stored in the byte order of the recording node.
+
+#include "mato_core.h"
+
+#define RECORDER_MODULE_TYPE "mato_recorder"
+
+#define RECORDING_FILE_MAGIC "MATOREC1"
+#define RECORDING_CHUNK_MAGIC "MATOCHNK"
+#define RECORDING_VERSION 1
+#define RECORDING_CHUNK_SIZE (4 * 1024 * 1024)
+
+/// the channel of the registry records
+#define RECORDING_MODULE_RECORD -1
+
+/// how many messages can wait for the recorder thread
+#define RECORDER_QUEUE_CAPACITY 16384
+
+/// every how many microseconds the recorder looks for new modules to subscribe to
+#define RECORDER_SCAN_PERIOD 100000
+
+typedef struct {
+    char magic[8];
+    int32_t version;
+    /// node that made the recording
+    int32_t node_id;
+    /// monotonic_usec() and usec() when the recording started
+    int64_t start_time;
+    int64_t start_unix_time;
+    /// offset of the first chunk in the file (aligned to the page size)
+    int64_t first_chunk;
+} recording_file_header;
+
+typedef struct {
+    char magic[8];
+    /// length of the chunk including this header and the index
+    int64_t size;
+    /// length of the records that follow this header
+    int64_t used;
+    /// time of the first and the last record
+    int64_t first_time;
+    int64_t last_time;
+    int32_t number_of_records;
+    /// offset of the index from the chunk start, 0 until the chunk is complete
+    int32_t index_offset;
+} recording_chunk_header;
+
+typedef struct {
+    /// monotonic_usec() when the message was posted, or when it arrived from its node
+    int64_t time;
+    int32_t node_id;
+    /// public module_id of the module that posted the message
+    int32_t module_id;
+    int32_t channel;
+    /// length of the payload (without the padding)
+    int32_t length;
+} recording_record;
+
+/// space occupied by a record with the payload of the length
+#define RECORDING_RECORD_SIZE(length) (sizeof(recording_record) + (((length) + 7) & ~7))
+
+/// Start the recording if the record_file variable of the framework config is set. Called by mato_start().
+void recorder_init();
+
+/// Stop the recording if it runs, called when the framework shuts down.
+void recorder_shutdown();
+
+#endif
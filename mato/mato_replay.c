@@ -0,0 +1,352 @@
+/// \file mato_replay.c
+/// Implementation of the Mato control framework - replay of the recorded sessions.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "mato_replay.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// Protects replays, replayed_types and next_replay.
+static pthread_mutex_t replays_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// public module_id -> mato_replay, for mato_get_replay_stats()
+static GHashTable *replays;
+
+/// type name -> module_specification of the types registered for the replayed modules
+static GHashTable *replayed_types;
+
+/// the instance data for the replay module that is just being created
+static mato_replay *next_replay;
+
+/// Position of a record in the recording, see next_record().
+typedef struct {
+    long long chunk;
+    long long offset;
+} recording_position;
+
+/// Returns the next record of the recording and moves the position behind it, or returns 0 at the end of the recording
+/// (or where it is damaged). The position starts at the first chunk with the offset 0.
+static recording_record *next_record(mato_replay *replay, recording_position *position)
+{
+    while (position->chunk + (long long)sizeof(recording_chunk_header) <= replay->recording_size)
+    {
+        recording_chunk_header *chunk_header = (recording_chunk_header *)(replay->recording + position->chunk);
+        if (memcmp(chunk_header->magic, RECORDING_CHUNK_MAGIC, 8) != 0) return 0;
+        long long records_end = position->chunk + sizeof(recording_chunk_header) + chunk_header->used;
+        long long offset = position->chunk + sizeof(recording_chunk_header) + position->offset;
+        if ((records_end <= replay->recording_size) && (offset + (long long)sizeof(recording_record) <= records_end))
+        {
+            recording_record *record = (recording_record *)(replay->recording + offset);
+            if ((record->length < 0) || (offset + (long long)RECORDING_RECORD_SIZE(record->length) > records_end)) return 0;
+            position->offset += RECORDING_RECORD_SIZE(record->length);
+            return record;
+        }
+        if (chunk_header->size <= 0) return 0;
+        position->chunk += chunk_header->size;
+        position->offset = 0;
+    }
+    return 0;
+}
+
+/// The name, type and number of channels stored in a registry record.
+static void parse_module_record(recording_record *record, char **name, char **type, int *number_of_channels)
+{
+    uint8_t *payload = (uint8_t *)(record + 1);
+    *number_of_channels = *(int32_t *)payload;
+    *name = (char *)payload + sizeof(int32_t);
+    *type = *name + strlen(*name) + 1;
+}
+
+/// Find the modules that have posted some messages in the recording. The registry records are only looked up
+/// for the messages, so that the modules whose module_id has been reused by another module are replayed correctly.
+static void find_recorded_modules(mato_replay *replay)
+{
+    GHashTable *registry = g_hash_table_new(g_direct_hash, g_direct_equal);  // recorded module_id -> registry record
+    recording_position position = { replay->header->first_chunk, 0 };
+    recording_record *record;
+    while ((record = next_record(replay, &position)))
+    {
+        if (record->channel == RECORDING_MODULE_RECORD)
+        {
+            g_hash_table_replace(registry, GINT_TO_POINTER(record->module_id), record);
+            continue;
+        }
+        recording_record *module_record = (recording_record *)g_hash_table_lookup(registry, GINT_TO_POINTER(record->module_id));
+        if (module_record == 0) continue;
+
+        char *name, *type;
+        int number_of_channels;
+        parse_module_record(module_record, &name, &type, &number_of_channels);
+        replayed_module *m = (replayed_module *)g_hash_table_lookup(replay->modules_by_name, name);
+        if (m == 0)
+        {
+            m = (replayed_module *)malloc(sizeof(replayed_module));
+            m->name = name;
+            m->type = type;
+            m->number_of_channels = number_of_channels;
+            m->module_id = -1;
+            g_hash_table_insert(replay->modules_by_name, name, m);
+        }
+        else if (number_of_channels > m->number_of_channels) m->number_of_channels = number_of_channels;
+    }
+    g_hash_table_destroy(registry);
+}
+
+static void *create_replayed_module(int module_id) { return 0; }
+static void start_replayed_module(void *instance_data) { }
+static void delete_replayed_module(void *instance_data) { }
+static void replayed_module_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data) { }
+
+/// Returns 1 if the replayed module can be created with the type: it has not been registered yet, or it has been registered
+/// by a replay with the same number of channels.
+static int can_use_type(char *type, int number_of_channels)
+{
+    lock_framework_read();
+        module_specification *spec = (module_specification *)g_hash_table_lookup(module_specifications, type);
+    unlock_framework();
+    if (spec == 0) return 1;
+    return (g_hash_table_lookup(replayed_types, type) == spec) && (spec->number_of_channels == number_of_channels);
+}
+
+/// Find the type for the replayed module: its recorded type, unless the program has registered that type itself, or it has been
+/// registered by another replay with a different number of channels. The type is registered if needed, the buffer must have space
+/// for the recorded type with the REPLAY_TYPE_PREFIX and the number of channels. Must be called with the replays_lock locked.
+static void replayed_module_type(replayed_module *m, char *type)
+{
+    strcpy(type, m->type);
+    if (!can_use_type(type, m->number_of_channels))
+    {
+        sprintf(type, "%s%s", REPLAY_TYPE_PREFIX, m->type);
+        if (!can_use_type(type, m->number_of_channels))
+            sprintf(type, "%s%s_%d", REPLAY_TYPE_PREFIX, m->type, m->number_of_channels);
+    }
+    if (g_hash_table_lookup(replayed_types, type)) return;
+
+    // the framework keeps both the type name and the specification
+    char *registered_type = strdup(type);
+    module_specification *spec = (module_specification *)malloc(sizeof(module_specification));
+    spec->create_instance = create_replayed_module;
+    spec->start_instance = start_replayed_module;
+    spec->delete_instance = delete_replayed_module;
+    spec->global_message = replayed_module_global_message;
+    spec->number_of_channels = m->number_of_channels;
+    mato_register_new_type_of_module(registered_type, spec);
+    g_hash_table_insert(replayed_types, registered_type, spec);
+}
+
+/// Sleep until the monotonic_usec() time, or until the replay is stopped.
+static void sleep_until(mato_replay *replay, long long time)
+{
+    long long now;
+    while (!replay->stop && program_runs && ((now = monotonic_usec()) < time))
+    {
+        long long delay = time - now;
+        if (delay > 100000) delay = 100000;
+        usleep(delay);
+    }
+}
+
+/// Posts the recorded messages on behalf of the replayed modules.
+static void *replay_thread(void *arg)
+{
+    mato_replay *replay = (mato_replay *)arg;
+    mato_inc_system_thread_count("replay");
+    while (!modules_started && !replay->stop && program_runs) usleep(1000);
+
+    GHashTable *current_modules = g_hash_table_new(g_direct_hash, g_direct_equal);  // recorded module_id -> replayed_module
+    recording_position position = { replay->header->first_chunk, 0 };
+    recording_record *record;
+    long long first_time = -1;
+    replay->start_time = monotonic_usec();
+    while (!replay->stop && program_runs && (record = next_record(replay, &position)))
+    {
+        if (record->channel == RECORDING_MODULE_RECORD)
+        {
+            char *name, *type;
+            int number_of_channels;
+            parse_module_record(record, &name, &type, &number_of_channels);
+            replayed_module *m = (replayed_module *)g_hash_table_lookup(replay->modules_by_name, name);
+            if (m && (m->module_id >= 0)) g_hash_table_replace(current_modules, GINT_TO_POINTER(record->module_id), m);
+            else g_hash_table_remove(current_modules, GINT_TO_POINTER(record->module_id));
+            continue;
+        }
+        replayed_module *m = (replayed_module *)g_hash_table_lookup(current_modules, GINT_TO_POINTER(record->module_id));
+        if ((m == 0) || (record->channel >= m->number_of_channels)) continue;
+
+        if (replay->speed > 0)
+        {
+            if (first_time < 0) first_time = record->time;
+            sleep_until(replay, replay->start_time + (long long)((record->time - first_time) / replay->speed));
+        }
+        else wait_for_deliveries();
+
+        void *data = 0;
+        if (record->length > 0)
+        {
+            data = mato_get_data_buffer(record->length);
+            memcpy(data, record + 1, record->length);
+        }
+        mato_post_data(m->module_id, record->channel, record->length, data);
+        atomic_fetch_add_explicit(&replay->messages, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&replay->bytes, record->length, memory_order_relaxed);
+    }
+    if (replay->speed <= 0) wait_for_deliveries();
+    replay->end_time = monotonic_usec();
+    replay->finished = 1;
+    g_hash_table_destroy(current_modules);
+    mato_log_val(ML_INFO, "replay finished, messages posted:", atomic_load(&replay->messages));
+
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+static void *create_replay(int module_id)
+{
+    mato_replay *replay = next_replay;
+    replay->module_id = module_id;
+    return replay;
+}
+
+static void start_replay(void *instance_data)
+{
+    mato_replay *replay = (mato_replay *)instance_data;
+    if (replay->thread_started) return;
+    if (pthread_create(&replay->thread, 0, replay_thread, replay) != 0)
+    {
+        perror("could not create thread for replay");
+        return;
+    }
+    replay->thread_started = 1;
+}
+
+static void delete_replay(void *instance_data)
+{
+    mato_replay *replay = (mato_replay *)instance_data;
+    replay->stop = 1;
+    if (replay->thread_started) pthread_join(replay->thread, 0);
+
+    pthread_mutex_lock(&replays_lock);
+        g_hash_table_remove(replays, GINT_TO_POINTER(replay->module_id));
+    pthread_mutex_unlock(&replays_lock);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, replay->modules_by_name);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+    {
+        replayed_module *m = (replayed_module *)value;
+        if (m->module_id >= 0) mato_delete_module_instance(m->module_id);
+        free(m);
+    }
+    g_hash_table_destroy(replay->modules_by_name);
+    munmap(replay->recording, replay->recording_size);
+    free(replay);
+}
+
+static void replay_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+/// Map the recording into the memory and check its header. Returns 0 if it cannot be used.
+static int map_recording(mato_replay *replay, const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        mato_log_str_val(ML_ERR, "could not open recording ", filename, errno);
+        return 0;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size < (long long)sizeof(recording_file_header)))
+    {
+        mato_log_str(ML_ERR, "not a recording:", filename);
+        close(fd);
+        return 0;
+    }
+    replay->recording_size = st.st_size;
+    replay->recording = (uint8_t *)mmap(0, replay->recording_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (replay->recording == MAP_FAILED)
+    {
+        mato_log_str_val(ML_ERR, "could not map recording ", filename, errno);
+        return 0;
+    }
+    madvise(replay->recording, replay->recording_size, MADV_SEQUENTIAL);
+
+    replay->header = (recording_file_header *)replay->recording;
+    if ((memcmp(replay->header->magic, RECORDING_FILE_MAGIC, 8) != 0) || (replay->header->version != RECORDING_VERSION))
+    {
+        mato_log_str(ML_ERR, "not a recording:", filename);
+        munmap(replay->recording, replay->recording_size);
+        return 0;
+    }
+    return 1;
+}
+
+int mato_create_replay(const char *filename, double speed)
+{
+    mato_replay *replay = (mato_replay *)calloc(1, sizeof(mato_replay));
+    if (!map_recording(replay, filename))
+    {
+        free(replay);
+        return -1;
+    }
+    replay->speed = speed;
+    replay->modules_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    find_recorded_modules(replay);
+
+    pthread_mutex_lock(&replays_lock);
+        if (replays == 0)
+        {
+            static module_specification replay_specification;
+            replay_specification.create_instance = create_replay;
+            replay_specification.start_instance = start_replay;
+            replay_specification.delete_instance = delete_replay;
+            replay_specification.global_message = replay_global_message;
+            replay_specification.number_of_channels = 0;
+            mato_register_new_type_of_module(REPLAY_MODULE_TYPE, &replay_specification);
+            replays = g_hash_table_new(g_direct_hash, g_direct_equal);
+            replayed_types = g_hash_table_new(g_str_hash, g_str_equal);
+        }
+
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, replay->modules_by_name);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+        {
+            replayed_module *m = (replayed_module *)value;
+            char *type = (char *)malloc(strlen(REPLAY_TYPE_PREFIX) + strlen(m->type) + 20);
+            replayed_module_type(m, type);
+            m->module_id = mato_create_new_module_instance(type, m->name);
+            free(type);
+        }
+
+        char name[40];
+        sprintf(name, "replay_node%d_%d", this_node_id, g_hash_table_size(replays));
+        next_replay = replay;
+        int module_id = mato_create_new_module_instance(REPLAY_MODULE_TYPE, name);
+        g_hash_table_insert(replays, GINT_TO_POINTER(module_id), replay);
+    pthread_mutex_unlock(&replays_lock);
+
+    mato_log_str(ML_INFO, "replaying", filename);
+    return module_id;
+}
+
+int mato_get_replay_stats(int replay_module_id, mato_replay_stats *stats)
+{
+    pthread_mutex_lock(&replays_lock);
+        mato_replay *replay = replays ? (mato_replay *)g_hash_table_lookup(replays, GINT_TO_POINTER(replay_module_id)) : 0;
+        if (replay)
+        {
+            stats->finished = replay->finished;
+            stats->messages = atomic_load(&replay->messages);
+            stats->bytes = atomic_load(&replay->bytes);
+            long long end = replay->finished ? replay->end_time : monotonic_usec();
+            stats->duration = replay->start_time ? end - replay->start_time : 0;
+        }
+    pthread_mutex_unlock(&replays_lock);
+    return replay != 0;
+}
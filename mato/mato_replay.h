@@ -0,0 +1,50 @@
+#ifndef __MATO_REPLAY_H__
+#define __MATO_REPLAY_H__
+
+/// \file mato_replay.h
+/// Mato control framework - replay of the sessions recorded by the session recorder (see mato_create_replay() and mato_recorder.h).
+/// A replay is a module of type REPLAY_MODULE_TYPE. When it is created, it maps the whole recording into the memory and creates
+/// a module for each recorded module that has posted some messages, with the same name, type and number of channels
+/// (if the program registers that type itself, the type gets the REPLAY_TYPE_PREFIX). When the replay module is started,
+/// its thread waits until mato_start() has started all modules, and then it posts the recorded messages in their order
+/// through mato_post_data() on behalf of those modules, either in the recorded rhythm (optionally faster or slower),
+/// or each message as soon as the deliveries of the previous one have finished (see wait_for_deliveries()).
+
+#include "mato_core.h"
+#include "mato_recorder.h"
+
+#define REPLAY_MODULE_TYPE "mato_replay"
+#define REPLAY_TYPE_PREFIX "replay_"
+
+/// A module of the recording that is recreated by the replay.
+typedef struct {
+    /// points into the recording
+    char *name;
+    char *type;
+    int number_of_channels;
+    /// public module_id of the recreated module
+    int module_id;
+} replayed_module;
+
+/// Instance data of the replay module.
+typedef struct {
+    int module_id;
+    double speed;
+    /// the whole recording mapped into the memory
+    uint8_t *recording;
+    long long recording_size;
+    recording_file_header *header;
+    /// name -> replayed_module
+    GHashTable *modules_by_name;
+    pthread_t thread;
+    int thread_started;
+    volatile int stop;
+    volatile int finished;
+    atomic_long messages;
+    atomic_llong bytes;
+    /// monotonic_usec() when the first message was posted, and when the last one was delivered (or posted)
+    long long start_time;
+    long long end_time;
+} mato_replay;
+
+#endif
@@ -0,0 +1,261 @@
+/// \file mato_requests.c
+/// Implementation of the Mato control framework - requests for the data of the remote modules.
+
+#include "mato_requests.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// A module waiting for the response to a request: a thread sleeping in request_remote_data(), or a callback.
+typedef struct {
+    get_data_callback callback;
+    void *context;
+    /// set when the response for the sleeping thread has arrived, with its copy of the data
+    int done;
+    int data_length;
+    uint8_t *data;
+} request_waiter;
+
+/// A request sent to a remote node that waits for the response.
+typedef struct {
+    int32_t request_id;
+    int node_id;
+    int module_id;
+    int channel;
+    /// of request_waiter *
+    GList *waiters;
+} data_request;
+
+/// A response kept for the next requests of the same channel.
+typedef struct {
+    int node_id;
+    int module_id;
+    int channel;
+    long long time;
+    int data_length;
+    uint8_t *data;
+} cached_response;
+
+/// Protects the requests and the cache, the sleeping threads wait for the request_completed condition.
+static pthread_mutex_t requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t request_completed = PTHREAD_COND_INITIALIZER;
+
+/// of data_request *, there are only a few requests waiting at the same time
+static GArray *requests;
+/// of cached_response
+static GArray *cache;
+static int32_t next_request_id;
+
+static uint8_t *copy_of_data(int data_length, uint8_t *data)
+{
+    if (data == 0) return 0;
+    uint8_t *copy = (uint8_t *)malloc(data_length);
+    memcpy(copy, data, data_length);
+    return copy;
+}
+
+/// Remove the cached responses that have expired, or all responses of the node if node_id is not -1. Requests must be locked.
+static void prune_cache(long long now, int node_id)
+{
+    for (int i = cache->len - 1; i >= 0; i--)
+    {
+        cached_response *cr = &g_array_index(cache, cached_response, i);
+        if ((now - cr->time > mato_core_config.get_data_cache_ttl) || (cr->node_id == node_id))
+        {
+            free(cr->data);
+            g_array_remove_index_fast(cache, i);
+        }
+    }
+}
+
+/// Returns a cached response for the channel that has not expired yet, or 0. Requests must be locked.
+static cached_response *find_cached_response(int node_id, int module_id, int channel)
+{
+    if (cache == 0) return 0;
+    prune_cache(monotonic_usec(), -1);
+    for (int i = 0; i < cache->len; i++)
+    {
+        cached_response *cr = &g_array_index(cache, cached_response, i);
+        if ((cr->node_id == node_id) && (cr->module_id == module_id) && (cr->channel == channel))
+            return cr;
+    }
+    return 0;
+}
+
+/// Keep the response, the data is taken over. Requests must be locked.
+static void cache_response(data_request *request, int data_length, uint8_t *data)
+{
+    cached_response *cr = find_cached_response(request->node_id, request->module_id, request->channel);
+    if (cr) free(cr->data);
+    else
+    {
+        cached_response empty;
+        g_array_append_val(cache, empty);
+        cr = &g_array_index(cache, cached_response, cache->len - 1);
+        cr->node_id = request->node_id;
+        cr->module_id = request->module_id;
+        cr->channel = request->channel;
+    }
+    cr->time = monotonic_usec();
+    cr->data_length = data_length;
+    cr->data = data;
+}
+
+/// Returns the index of the request with the id, or -1. Requests must be locked.
+static int find_request(int32_t request_id)
+{
+    for (int i = 0; i < requests->len; i++)
+        if (g_array_index(requests, data_request *, i)->request_id == request_id)
+            return i;
+    return -1;
+}
+
+/// Add the waiter to the request for the channel that has already been sent, or to a new one. Returns the new request that
+/// should be sent, or 0. Requests must be locked.
+static data_request *join_request(int node_id, int module_id, int channel, request_waiter *waiter)
+{
+    if (requests == 0)
+    {
+        requests = g_array_new(0, 0, sizeof(data_request *));
+        cache = g_array_new(0, 0, sizeof(cached_response));
+    }
+    for (int i = 0; i < requests->len; i++)
+    {
+        data_request *request = g_array_index(requests, data_request *, i);
+        if ((request->node_id == node_id) && (request->module_id == module_id) && (request->channel == channel))
+        {
+            request->waiters = g_list_append(request->waiters, waiter);
+            return 0;
+        }
+    }
+    data_request *request = (data_request *)malloc(sizeof(data_request));
+    request->request_id = next_request_id++;
+    request->node_id = node_id;
+    request->module_id = module_id;
+    request->channel = channel;
+    request->waiters = g_list_append(0, waiter);
+    g_array_append_val(requests, request);
+    return request;
+}
+
+/// Remove the request from the table and pass the data to its waiters: the sleeping threads are woken up, the callbacks
+/// are called without the requests locked. The data is taken over.
+static void complete_request(int index, int data_length, uint8_t *data)
+{
+    data_request *request = g_array_index(requests, data_request *, index);
+    g_array_remove_index_fast(requests, index);
+    GList *callbacks = 0;
+    for (GList *w = request->waiters; w; w = w->next)
+    {
+        request_waiter *waiter = (request_waiter *)w->data;
+        waiter->data_length = data ? data_length : 0;
+        waiter->data = copy_of_data(data_length, data);
+        if (waiter->callback) callbacks = g_list_append(callbacks, waiter);
+        else waiter->done = 1;
+    }
+    if (data && (mato_core_config.get_data_cache_ttl > 0)) cache_response(request, data_length, data);
+    else free(data);
+    pthread_cond_broadcast(&request_completed);
+    pthread_mutex_unlock(&requests_lock);
+
+    for (GList *w = callbacks; w; w = w->next)
+    {
+        request_waiter *waiter = (request_waiter *)w->data;
+        waiter->callback(waiter->context, request->node_id * NODE_MULTIPLIER + request->module_id, request->channel,
+                         waiter->data_length, waiter->data);
+        free(waiter);
+    }
+    g_list_free(callbacks);
+    g_list_free(request->waiters);
+    free(request);
+    pthread_mutex_lock(&requests_lock);
+}
+
+/// Join or send the request for the waiter. Returns 0 if the node is not connected.
+static int send_request(int node_id, int module_id, int channel, request_waiter *waiter)
+{
+    if (!g_array_index(nodes, node_info *, node_id)->is_online) return 0;
+    data_request *request = join_request(node_id, module_id, channel, waiter);
+    if (request)
+    {
+        int32_t request_id = request->request_id;
+        pthread_mutex_unlock(&requests_lock);
+            net_send_get_data(node_id, module_id, channel, request_id);
+        pthread_mutex_lock(&requests_lock);
+    }
+    return 1;
+}
+
+void request_remote_data(int node_id, int module_id, int channel, int *data_length, uint8_t **data)
+{
+    *data_length = 0;
+    *data = 0;
+    pthread_mutex_lock(&requests_lock);
+        cached_response *cr = find_cached_response(node_id, module_id, channel);
+        if (cr)
+        {
+            *data_length = cr->data_length;
+            *data = copy_of_data(cr->data_length, cr->data);
+        }
+        else
+        {
+            request_waiter waiter;
+            memset(&waiter, 0, sizeof(request_waiter));
+            if (send_request(node_id, module_id, channel, &waiter))
+            {
+                while (!waiter.done)
+                    pthread_cond_wait(&request_completed, &requests_lock);
+                *data_length = waiter.data_length;
+                *data = waiter.data;
+            }
+        }
+    pthread_mutex_unlock(&requests_lock);
+}
+
+void request_remote_data_async(int node_id, int module_id, int channel, get_data_callback callback, void *context)
+{
+    int data_length = 0;
+    uint8_t *data = 0;
+    pthread_mutex_lock(&requests_lock);
+        cached_response *cr = find_cached_response(node_id, module_id, channel);
+        if (cr)
+        {
+            data_length = cr->data_length;
+            data = copy_of_data(cr->data_length, cr->data);
+        }
+        else
+        {
+            request_waiter *waiter = (request_waiter *)calloc(1, sizeof(request_waiter));
+            waiter->callback = callback;
+            waiter->context = context;
+            if (send_request(node_id, module_id, channel, waiter))
+            {
+                pthread_mutex_unlock(&requests_lock);
+                return;
+            }
+            free(waiter);
+        }
+    pthread_mutex_unlock(&requests_lock);
+    callback(context, node_id * NODE_MULTIPLIER + module_id, channel, data_length, data);
+}
+
+void return_data_to_waiting_module(int request_id, int data_length, uint8_t *data)
+{
+    pthread_mutex_lock(&requests_lock);
+        int index = requests ? find_request(request_id) : -1;
+        if (index >= 0) complete_request(index, data_length, data);
+        else free(data);
+    pthread_mutex_unlock(&requests_lock);
+}
+
+void remote_requests_node_disconnected(int node_id)
+{
+    pthread_mutex_lock(&requests_lock);
+        if (requests)
+        {
+            for (int i = requests->len - 1; i >= 0; i--)
+                if ((i < requests->len) && (g_array_index(requests, data_request *, i)->node_id == node_id))
+                    complete_request(i, 0, 0);
+            prune_cache(monotonic_usec(), node_id);
+        }
+    pthread_mutex_unlock(&requests_lock);
+}
@@ -0,0 +1,29 @@
+#ifndef __MATO_REQUESTS_H__
+#define __MATO_REQUESTS_H__
+
+/// \file mato_requests.h
+/// Mato control framework - requests for the data of the remote modules that no module of this node is subscribed to
+/// (see mato_get_data() and mato_get_data_async()). Each request waiting for the response of the other node is kept
+/// in a table under its request_id, that travels in the MSG_GET_DATA and MSG_DATA messages. Concurrent requests for the same
+/// channel wait for a single response, and the responses are cached for get_data_cache_ttl microseconds (see mato_config_structure),
+/// so that a module polling a remote channel does not send a request for each call.
+
+#include "mato_core.h"
+
+/// Retrieve a copy of the latest message of a channel of a remote module from its node (or from the cache), the caller
+/// must free() it. Sleeps until the response arrives, must be called without the framework locked. The data is 0 if the module
+/// has not posted anything yet, or the node is not connected.
+void request_remote_data(int node_id, int module_id, int channel, int *data_length, uint8_t **data);
+
+/// The same as request_remote_data(), but returns immediately, the callback is called with the data later
+/// (or right away if the response is cached).
+void request_remote_data_async(int node_id, int module_id, int channel, get_data_callback callback, void *context);
+
+/// The remote node has sent the data requested by the request, pass it to the waiting modules. The data was allocated
+/// by malloc() (or is 0), it is taken over by the function. Called by the networking thread.
+void return_data_to_waiting_module(int request_id, int data_length, uint8_t *data);
+
+/// The node has disconnected: the requests waiting for its responses receive no data, and its cached responses are dropped.
+void remote_requests_node_disconnected(int node_id);
+
+#endif
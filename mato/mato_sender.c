@@ -0,0 +1,132 @@
+/// \file mato_sender.c
+/// Implementation of the Mato control framework - asynchronous sending of the subscribed data to the other nodes.
+
+#include "mato_sender.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// The send queue of a remote node and its thread.
+typedef struct {
+    int node_id;
+    mato_queue *queue;
+} node_sender;
+
+/// [node_id], the sender of this node is not used
+static node_sender *senders;
+static int number_of_senders;
+
+/// Releases a message that was dropped from a send queue, called with the framework locked for reading.
+static void drop_sent_data(void *item)
+{
+    release_channel_data((channel_data *)item);
+    delivery_finished();
+}
+
+/// Send the batch of messages to the node if it is online, and release them.
+static void flush_batch(node_sender *sender, net_batch *batch, GArray *batched)
+{
+    // the messages that were waiting when the node disconnected or the framework is shutting down are only released
+    if (program_runs && g_array_index(nodes, node_info *, sender->node_id)->is_online)
+        net_send_batch(sender->node_id, batch);
+    batch->number_of_parts = 0;
+    batch->length = 0;
+    batch->number_of_messages = 0;
+    lock_framework_read();
+        for (int i = 0; i < batched->len; i++)
+            release_channel_data(g_array_index(batched, channel_data *, i));
+    unlock_framework();
+    for (int i = 0; i < batched->len; i++)
+        delivery_finished();
+    g_array_set_size(batched, 0);
+}
+
+/// The thread that writes the messages of the send queue of a node to its socket. The messages are collected into a batch
+/// until the queue is empty (or for at most node_send_batch_latency microseconds since the first one, if configured),
+/// or until the batch would exceed node_send_batch_size bytes, then the whole batch is sent at once. Larger messages
+/// are sent alone. The messages are sent with the headers encoded in them when they were stored
+/// (see net_encode_subscribed_data()), so the work for each subscribed node is only the writing.
+static void *sender_thread(void *arg)
+{
+    node_sender *sender = (node_sender *)arg;
+    char thread_name[MAX_THREAD_NAME_LENGTH + 1];
+    sprintf(thread_name, "send%d", sender->node_id);
+    mato_inc_system_thread_count(thread_name);
+
+    // the messages in the batch are not copied, the sender keeps their references until the batch is sent
+    net_batch batch;
+    memset(&batch, 0, sizeof(net_batch));
+    // of channel_data *, the messages in the batch
+    GArray *batched = g_array_new(0, 0, sizeof(channel_data *));
+    long long batch_start = 0;
+
+    channel_data *cd = (channel_data *)mato_queue_pop(sender->queue);
+    while (cd)
+    {
+        if ((batched->len > 0) && ((batch.length + net_batch_subscribed_data_size(cd) > mato_core_config.node_send_batch_size) ||
+                                   (batch.number_of_messages == NET_BATCH_MAX_MESSAGES)))
+            flush_batch(sender, &batch, batched);
+        if (batched->len == 0) batch_start = monotonic_usec();
+        net_batch_subscribed_data(&batch, cd);
+        g_array_append_val(batched, cd);
+        // a large message is sent alone
+        if (batch.length >= mato_core_config.node_send_batch_size)
+            flush_batch(sender, &batch, batched);
+
+        if (batched->len == 0)
+            cd = (channel_data *)mato_queue_pop(sender->queue);
+        else
+        {
+            long wait = mato_core_config.node_send_batch_latency - (monotonic_usec() - batch_start);
+            cd = (channel_data *)((wait > 0) ? mato_queue_pop_timeout(sender->queue, wait) : mato_queue_try_pop(sender->queue));
+            if (cd == 0)
+            {
+                flush_batch(sender, &batch, batched);
+                cd = (channel_data *)mato_queue_pop(sender->queue);
+            }
+        }
+    }
+    g_array_free(batched, 1);
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+void senders_init()
+{
+    number_of_senders = nodes->len;
+    senders = (node_sender *)calloc(number_of_senders, sizeof(node_sender));
+    for (int node_id = 0; node_id < number_of_senders; node_id++)
+    {
+        if (node_id == this_node_id) continue;
+        node_sender *sender = &senders[node_id];
+        sender->node_id = node_id;
+        sender->queue = mato_queue_new(mato_core_config.node_send_queue_capacity, mato_queue_drop_oldest, drop_sent_data);
+        pthread_t t;
+        if (pthread_create(&t, 0, sender_thread, sender) != 0)
+            mato_log_val(ML_ERR, "could not create sender thread for node", node_id);
+    }
+}
+
+void senders_shutdown()
+{
+    // the queues themselves are not released, the core thread may still be sending the last messages to the closed queues
+    for (int node_id = 0; node_id < number_of_senders; node_id++)
+        if (senders[node_id].queue) mato_queue_close(senders[node_id].queue);
+}
+
+void sender_enqueue(int node_id, channel_data *cd)
+{
+    channel_buffers *cb = get_channel_buffers(cd->node_id, cd->module_id, cd->channel_id);
+    int drop_oldest = cb ? (cb->send_drop_policy == send_drop_oldest) : 1;
+    cd->references++;
+    delivery_started();
+    mato_queue_push_nowait(senders[node_id].queue, CHANNEL_KEY(cd->node_id, cd->module_id, cd->channel_id), cd, drop_oldest);
+}
+
+void sender_queue_usage(int node_id, int *waiting, long *dropped)
+{
+    *waiting = 0;
+    *dropped = 0;
+    if ((node_id >= number_of_senders) || (senders[node_id].queue == 0)) return;
+    *waiting = mato_queue_length(senders[node_id].queue);
+    *dropped = mato_queue_dropped(senders[node_id].queue);
+}
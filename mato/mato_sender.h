@@ -0,0 +1,32 @@
+#ifndef __MATO_SENDER_H__
+#define __MATO_SENDER_H__
+
+/// \file mato_sender.h
+/// Mato control framework - asynchronous sending of the subscribed data to the other nodes. Each remote node has its own
+/// bounded send queue of messages (each holding a reference of its channel_data) and a sender thread that writes them
+/// to the socket of the node, so that the core thread and the dispatch workers do not wait for the network to send the data:
+/// a congested node only fills its own queue. The other messages to the nodes are written right away, some of them with
+/// the framework locked, a node that stops receiving holds them up for at most NODE_SEND_TIMEOUT seconds before it gets
+/// disconnected (see net_send_parts()). When the queue is full, either the oldest waiting message of the same channel,
+/// or the new message is dropped, depending on the policy of the channel (see mato_set_node_send_policy()).
+/// The small messages that are waiting in the queue are sent in batches (see net_send_batch()) to lower the number of packets
+/// on the network. By default, the batch is sent as soon as the queue is empty, the sender can also wait for the next messages
+/// for up to node_send_batch_latency microseconds (see mato_config_structure).
+
+#include "mato_core.h"
+#include "mato_queue.h"
+
+/// Create the send queues and start the sender threads of all remote nodes.
+void senders_init();
+
+/// Close the send queues, the sender threads release the remaining messages and terminate.
+void senders_shutdown();
+
+/// Append a message for a remote node to its send queue, it takes one more reference of the message. Never waits.
+/// Must be called with the framework locked for reading (by a thread that holds a reference of the message).
+void sender_enqueue(int node_id, channel_data *cd);
+
+/// Retrieve the number of messages waiting in the send queue of the node and the number of messages dropped since the start.
+void sender_queue_usage(int node_id, int *waiting, long *dropped);
+
+#endif
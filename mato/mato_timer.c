@@ -0,0 +1,407 @@
+/// \file mato_timer.c
+/// Implementation of the Mato control framework - timers of the modules driven by a hierarchical timer wheel.
+/// Lock ordering: the framework lock is always taken before the timers lock, the dispatch lock is never held together with it.
+
+#include <sys/timerfd.h>
+
+#include "mato_timer.h"
+#include "mato_dispatch.h"
+#include "mato_net.h"
+#include "mato_logs.h"
+
+/// Protects the wheel, the timers table and the scheduled fields of all timers.
+static pthread_mutex_t timers_mutex;
+
+/// All timers that have not been removed.
+static GHashTable *timers;   // [timer_id] -> mato_timer
+
+static int next_free_timer_id;
+
+/// The slots are doubly-linked lists of timers, see mato_timer.h.
+static mato_timer *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static int timers_in_wheel;
+
+/// The ticks are counted from wheel_start_time, all timers of the ticks before current_tick have been expired.
+static long long wheel_start_time;
+static long long current_tick;
+
+static int timer_fd;
+
+/// monotonic_usec() the timer_fd is armed for, 0 if it is not armed.
+static long long armed_for;
+
+static volatile int timers_run;
+
+static long long tick_of(long long time)
+{
+    if (time < wheel_start_time) return 0;
+    return (time - wheel_start_time) / TIMER_TICK_USEC;
+}
+
+static void release_timer(mato_timer *t)
+{
+    if (atomic_fetch_sub(&t->references, 1) == 1)
+        free(t);
+}
+
+/// Add the timer to the slot of the lowest level that reaches its expiration. Timers that expire later than the highest
+/// level reaches are added to its farthest slot, and they are cascaded down from there until they expire.
+static void wheel_insert(mato_timer *t)
+{
+    long long tick = tick_of(t->expires);
+    if (tick < current_tick) tick = current_tick;
+    long long delta = tick - current_tick;
+    if (delta >= (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)))
+    {
+        delta = (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+        tick = current_tick + delta;
+    }
+    int level = 0;
+    while ((level < TIMER_WHEEL_LEVELS - 1) && (delta >= (1LL << (TIMER_WHEEL_BITS * (level + 1)))))
+        level++;
+
+    mato_timer **slot = &wheel[level][(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    t->slot = slot;
+    t->prev = 0;
+    t->next = *slot;
+    if (*slot) (*slot)->prev = t;
+    *slot = t;
+    timers_in_wheel++;
+}
+
+static void wheel_unlink(mato_timer *t)
+{
+    if (t->slot == 0) return;
+    if (t->prev) t->prev->next = t->next;
+    else *(t->slot) = t->next;
+    if (t->next) t->next->prev = t->prev;
+    t->slot = 0;
+    t->prev = t->next = 0;
+    timers_in_wheel--;
+}
+
+/// Move the timers of the slots of the higher levels that start at the current tick down to the lower levels.
+static void cascade()
+{
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        if (current_tick & ((1LL << (TIMER_WHEEL_BITS * level)) - 1)) break;
+        mato_timer **slot = &wheel[level][(current_tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+        mato_timer *t = *slot;
+        *slot = 0;
+        while (t)
+        {
+            mato_timer *next = t->next;
+            t->slot = 0;
+            timers_in_wheel--;
+            wheel_insert(t);
+            t = next;
+        }
+    }
+}
+
+/// The timer has expired: schedule its callback, unless the previous one is still waiting or running, and add
+/// a periodic timer back to the wheel. The scheduled timers are prepended to the list, each holds a reference.
+static void expire_timer(mato_timer *t, long long now, mato_timer **to_fire)
+{
+    wheel_unlink(t);
+    if (t->scheduled)
+        atomic_fetch_add(&t->missed, 1);
+    else
+    {
+        t->scheduled = 1;
+        t->due = t->expires;
+        atomic_fetch_add(&t->references, 1);
+        t->fire_next = *to_fire;
+        *to_fire = t;
+    }
+
+    // a one-shot timer stays in the timers table until its callback has been called, so that it can still be removed
+    if (t->period > 0)
+    {
+        long long skipped = (now - t->expires) / t->period;
+        if (skipped < 0) skipped = 0;
+        if (skipped > 0) atomic_fetch_add(&t->missed, skipped);
+        t->expires += (skipped + 1) * t->period;
+        wheel_insert(t);
+    }
+}
+
+/// Advance the wheel to the current time and collect the expired timers. The timers lock must be held.
+static void expire_timers(long long now, mato_timer **to_fire)
+{
+    long long now_tick = tick_of(now);
+    if (timers_in_wheel == 0)
+    {
+        if (current_tick < now_tick) current_tick = now_tick;
+        return;
+    }
+
+    while (current_tick < now_tick)
+    {
+        mato_timer *t = wheel[0][current_tick & (TIMER_WHEEL_SLOTS - 1)];
+        while (t)
+        {
+            mato_timer *next = t->next;
+            expire_timer(t, now, to_fire);
+            t = next;
+        }
+        current_tick++;
+        cascade();
+    }
+
+    // the expirations of the current tick that have not come yet stay in the slot, the expired periodic timers
+    // that return to the same slot are prepended to it, so they are not visited again by this walk
+    mato_timer *t = wheel[0][current_tick & (TIMER_WHEEL_SLOTS - 1)];
+    while (t)
+    {
+        mato_timer *next = t->next;
+        if (t->expires <= now) expire_timer(t, now, to_fire);
+        t = next;
+    }
+}
+
+/// Arm the timer_fd for the earliest expiration in the nearest non-empty slot of the first level before the next cascade,
+/// or for the next cascade, or disarm it if there are no timers. The timers lock must be held.
+static void arm_timer_fd()
+{
+    long long wake = 0;
+    if (timers_in_wheel > 0)
+    {
+        long long next_cascade = (current_tick | (TIMER_WHEEL_SLOTS - 1)) + 1;
+        for (long long tick = current_tick; (tick < next_cascade) && (wake == 0); tick++)
+            for (mato_timer *t = wheel[0][tick & (TIMER_WHEEL_SLOTS - 1)]; t; t = t->next)
+                if ((wake == 0) || (t->expires < wake)) wake = t->expires;
+        if (wake == 0) wake = wheel_start_time + next_cascade * TIMER_TICK_USEC;
+    }
+    if (wake == armed_for) return;
+    armed_for = wake;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(struct itimerspec));
+    if (wake)
+    {
+        its.it_value.tv_sec = wake / 1000000L;
+        its.it_value.tv_nsec = (wake % 1000000L) * 1000L;
+        if ((its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0)) its.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, 0) < 0)
+        perror("mato:timers timerfd_settime");
+}
+
+void fire_timer(mato_timer *t)
+{
+    lock_framework_read();
+        // removed is set with the framework locked for writing when the module is deleted
+        int alive = !t->removed;
+        void *data = alive ? g_array_index(instance_data, void *, t->module_id) : 0;
+    unlock_framework();
+    if (!alive) return;
+
+    latency_histogram_record(&t->jitter, monotonic_usec() - t->due);
+    atomic_fetch_add(&t->expirations, 1);
+    t->callback(data, t->timer_id);
+}
+
+/// Remove the timer from the wheel and from the timers table. The timers lock must be held.
+static void remove_timer(mato_timer *t)
+{
+    wheel_unlink(t);
+    t->removed = 1;
+    g_hash_table_remove(timers, GINT_TO_POINTER(t->timer_id));
+    release_timer(t);
+}
+
+void timer_fired(mato_timer *t)
+{
+    pthread_mutex_lock(&timers_mutex);
+        t->scheduled = 0;
+        if ((t->period == 0) && !t->removed) remove_timer(t);
+    pthread_mutex_unlock(&timers_mutex);
+    release_timer(t);
+}
+
+static void *timer_thread(void *arg)
+{
+    mato_inc_system_thread_count("timers");
+    while (timers_run)
+    {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(uint64_t)) < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("mato:timers read");
+            break;
+        }
+        if (!timers_run) break;
+
+        mato_timer *to_fire = 0;
+        pthread_mutex_lock(&timers_mutex);
+            armed_for = 0;
+            expire_timers(monotonic_usec(), &to_fire);
+            arm_timer_fd();
+        pthread_mutex_unlock(&timers_mutex);
+
+        while (to_fire)
+        {
+            mato_timer *t = to_fire;
+            to_fire = t->fire_next;
+            if (dispatch_workers() > 0)
+                dispatch_timer(t);
+            else
+            {
+                fire_timer(t);
+                timer_fired(t);
+            }
+        }
+    }
+    mato_dec_system_thread_count();
+    return 0;
+}
+
+void timers_init()
+{
+    pthread_mutex_init(&timers_mutex, 0);
+    timers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    next_free_timer_id = 0;
+    memset(wheel, 0, sizeof(wheel));
+    timers_in_wheel = 0;
+    wheel_start_time = monotonic_usec();
+    current_tick = 0;
+    armed_for = 0;
+    timers_run = 1;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd < 0)
+    {
+        perror("mato:timers timerfd_create");
+        return;
+    }
+    pthread_t t;
+    if (pthread_create(&t, 0, timer_thread, 0) != 0)
+        perror("could not create thread for timers");
+}
+
+void timers_shutdown()
+{
+    timers_run = 0;
+    struct itimerspec its;
+    memset(&its, 0, sizeof(struct itimerspec));
+    its.it_value.tv_nsec = 1;
+    pthread_mutex_lock(&timers_mutex);
+        if (timerfd_settime(timer_fd, 0, &its, 0) < 0)
+            perror("mato:timers timerfd_settime");
+    pthread_mutex_unlock(&timers_mutex);
+}
+
+void timers_remove_module(int module_id)
+{
+    GArray *removed = g_array_new(0, 0, sizeof(mato_timer *));
+    pthread_mutex_lock(&timers_mutex);
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, timers);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+            if (((mato_timer *)value)->module_id == module_id)
+                g_array_append_val(removed, value);
+        for (int i = 0; i < removed->len; i++)
+            remove_timer(g_array_index(removed, mato_timer *, i));
+        arm_timer_fd();
+    pthread_mutex_unlock(&timers_mutex);
+    g_array_free(removed, 1);
+}
+
+static int add_timer(int module_id, long long period, long long delay, timer_callback callback)
+{
+    int node_id = module_id / NODE_MULTIPLIER;
+    module_id %= NODE_MULTIPLIER;
+    if ((node_id != this_node_id) || (delay < 0) || (callback == 0)) return -1;
+
+    mato_timer *t = (mato_timer *)calloc(1, sizeof(mato_timer));
+    t->module_id = module_id;
+    t->callback = callback;
+    t->period = period;
+    atomic_init(&t->removed, 0);
+    atomic_init(&t->references, 1);
+    atomic_init(&t->expirations, 0);
+    atomic_init(&t->missed, 0);
+    latency_histogram_init(&t->jitter);
+
+    lock_framework_read();
+        if ((module_id >= instance_specifications->len) ||
+            (g_array_index(instance_specifications, module_specification *, module_id) == 0))
+        {
+            unlock_framework();
+            free(t);
+            return -1;
+        }
+        pthread_mutex_lock(&timers_mutex);
+            t->timer_id = next_free_timer_id++;
+            g_hash_table_insert(timers, GINT_TO_POINTER(t->timer_id), t);
+            long long now = monotonic_usec();
+            if (timers_in_wheel == 0) current_tick = tick_of(now);
+            t->expires = now + delay;
+            wheel_insert(t);
+            arm_timer_fd();
+        pthread_mutex_unlock(&timers_mutex);
+    unlock_framework();
+    return t->timer_id;
+}
+
+int mato_add_timer(int module_id, long period_usec, timer_callback callback)
+{
+    if (period_usec <= 0) return -1;
+    return add_timer(module_id, period_usec, period_usec, callback);
+}
+
+int mato_add_one_shot_timer(int module_id, long delay_usec, timer_callback callback)
+{
+    return add_timer(module_id, 0, delay_usec, callback);
+}
+
+int mato_align_timer(int timer_id, long long reference_time)
+{
+    int found = 0;
+    pthread_mutex_lock(&timers_mutex);
+        mato_timer *t = (mato_timer *)g_hash_table_lookup(timers, GINT_TO_POINTER(timer_id));
+        if (t && (t->period > 0))
+        {
+            // the first expiration after now that is a whole number of periods from the reference time
+            long long now = monotonic_usec();
+            long long periods = (now - reference_time) / t->period;
+            if (reference_time + periods * t->period <= now) periods++;
+            wheel_unlink(t);
+            t->expires = reference_time + periods * t->period;
+            wheel_insert(t);
+            arm_timer_fd();
+            found = 1;
+        }
+    pthread_mutex_unlock(&timers_mutex);
+    return found;
+}
+
+void mato_remove_timer(int timer_id)
+{
+    pthread_mutex_lock(&timers_mutex);
+        mato_timer *t = (mato_timer *)g_hash_table_lookup(timers, GINT_TO_POINTER(timer_id));
+        if (t)
+        {
+            remove_timer(t);
+            arm_timer_fd();
+        }
+    pthread_mutex_unlock(&timers_mutex);
+}
+
+int mato_get_timer_stats(int timer_id, mato_timer_stats *stats)
+{
+    pthread_mutex_lock(&timers_mutex);
+        mato_timer *t = (mato_timer *)g_hash_table_lookup(timers, GINT_TO_POINTER(timer_id));
+        if (t)
+        {
+            stats->expirations = atomic_load(&t->expirations);
+            stats->missed = atomic_load(&t->missed);
+            latency_histogram_summary(&t->jitter, &stats->jitter);
+        }
+    pthread_mutex_unlock(&timers_mutex);
+    return t != 0;
+}
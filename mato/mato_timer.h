@@ -0,0 +1,66 @@
+#ifndef __MATO_TIMER_H__
+#define __MATO_TIMER_H__
+
+/// \file mato_timer.h
+/// Mato control framework - timers of the modules (see mato_add_timer()).
+/// All timers are kept in a hierarchical timer wheel: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots, the slots of the first
+/// level are single ticks of TIMER_TICK_USEC, the slots of each next level are TIMER_WHEEL_SLOTS times longer. A timer is added
+/// to the slot of the lowest level that still reaches its expiration, and whenever the first level wraps around, the timers of the
+/// next slot of the higher level are moved (cascaded) down. Adding and removing a timer is O(1) regardless of the number of timers.
+/// A single timer thread sleeps on a timerfd that is armed for the earliest expiration of the timers in the nearest slot
+/// (or for the next cascade), so the timers expire exactly at their time, not rounded to the ticks, and the thread does not
+/// wake up when there are no timers.
+
+#include "mato_core.h"
+
+#define TIMER_TICK_USEC 1000
+#define TIMER_WHEEL_SLOTS 64
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct mato_timer_struct {
+    int timer_id;
+    /// local module_id of the module that owns the timer
+    int module_id;
+    timer_callback callback;
+    /// 0 for one-shot timers
+    long long period;
+    /// the next expiration (monotonic_usec())
+    long long expires;
+    /// expiration time of the callback that has been scheduled, or is running now
+    long long due;
+    /// in the wheel: the slot list and the neighbours in it (0 when the timer is not in the wheel)
+    struct mato_timer_struct **slot;
+    struct mato_timer_struct *prev;
+    struct mato_timer_struct *next;
+    /// the next timer in the list of the timers expired at once
+    struct mato_timer_struct *fire_next;
+    /// the callback is waiting for a dispatch worker, or running now (the next expirations are skipped meanwhile)
+    int scheduled;
+    /// the timer has been removed, its callback is not called anymore
+    atomic_int removed;
+    /// held by the timers structure, and by the thread that calls the callback while it is scheduled
+    atomic_int references;
+    atomic_long expirations;
+    atomic_long missed;
+    latency_histogram jitter;
+} mato_timer;
+
+/// Start the timer thread.
+void timers_init();
+
+/// Stop the timer thread, the timers are not released.
+void timers_shutdown();
+
+/// Remove all timers of the local module. Must be called with the framework locked for writing.
+void timers_remove_module(int module_id);
+
+/// Call the callback of a timer that has expired, unless it has been removed meanwhile. Called by the timer thread,
+/// or by a dispatch worker (see dispatch_timer()), must be called without the framework locked.
+void fire_timer(mato_timer *t);
+
+/// The scheduled callback of the timer has finished (or it was not called at all): the timer can expire again
+/// (a one-shot timer is removed), and the reference taken for the callback is returned.
+void timer_fired(mato_timer *t);
+
+#endif
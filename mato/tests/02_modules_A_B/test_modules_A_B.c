@@ -49,6 +49,9 @@ int main(int argc, char **argv)
 	   
     print_list_of_modules();
 
+    // the modules are started in parallel, but B2 only after A1 has started
+    mato_add_start_dependency(b2, a1);
+
     printf("starting...\n");
     mato_start();
 
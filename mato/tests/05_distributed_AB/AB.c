@@ -125,7 +125,7 @@ void *module_AB_msg_eating_thread(void *arg)
     {
         int *val_ptr;
         int rv = read(data->msg_queue[0], &val_ptr, sizeof(void *));
-        if (rv == -1) break;
+        if (rv <= 0) break;
         int val = *val_ptr;
         time(&tm);
         printf("%u %c(%d) retrieves message %d from queue\n", (unsigned int)(tm - tm0), data->type, data->module_id, val);
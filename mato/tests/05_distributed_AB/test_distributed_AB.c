@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <unistd.h>
 
@@ -26,6 +27,27 @@ void print_list_of_modules()
         mato_free_list_of_modules(modules_list);
 }
 
+void print_remote_data(void *context, int module_id, int channel, int data_length, void *data)
+{
+    if (data) printf("%s: module %d posted %d last\n", (char *)context, module_id, *((int *)data));
+    else printf("%s: module %d has not posted yet\n", (char *)context, module_id);
+    free(data);
+}
+
+void read_remote_data(int this_node_id)
+{
+    // no module of this node subscribes to the modules of the node before it, their data are requested over the network
+    char module_name[8];
+    sprintf(module_name, "n%d_A0", (this_node_id + 2) % 3);
+    int module_id = mato_get_module_id(module_name);
+
+    int data_length;
+    void *data;
+    mato_get_data(module_id, 0, &data_length, &data);
+    print_remote_data("get_data", module_id, 0, data_length, data);
+    mato_get_data_async(module_id, 0, print_remote_data, "get_data_async");
+}
+
 int main(int argc, char **argv)
 {
     int this_node_id = 0;
@@ -68,6 +90,7 @@ int main(int argc, char **argv)
 
         printf("main loop...\n");
         sleep(2);
+        read_remote_data(this_node_id);
         while (program_runs && (mato_threads_running() > 0)) sleep(1);
 
         printf("deleting instances...\n");
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../../mato.h"
+#include "bench.h"
+
+int bench_seconds;
+
+atomic_long posted_messages;
+atomic_long delivered_messages;
+atomic_long borrowed_and_released;
+atomic_long polled_into;
+
+typedef struct {
+           int module_id;
+           int subscription_id;
+        } module_bench_instance_data;
+
+static module_bench_instance_data *readers[MAX_READERS];
+static int number_of_readers;
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+void *bench_create_instance(int module_id)
+{
+    module_bench_instance_data *data = (module_bench_instance_data *)malloc(sizeof(module_bench_instance_data));
+    data->module_id = module_id;
+    return data;
+}
+
+/// The producer posts small messages to its channel as fast as it can.
+void *module_P_thread(void *arg)
+{
+    module_bench_instance_data *data = (module_bench_instance_data *)arg;
+    double end = now() + bench_seconds;
+    while (program_runs && (now() < end))
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            int *val = (int *)mato_get_data_buffer(sizeof(int));
+            *val = i;
+            mato_post_data(data->module_id, 0, sizeof(int), val);
+        }
+        atomic_fetch_add(&posted_messages, 100);
+    }
+    return 0;
+}
+
+/// The reader keeps borrowing and releasing the last message of its own channel,
+/// i.e. a channel unrelated to the one that is being dispatched, and polling
+/// the last message of the producer into its own buffer.
+void *module_R_thread(void *arg)
+{
+    module_bench_instance_data *data = (module_bench_instance_data *)arg;
+    double end = now() + bench_seconds;
+    long count = 0;
+    long polled = 0;
+    int producer = mato_get_module_id("P1");
+    while (program_runs && (now() < end))
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            int length;
+            void *ptr;
+            mato_borrow_data(data->module_id, 0, &length, &ptr);
+            if (ptr) mato_release_data(data->module_id, 0, ptr);
+        }
+        count += 100;
+        for (int i = 0; i < 100; i++)
+        {
+            int val;
+            if (mato_get_data_into(producer, 0, &val, sizeof(int)) == sizeof(int)) polled++;
+        }
+    }
+    atomic_fetch_add(&borrowed_and_released, count);
+    atomic_fetch_add(&polled_into, polled);
+    return 0;
+}
+
+/// Each reader is subscribed to the producer, the callback is short, but not empty.
+void message_from_producer(void *instance_data, int sender_module_id, int data_length, void *new_data_ptr)
+{
+    volatile int sum = 0;
+    for (int i = 0; i < 200; i++) sum += *(int *)new_data_ptr + i;
+    atomic_fetch_add(&delivered_messages, 1);
+}
+
+void P_start(void *instance_data)
+{
+    mato_start_thread("P", 0, module_P_thread, instance_data);
+}
+
+void R_start(void *instance_data)
+{
+    module_bench_instance_data *data = (module_bench_instance_data *)instance_data;
+    data->subscription_id = mato_subscribe(data->module_id, mato_get_module_id("P1"), 0, message_from_producer, direct_data_ptr);
+    readers[number_of_readers++] = data;
+
+    // something to borrow
+    int *val = (int *)mato_get_data_buffer(sizeof(int));
+    *val = data->module_id;
+    mato_post_data(data->module_id, 0, sizeof(int), val);
+    usleep(100000);
+
+    char name[13];
+    sprintf(name, "R%d", data->module_id);
+    mato_start_thread(name, 0, module_R_thread, data);
+}
+
+void bench_delete(void *instance_data)
+{
+    free(instance_data);
+}
+
+void bench_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+void bench_print_latencies()
+{
+    int producer = mato_get_module_id("P1");
+    for (int i = 0; i < number_of_readers; i++)
+    {
+        mato_channel_stats stats;
+        if (!mato_get_channel_stats(producer, 0, readers[i]->subscription_id, &stats)) continue;
+        printf("  R%d post->callback: p50 %lld us, p99 %lld us, p99.9 %lld us, max %lld us; callback: mean %.1f us, max %lld us\n",
+               i + 1, stats.post_to_dispatch.p50, stats.post_to_dispatch.p99, stats.post_to_dispatch.p999, stats.post_to_dispatch.max,
+               stats.dispatch_to_return.mean, stats.dispatch_to_return.max);
+    }
+}
+
+static module_specification P_specification = { bench_create_instance, P_start, bench_delete, bench_global_message, 1 };
+static module_specification R_specification = { bench_create_instance, R_start, bench_delete, bench_global_message, 1 };
+
+void bench_init()
+{
+    mato_register_new_type_of_module("P", &P_specification);
+    mato_register_new_type_of_module("R", &R_specification);
+}
@@ -0,0 +1,22 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdatomic.h>
+
+#define MAX_READERS 16
+
+/// how long the benchmark runs (in seconds)
+extern int bench_seconds;
+
+/// counters of the operations done by all the modules
+extern atomic_long posted_messages;
+extern atomic_long delivered_messages;
+extern atomic_long borrowed_and_released;
+extern atomic_long polled_into;
+
+void bench_init();
+
+/// Print the delivery latencies of the messages of the producer to the readers.
+void bench_print_latencies();
+
+#endif
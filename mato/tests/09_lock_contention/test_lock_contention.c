@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../../mato.h"
+#include "bench.h"
+
+int main(int argc, char **argv)
+{
+    int number_of_readers = 4;
+    bench_seconds = 5;
+    if (argc > 1) sscanf(argv[1], "%d", &number_of_readers);
+    if (argc > 2) sscanf(argv[2], "%d", &bench_seconds);
+    if (number_of_readers > MAX_READERS) number_of_readers = MAX_READERS;
+
+    printf("initializing framework...\n");
+    mato_init(0, 0);
+    bench_init();
+
+    int modules[MAX_READERS + 1];
+    modules[0] = mato_create_new_module_instance("P", "P1");
+    for (int i = 1; i <= number_of_readers; i++)
+    {
+        char name[10];
+        sprintf(name, "R%d", i);
+        modules[i] = mato_create_new_module_instance("R", name);
+    }
+
+    printf("running the benchmark with 1 producer and %d readers for %d seconds...\n", number_of_readers, bench_seconds);
+    mato_start();
+    mato_memory_pool_allocation_rate();
+    mato_metrics *metrics_at_start = mato_get_metrics(0);
+
+    sleep(1);
+    while (program_runs && (mato_threads_running() > 0)) sleep(1);
+
+    printf("posted:            %10.0f messages/s\n", (double)posted_messages / bench_seconds);
+    printf("delivered:         %10.0f callbacks/s\n", (double)delivered_messages / bench_seconds);
+    printf("borrow + release:  %10.0f pairs/s\n", (double)borrowed_and_released / bench_seconds);
+    printf("get_data_into:     %10.0f reads/s\n", (double)polled_into / bench_seconds);
+    printf("buffer allocations:%10.0f per s\n", mato_memory_pool_allocation_rate());
+
+    int block_size, blocks_allocated, blocks_in_use, high_water_mark;
+    for (int size_class = 0; mato_memory_pool_usage(size_class, &block_size, &blocks_allocated, &blocks_in_use, &high_water_mark); size_class++)
+        if (blocks_allocated)
+            printf("  pool blocks of %6d bytes: %d allocated from the system, %d in use, at most %d in use\n",
+                   block_size, blocks_allocated, blocks_in_use, high_water_mark);
+
+    bench_print_latencies();
+
+    mato_metrics *metrics = mato_get_metrics(metrics_at_start);
+    printf("framework metrics:\n");
+    mato_write_metrics(stdout, metrics);
+    mato_free_metrics(metrics);
+    mato_free_metrics(metrics_at_start);
+
+    for (int i = 0; i <= number_of_readers; i++)
+        mato_delete_module_instance(modules[i]);
+
+    mato_shutdown();
+
+    printf("main program terminates.\n");
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../../mato.h"
+#include "SV.h"
+
+module_V_instance_data *viewers[MAX_VIEWERS];
+volatile int sensor_finished;
+mato_timer_stats sensor_timer_stats;
+
+static viewer_config *viewer_configs;
+static int viewers_created;
+
+typedef struct {
+           int module_id;
+           int posted;
+        } module_S_instance_data;
+
+void *S_create_instance(int module_id)
+{
+    module_S_instance_data *data = (module_S_instance_data *)malloc(sizeof(module_S_instance_data));
+    data->module_id = module_id;
+    data->posted = 0;
+    sensor_finished = 0;
+    return data;
+}
+
+/// The sensor posts its samples much faster than the viewers can process them. It has no thread of its own,
+/// the samples are posted by a periodic timer.
+void post_sample(void *instance_data, int timer_id)
+{
+    module_S_instance_data *data = (module_S_instance_data *)instance_data;
+    int *val = (int *)mato_get_data_buffer(sizeof(int));
+    *val = ++data->posted;
+    mato_post_data(data->module_id, 0, sizeof(int), val);
+    if (data->posted == NUMBER_OF_SAMPLES)
+    {
+        mato_get_timer_stats(timer_id, &sensor_timer_stats);
+        mato_remove_timer(timer_id);
+        sensor_finished = 1;
+    }
+}
+
+/// The viewers have subscribed meanwhile, start posting.
+void start_posting(void *instance_data, int timer_id)
+{
+    module_S_instance_data *data = (module_S_instance_data *)instance_data;
+    mato_add_timer(data->module_id, SAMPLE_PERIOD, post_sample);
+}
+
+void S_start(void *instance_data)
+{
+    module_S_instance_data *data = (module_S_instance_data *)instance_data;
+    mato_add_one_shot_timer(data->module_id, 1000000, start_posting);  // let the viewers subscribe
+}
+
+void *V_create_instance(int module_id)
+{
+    module_V_instance_data *data = (module_V_instance_data *)malloc(sizeof(module_V_instance_data));
+    data->module_id = module_id;
+    data->config = viewer_configs[viewers_created];
+    data->received = 0;
+    data->last_value = 0;
+    viewers[viewers_created++] = data;
+    return data;
+}
+
+/// A slow viewer: each sample takes 2 ms to process.
+void sample_arrived(void *instance_data, int sender_module_id, int data_length, void *new_data_ptr)
+{
+    module_V_instance_data *data = (module_V_instance_data *)instance_data;
+    data->received++;
+    data->last_value = *(int *)new_data_ptr;
+    usleep(2000);
+}
+
+void V_start(void *instance_data)
+{
+    module_V_instance_data *data = (module_V_instance_data *)instance_data;
+    data->subscription_id = mato_subscribe_with_policy(data->module_id, mato_get_module_id("S1"), 0, sample_arrived,
+                                                       data->config.subscription_type, data->config.policy, data->config.max_pending);
+    if (data->config.budget > 0)
+        mato_set_callback_budget(mato_get_module_id("S1"), 0, data->subscription_id, data->config.budget, 1);
+}
+
+void SV_delete(void *instance_data)
+{
+    free(instance_data);
+}
+
+void SV_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+static module_specification S_specification = { S_create_instance, S_start, SV_delete, SV_global_message, 1 };
+static module_specification V_specification = { V_create_instance, V_start, SV_delete, SV_global_message, 0 };
+
+void SV_init(viewer_config *configs_of_viewers)
+{
+    viewer_configs = configs_of_viewers;
+    viewers_created = 0;
+    mato_register_new_type_of_module("S", &S_specification);
+    mato_register_new_type_of_module("V", &V_specification);
+}
@@ -0,0 +1,39 @@
+#ifndef __SV_H__
+#define __SV_H__
+
+/// number of samples posted by the sensor module
+#define NUMBER_OF_SAMPLES 500
+
+/// the sensor posts a sample every SAMPLE_PERIOD microseconds
+#define SAMPLE_PERIOD 250
+
+#define MAX_VIEWERS 10
+
+/// how the viewer modules subscribe to the sensor
+typedef struct {
+           int subscription_type;
+           subscription_queue_policy policy;
+           int max_pending;
+           /// time budget of the callback in microseconds (0 = unlimited), the subscription is degraded when it is exceeded
+           long budget;
+        } viewer_config;
+
+/// what has a viewer module received
+typedef struct {
+           int module_id;
+           int subscription_id;
+           viewer_config config;
+           int received;
+           int last_value;
+        } module_V_instance_data;
+
+/// instance data of the viewers in the order they have been created
+extern module_V_instance_data *viewers[];
+
+/// set when the sensor has posted all samples, together with the statistics of its timer
+extern volatile int sensor_finished;
+extern mato_timer_stats sensor_timer_stats;
+
+void SV_init(viewer_config *configs_of_viewers);
+
+#endif
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../../mato.h"
+#include "SV.h"
+
+#define NUMBER_OF_VIEWERS 4
+
+#define RECORDING_FILE "logs/latest_only.rec"
+
+static viewer_config configs[NUMBER_OF_VIEWERS] = {
+    { direct_data_ptr, queue_all, 0, 0 },
+    { direct_data_ptr, keep_last_n, 4, 0 },
+    { latest_only, coalesce_to_latest, 1, 0 },
+    { direct_data_ptr, queue_all, 0, 1000 }
+};
+
+static char *descriptions[NUMBER_OF_VIEWERS] = { "all messages", "keep last 4", "latest only", "budget 1 ms" };
+
+int main(int argc, char **argv)
+{
+    printf("initializing framework...\n");
+    mato_init(0, 0);
+    SV_init(configs);
+
+    int sensor = mato_create_new_module_instance("S", "S1");
+    int viewer_ids[NUMBER_OF_VIEWERS];
+    for (int i = 0; i < NUMBER_OF_VIEWERS; i++)
+    {
+        char name[10];
+        sprintf(name, "V%d", i + 1);
+        viewer_ids[i] = mato_create_new_module_instance("V", name);
+    }
+
+    // the samples of the sensor are recorded, the recording can be replayed by the 11_replay demo
+    if (!mato_start_recording(RECORDING_FILE, "S1"))
+        printf("could not start recording into %s\n", RECORDING_FILE);
+
+    printf("sensor posts %d samples every %d us, the viewers need 2 ms for each...\n", NUMBER_OF_SAMPLES, SAMPLE_PERIOD);
+    mato_start();
+
+    while (program_runs && !sensor_finished) usleep(10000);
+    printf("sensor timer: %ld expirations, %ld missed, jitter p50 %lld us, p99 %lld us, max %lld us\n",
+           sensor_timer_stats.expirations, sensor_timer_stats.missed, sensor_timer_stats.jitter.p50,
+           sensor_timer_stats.jitter.p99, sensor_timer_stats.jitter.max);
+    // the viewer that receives all messages is still far behind
+    sleep(2);
+
+    for (int i = 0; i < NUMBER_OF_VIEWERS; i++)
+    {
+        module_V_instance_data *data = viewers[i];
+        printf("%-14s received %4d, dropped %4ld, last value %d\n", descriptions[i], data->received,
+               mato_subscription_dropped(sensor, 0, data->subscription_id), data->last_value);
+    }
+    mato_log_callback_profiles();
+
+    mato_stop_recording();
+    mato_recording_stats recording;
+    mato_get_recording_stats(&recording);
+    printf("recorded %ld samples (%lld bytes) into %s, %ld dropped\n", recording.messages, recording.bytes, RECORDING_FILE, recording.dropped);
+
+    for (int i = 0; i < NUMBER_OF_VIEWERS; i++)
+        mato_delete_module_instance(viewer_ids[i]);
+    mato_delete_module_instance(sensor);
+    mato_shutdown();
+
+    printf("main program terminates.\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../../mato.h"
+
+/// recorded by the 10_latest_only demo
+#define RECORDING_FILE "logs/latest_only.rec"
+
+typedef struct {
+           int module_id;
+           int received;
+           int last_value;
+        } module_V_instance_data;
+
+/// the viewer of the current replay
+static module_V_instance_data *viewer;
+
+void *V_create_instance(int module_id)
+{
+    module_V_instance_data *data = (module_V_instance_data *)malloc(sizeof(module_V_instance_data));
+    data->module_id = module_id;
+    data->received = 0;
+    data->last_value = 0;
+    viewer = data;
+    return data;
+}
+
+/// A slow viewer: each sample takes 2 ms to process.
+void sample_arrived(void *instance_data, int sender_module_id, int data_length, void *new_data_ptr)
+{
+    module_V_instance_data *data = (module_V_instance_data *)instance_data;
+    data->received++;
+    data->last_value = *(int *)new_data_ptr;
+    usleep(2000);
+}
+
+/// The sensor S1 is created by the replay.
+void V_start(void *instance_data)
+{
+    module_V_instance_data *data = (module_V_instance_data *)instance_data;
+    mato_subscribe(data->module_id, mato_get_module_id("S1"), 0, sample_arrived, direct_data_ptr);
+}
+
+void V_delete(void *instance_data)
+{
+    free(instance_data);
+}
+
+void V_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+static module_specification V_specification = { V_create_instance, V_start, V_delete, V_global_message, 0 };
+
+/// Replay the recording to a new viewer at the speed, and print how long it took.
+static void replay(double speed, char *description, int first_run)
+{
+    int replay_id = mato_create_replay(RECORDING_FILE, speed);
+    if (replay_id < 0)
+    {
+        printf("could not replay %s, run test_latest_only first\n", RECORDING_FILE);
+        return;
+    }
+    int viewer_id = mato_create_new_module_instance("V", "V1");
+    if (first_run) mato_start();
+    else
+    {
+        mato_start_module(viewer_id);
+        mato_start_module(replay_id);
+    }
+
+    mato_replay_stats stats;
+    while (program_runs && mato_get_replay_stats(replay_id, &stats) && !stats.finished) usleep(10000);
+    int received = viewer->received;
+    // unless in the lockstep, the viewer may still be behind
+    while (program_runs && (viewer->received < stats.messages)) usleep(10000);
+
+    printf("%-9s posted %ld samples in %5lld ms, the viewer had received %d of them by then, last value %d\n",
+           description, stats.messages, stats.duration / 1000, received, viewer->last_value);
+
+    mato_delete_module_instance(viewer_id);
+    mato_delete_module_instance(replay_id);
+}
+
+int main(int argc, char **argv)
+{
+    printf("initializing framework...\n");
+    mato_init(0, 0);
+    mato_register_new_type_of_module("V", &V_specification);
+
+    replay(MATO_REPLAY_LOCKSTEP, "lockstep", 1);
+    replay(4, "4x speed", 0);
+    replay(1, "real time", 0);
+
+    mato_shutdown();
+
+    printf("main program terminates.\n");
+    return 0;
+}
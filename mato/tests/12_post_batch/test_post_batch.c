@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../../mato.h"
+
+#define NUMBER_OF_FRAMES 200
+#define FRAME_PERIOD 5000
+
+/// the outputs of the detector computed from each frame
+#define CHANNEL_LINES 0
+#define CHANNEL_SEGMENTS 1
+#define CHANNEL_CORNERS 2
+#define NUMBER_OF_OUTPUTS 3
+
+typedef struct {
+           int module_id;
+           int frame;
+        } module_D_instance_data;
+
+/// how many frames can be joined at the same time
+#define FRAMES_IN_PROGRESS 8
+
+typedef struct {
+           int module_id;
+           int detector_id;
+           /// with dispatch workers, the callbacks of different channels can run at the same time
+           pthread_mutex_t lock;
+           /// how many outputs of the frames have arrived, indexed by frame % FRAMES_IN_PROGRESS
+           int outputs[FRAMES_IN_PROGRESS];
+           /// the frame of the previous output
+           int last_frame;
+           int complete_frames;
+           int interleaved_frames;
+           int inconsistent_reads;
+        } module_J_instance_data;
+
+static volatile int detector_finished;
+static module_J_instance_data *joiner;
+
+void *D_create_instance(int module_id)
+{
+    module_D_instance_data *data = (module_D_instance_data *)malloc(sizeof(module_D_instance_data));
+    data->module_id = module_id;
+    data->frame = 0;
+    detector_finished = 0;
+    return data;
+}
+
+/// The detector processes a frame and posts all its outputs in a single batch, marked with the number of the frame.
+void process_frame(void *instance_data, int timer_id)
+{
+    module_D_instance_data *data = (module_D_instance_data *)instance_data;
+    int channels[NUMBER_OF_OUTPUTS] = { CHANNEL_LINES, CHANNEL_SEGMENTS, CHANNEL_CORNERS };
+    int lengths[NUMBER_OF_OUTPUTS];
+    void *outputs[NUMBER_OF_OUTPUTS];
+    data->frame++;
+    for (int i = 0; i < NUMBER_OF_OUTPUTS; i++)
+    {
+        int *val = (int *)mato_get_data_buffer(sizeof(int));
+        *val = data->frame * 10 + i;
+        lengths[i] = sizeof(int);
+        outputs[i] = val;
+    }
+    mato_post_data_batch(data->module_id, NUMBER_OF_OUTPUTS, channels, lengths, outputs, data->frame);
+    if (data->frame == NUMBER_OF_FRAMES)
+    {
+        mato_remove_timer(timer_id);
+        detector_finished = 1;
+    }
+}
+
+/// The joiner has subscribed meanwhile, start detecting.
+void start_detecting(void *instance_data, int timer_id)
+{
+    module_D_instance_data *data = (module_D_instance_data *)instance_data;
+    mato_add_timer(data->module_id, FRAME_PERIOD, process_frame);
+}
+
+void D_start(void *instance_data)
+{
+    module_D_instance_data *data = (module_D_instance_data *)instance_data;
+    mato_add_one_shot_timer(data->module_id, 500000, start_detecting);
+}
+
+void *J_create_instance(int module_id)
+{
+    module_J_instance_data *data = (module_J_instance_data *)calloc(1, sizeof(module_J_instance_data));
+    data->module_id = module_id;
+    pthread_mutex_init(&data->lock, 0);
+    joiner = data;
+    return data;
+}
+
+/// The outputs of a frame are joined by the frame id. When the first of them arrives, the other outputs of the same frame
+/// are already the latest data of their channels.
+void output_arrived(void *instance_data, int sender_module_id, int data_length, void *new_data_ptr)
+{
+    module_J_instance_data *data = (module_J_instance_data *)instance_data;
+    int frame = mato_data_frame_id(new_data_ptr);
+    pthread_mutex_lock(&data->lock);
+        // an output of another frame arrived before the previous frame was complete
+        if ((frame != data->last_frame) && (data->outputs[data->last_frame % FRAMES_IN_PROGRESS] != 0))
+            data->interleaved_frames++;
+        data->last_frame = frame;
+        int first_output = (data->outputs[frame % FRAMES_IN_PROGRESS]++ == 0);
+        if (data->outputs[frame % FRAMES_IN_PROGRESS] == NUMBER_OF_OUTPUTS)
+        {
+            data->complete_frames++;
+            data->outputs[frame % FRAMES_IN_PROGRESS] = 0;
+        }
+    pthread_mutex_unlock(&data->lock);
+
+    if (first_output)
+    {
+        int length;
+        void *corners;
+        mato_get_data(sender_module_id, CHANNEL_CORNERS, &length, &corners);
+        if ((corners == 0) || (*(int *)corners / 10 < frame)) data->inconsistent_reads++;
+        free(corners);
+    }
+}
+
+void J_start(void *instance_data)
+{
+    module_J_instance_data *data = (module_J_instance_data *)instance_data;
+    data->detector_id = mato_get_module_id("D1");
+    for (int channel = 0; channel < NUMBER_OF_OUTPUTS; channel++)
+        mato_subscribe(data->module_id, data->detector_id, channel, output_arrived, direct_data_ptr);
+}
+
+void D_delete(void *instance_data)
+{
+    free(instance_data);
+}
+
+void J_delete(void *instance_data)
+{
+    module_J_instance_data *data = (module_J_instance_data *)instance_data;
+    pthread_mutex_destroy(&data->lock);
+    free(data);
+}
+
+void DJ_global_message(void *instance_data, int module_id_sender, int message_id, int msg_length, void *message_data)
+{
+}
+
+static module_specification D_specification = { D_create_instance, D_start, D_delete, DJ_global_message, NUMBER_OF_OUTPUTS };
+static module_specification J_specification = { J_create_instance, J_start, J_delete, DJ_global_message, 0 };
+
+int main(int argc, char **argv)
+{
+    printf("initializing framework...\n");
+    mato_init(0, 0);
+    mato_register_new_type_of_module("D", &D_specification);
+    mato_register_new_type_of_module("J", &J_specification);
+
+    int detector = mato_create_new_module_instance("D", "D1");
+    int joiner_id = mato_create_new_module_instance("J", "J1");
+    mato_add_start_dependency(joiner_id, detector);
+
+    printf("detector posts %d outputs of each of %d frames in batches...\n", NUMBER_OF_OUTPUTS, NUMBER_OF_FRAMES);
+    mato_start();
+
+    while (program_runs && !detector_finished) usleep(10000);
+    usleep(100000);
+
+    printf("joiner received %d complete frames (of %d), %d interleaved with another frame, %d inconsistent reads of the corners\n",
+           joiner->complete_frames, NUMBER_OF_FRAMES, joiner->interleaved_frames, joiner->inconsistent_reads);
+
+    mato_delete_module_instance(joiner_id);
+    mato_delete_module_instance(detector);
+    mato_shutdown();
+
+    printf("main program terminates.\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+/// \file mato_metrics_view.c
+/// Renders the last snapshot of a metrics file written by the Mato control framework (see the metrics_interval variable
+/// of the framework config and mato_metrics.h for the format) as a table.
+/// Usage: mato_metrics_view [-f] metrics_file
+/// With -f, the file is followed and the table is redrawn whenever a new snapshot is appended.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define MAX_LINE 512
+
+/// The lines of the last complete snapshot found in the file.
+static char **snapshot_lines;
+static int number_of_lines;
+
+/// Lines of the snapshot that is being read.
+static char **reading_lines;
+static int number_of_reading_lines;
+static int reading_capacity;
+
+static void free_lines(char **lines, int count)
+{
+    for (int i = 0; i < count; i++) free(lines[i]);
+    free(lines);
+}
+
+/// Read the file from the offset to the end, and remember the last complete snapshot. Returns the new offset,
+/// which is the start of an incomplete line at the end of the file, if there is one.
+static long read_snapshots(FILE *f, long offset, int *found_new)
+{
+    char line[MAX_LINE];
+    *found_new = 0;
+    fseek(f, offset, SEEK_SET);
+    while (fgets(line, MAX_LINE, f))
+    {
+        int length = strlen(line);
+        if ((length == 0) || (line[length - 1] != '\n')) break;   // still being written
+        offset = ftell(f);
+        line[length - 1] = 0;
+
+        if (strncmp(line, "snapshot ", 9) == 0)
+        {
+            free_lines(reading_lines, number_of_reading_lines);
+            reading_lines = 0;
+            number_of_reading_lines = reading_capacity = 0;
+        }
+        if (number_of_reading_lines == reading_capacity)
+        {
+            reading_capacity = reading_capacity ? 2 * reading_capacity : 64;
+            reading_lines = (char **)realloc(reading_lines, reading_capacity * sizeof(char *));
+        }
+        reading_lines[number_of_reading_lines++] = strdup(line);
+
+        if (strcmp(line, "end") == 0)
+        {
+            free_lines(snapshot_lines, number_of_lines);
+            snapshot_lines = reading_lines;
+            number_of_lines = number_of_reading_lines;
+            reading_lines = 0;
+            number_of_reading_lines = reading_capacity = 0;
+            *found_new = 1;
+        }
+    }
+    clearerr(f);
+    return offset;
+}
+
+/// Format a number of bytes with a unit.
+static char *human_bytes(double bytes, char *buffer)
+{
+    static const char *units[] = { "B", "kB", "MB", "GB", "TB" };
+    int unit = 0;
+    while ((bytes >= 1024) && (unit < 4))
+    {
+        bytes /= 1024;
+        unit++;
+    }
+    sprintf(buffer, (unit == 0) ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return buffer;
+}
+
+static void render_snapshot()
+{
+    char b1[32], b2[32], b3[32], b4[32];
+    for (int i = 0; i < number_of_lines; i++)
+    {
+        char *ln = snapshot_lines[i];
+        long unix_time;
+        int node_id, a, b, c, d, e;
+        long dropped;
+        int queued = 0;
+        long send_dropped = 0;
+        double interval, r1, r2;
+        long long sent, received;
+        char name[MAX_LINE];
+        long messages;
+        long long bytes;
+
+        if (sscanf(ln, "snapshot %ld %d %lf", &unix_time, &node_id, &interval) == 3)
+        {
+            time_t t = unix_time;
+            char tm[40];
+            strftime(tm, sizeof(tm), "%Y-%m-%d %H:%M:%S", localtime(&t));
+            printf("node %d at %s (rates over %.1f s)\n\n", node_id, tm, interval);
+        }
+        else if (sscanf(ln, "queues %d %ld %d %d", &a, &dropped, &b, &c) == 4)
+            printf("post queue: %d waiting, %ld dropped   pending deliveries: %d   dangling buffers: %d\n", a, dropped, b, c);
+        else if (sscanf(ln, "threads %d %d %d", &a, &b, &c) == 3)
+            printf("threads: %d module, %d framework, %d dispatch workers\n\n"
+                   "%5s %7s %8s %12s %12s %12s %12s %8s %8s\n", a, b, c, "node", "online", "modules", "sent", "received", "sent/s", "received/s",
+                   "queued", "dropped");
+        // the older metrics files have no send queues
+        else if (sscanf(ln, "net %d %d %d %lld %lld %lf %lf %d %ld", &node_id, &a, &b, &sent, &received, &r1, &r2, &queued, &send_dropped) >= 7)
+            printf("%5d %7s %8d %12s %12s %12s %12s %8d %8ld\n", node_id, a ? "yes" : "no", b, human_bytes(sent, b1),
+                   human_bytes(received, b2), human_bytes(r1, b3), human_bytes(r2, b4), queued, send_dropped);
+        else if (sscanf(ln, "channel %d %d %s %ld %lld %lf %lf %d %d %d", &a, &b, name, &messages, &bytes, &r1, &r2, &c, &d, &e) == 10)
+        {
+            if ((i == 0) || (strncmp(snapshot_lines[i - 1], "channel ", 8) != 0))
+                printf("\n%8s %-20s %3s %10s %12s %9s %12s %5s %7s %5s\n", "module", "name", "ch", "messages", "bytes",
+                       "msg/s", "bytes/s", "subs", "buffers", "refs");
+            printf("%8d %-20s %3d %10ld %12s %9.1f %12s %5d %7d %5d\n", a, name, b, messages, human_bytes(bytes, b1), r1,
+                   human_bytes(r2, b2), c, d, e);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int follow = 0;
+    char *filename = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0) follow = 1;
+        else filename = argv[i];
+    }
+    if (filename == 0)
+    {
+        printf("usage: %s [-f] metrics_file\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(filename, "r");
+    if (f == 0)
+    {
+        perror(filename);
+        return 1;
+    }
+
+    int found_new;
+    long offset = read_snapshots(f, 0, &found_new);
+    if (!follow)
+    {
+        if (number_of_lines == 0) printf("no complete snapshot in %s\n", filename);
+        else render_snapshot();
+    }
+    else while (1)
+    {
+        if (found_new)
+        {
+            printf("\033[H\033[2J");
+            render_snapshot();
+            fflush(stdout);
+        }
+        sleep(1);
+        offset = read_snapshots(f, offset, &found_new);
+    }
+
+    fclose(f);
+    free_lines(snapshot_lines, number_of_lines);
+    free_lines(reading_lines, number_of_reading_lines);
+    return 0;
+}